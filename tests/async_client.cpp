@@ -0,0 +1,114 @@
+#include <catch.hpp>
+#include <zmq_addon.hpp>
+
+#ifdef ZMQ_CPP11
+#include <thread>
+
+TEST_CASE("timer wheel expiration", "[async_client]")
+{
+    const auto start = zmq::timer_wheel_t::clock::now();
+    zmq::timer_wheel_t wheel(std::chrono::milliseconds{10}, 8);
+    CHECK(wheel.empty());
+    CHECK(wheel.next_timeout(start).count() == -1);
+
+    wheel.schedule(1, std::chrono::milliseconds{25}, start);
+    wheel.schedule(2, std::chrono::milliseconds{5}, start);
+    // beyond one revolution of the wheel
+    wheel.schedule(3, std::chrono::milliseconds{200}, start);
+    CHECK(wheel.size() == 3);
+    CHECK(wheel.next_timeout(start).count() > 0);
+    CHECK(wheel.next_timeout(start).count() <= 30);
+
+    std::vector<uint64_t> expired;
+    auto collect = [&expired](uint64_t key) { expired.push_back(key); };
+    CHECK(wheel.advance(collect, start) == 0);
+    CHECK(wheel.advance(collect, start + std::chrono::milliseconds{15}) == 1);
+    CHECK(wheel.advance(collect, start + std::chrono::milliseconds{20}) == 0);
+    CHECK(wheel.advance(collect, start + std::chrono::milliseconds{60}) == 1);
+    REQUIRE(expired.size() == 2);
+    CHECK(expired[0] == 2);
+    CHECK(expired[1] == 1);
+    const auto later = start + std::chrono::milliseconds{60};
+    CHECK(wheel.next_timeout(later).count() >= 140);
+
+    CHECK(wheel.advance(collect, start + std::chrono::milliseconds{150}) == 0);
+    CHECK(wheel.advance(collect, start + std::chrono::milliseconds{250}) == 1);
+    CHECK(expired.back() == 3);
+    CHECK(wheel.empty());
+}
+
+TEST_CASE("async client out of order replies", "[async_client]")
+{
+    zmq::context_t context;
+    zmq::socket_t router(context, zmq::socket_type::router);
+    zmq::socket_t dealer(context, zmq::socket_type::dealer);
+    router.bind("inproc://async-client");
+    dealer.connect("inproc://async-client");
+
+    const int n = 1000;
+    std::thread server([&] {
+        std::vector<std::vector<zmq::message_t>> requests(n);
+        for (auto &request : requests)
+            REQUIRE(zmq::recv_multipart(router, std::back_inserter(request)));
+        // reply in reverse order, echoing the envelope
+        for (auto it = requests.rbegin(); it != requests.rend(); ++it)
+            REQUIRE(zmq::send_multipart(router, *it));
+    });
+
+    zmq::async_client_t client(dealer);
+    std::vector<int> replies(n, -1);
+    for (int i = 0; i < n; ++i) {
+        const std::string payload = std::to_string(i);
+        std::array<zmq::const_buffer, 1> parts = {zmq::buffer(payload)};
+        client.send(parts, std::chrono::milliseconds{10000},
+                    [&replies, i](zmq::request_status status,
+                                  zmq::multipart_t &&reply) {
+                        CHECK(status == zmq::request_status::ok);
+                        REQUIRE(reply.size() == 1);
+                        replies[i] = std::stoi(reply.peekstr(0));
+                    });
+    }
+    CHECK(client.pending() == n);
+
+    size_t completed = 0;
+    while (client.pending() > 0)
+        completed += client.process(std::chrono::milliseconds{1000});
+    server.join();
+    CHECK(completed == n);
+    for (int i = 0; i < n; ++i)
+        CHECK(replies[i] == i);
+}
+
+TEST_CASE("async client futures and timeouts", "[async_client]")
+{
+    zmq::context_t context;
+    zmq::socket_t rep(context, zmq::socket_type::rep);
+    zmq::socket_t dealer(context, zmq::socket_type::dealer);
+    rep.bind("inproc://async-client-rep");
+    dealer.connect("inproc://async-client-rep");
+
+    zmq::async_client_t client(dealer);
+    std::array<zmq::const_buffer, 1> ping = {zmq::str_buffer("ping")};
+    auto answered = client.send(ping, std::chrono::milliseconds{10000});
+    auto unanswered = client.send(ping, std::chrono::milliseconds{20});
+
+    // REP socket answers the first request only
+    zmq::message_t request;
+    REQUIRE(rep.recv(request));
+    CHECK(request.to_string() == "ping");
+    REQUIRE(rep.send(zmq::str_buffer("pong"), zmq::send_flags::none));
+
+    while (client.pending() > 0)
+        client.process(std::chrono::milliseconds{1000});
+
+    zmq::multipart_t reply = answered.get();
+    REQUIRE(reply.size() == 1);
+    CHECK(reply.peekstr(0) == "pong");
+    CHECK_THROWS_AS(unanswered.get(), const zmq::request_timeout_error &);
+
+    // the late reply to the timed out request is discarded
+    REQUIRE(rep.recv(request));
+    REQUIRE(rep.send(zmq::str_buffer("late"), zmq::send_flags::none));
+    CHECK(client.process(std::chrono::milliseconds{50}) == 0);
+}
+#endif
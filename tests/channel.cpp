@@ -0,0 +1,102 @@
+#include <catch.hpp>
+#include <zmq_addon.hpp>
+
+#if defined(ZMQ_CPP11) && !defined(_WIN32)
+#include <thread>
+
+TEST_CASE("channel send recv", "[channel]")
+{
+    zmq::channel_t channel(3);
+    CHECK(channel.capacity() == 4);
+
+    zmq::message_t msg;
+    CHECK_FALSE(channel.recv(msg, zmq::recv_flags::dontwait));
+
+    zmq::message_t big(std::string(1000, 'x'));
+    auto sret = channel.send(big);
+    REQUIRE(sret);
+    CHECK(*sret == 1000);
+    CHECK(big.size() == 0);
+    CHECK(channel.send(zmq::message_t("ab", 2)));
+    CHECK(channel.send(zmq::str_buffer("cde")));
+    CHECK(channel.send(zmq::str_buffer("f")));
+    CHECK_FALSE(channel.send(zmq::str_buffer("g"), zmq::send_flags::dontwait));
+
+    auto rret = channel.recv(msg);
+    REQUIRE(rret);
+    CHECK(*rret == 1000);
+    CHECK(msg.to_string() == std::string(1000, 'x'));
+    REQUIRE(channel.recv(msg));
+    CHECK(msg.to_string() == "ab");
+    // a slot is free again
+    CHECK(channel.send(zmq::str_buffer("g"), zmq::send_flags::dontwait));
+    for (const char *expected : {"cde", "f", "g"}) {
+        REQUIRE(channel.recv(msg, zmq::recv_flags::dontwait));
+        CHECK(msg.to_string() == expected);
+    }
+    CHECK_FALSE(channel.recv(msg, zmq::recv_flags::dontwait));
+
+    // pending messages are released by the destructor
+    CHECK(channel.send(zmq::message_t(std::string(100, 'y'))));
+}
+
+TEST_CASE("channel fd signals pending messages", "[channel]")
+{
+    zmq::channel_t channel;
+    zmq::pollitem_t items[] = {{nullptr, channel.fd(), ZMQ_POLLIN, 0}};
+    CHECK(zmq::poll(items, 1, std::chrono::milliseconds{0}) == 0);
+
+    CHECK(channel.send(zmq::str_buffer("a")));
+    CHECK(channel.send(zmq::str_buffer("b")));
+    CHECK(zmq::poll(items, 1, std::chrono::milliseconds{0}) == 1);
+
+    zmq::message_t msg;
+    REQUIRE(channel.recv(msg, zmq::recv_flags::dontwait));
+    REQUIRE(channel.recv(msg, zmq::recv_flags::dontwait));
+    CHECK(msg.to_string() == "b");
+    // the wakeup is consumed once the channel is found empty
+    CHECK_FALSE(channel.recv(msg, zmq::recv_flags::dontwait));
+    CHECK(zmq::poll(items, 1, std::chrono::milliseconds{0}) == 0);
+
+#if defined(ZMQ_BUILD_DRAFT_API) && defined(ZMQ_HAVE_POLLER)
+    zmq::poller_t<zmq::channel_t> poller;
+    poller.add_fd(channel.fd(), zmq::event_flags::pollin, &channel);
+    std::vector<zmq::poller_event<zmq::channel_t>> events(1);
+    CHECK(poller.wait_all(events, std::chrono::milliseconds{0}) == 0);
+    CHECK(channel.send(zmq::str_buffer("c")));
+    REQUIRE(poller.wait_all(events, std::chrono::milliseconds{0}) == 1);
+    CHECK(events[0].user_data == &channel);
+    CHECK(events[0].fd == channel.fd());
+    poller.remove_fd(channel.fd());
+#endif
+}
+
+TEST_CASE("channel multiple producers", "[channel]")
+{
+    zmq::channel_t channel(64);
+    const int producers = 4;
+    const int n = 20000;
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&channel, p] {
+            for (int i = 0; i < n; ++i) {
+                const int value[2] = {p, i};
+                channel.send(zmq::buffer(value));
+            }
+        });
+    }
+
+    std::vector<int> next(producers, 0);
+    zmq::message_t msg;
+    for (int k = 0; k < producers * n; ++k) {
+        REQUIRE(channel.recv(msg));
+        REQUIRE(msg.size() == 2 * sizeof(int));
+        const int *value = msg.data<int>();
+        // messages of each producer arrive in order
+        CHECK(value[1] == next[value[0]]++);
+    }
+    for (auto &t : threads)
+        t.join();
+    CHECK_FALSE(channel.recv(msg, zmq::recv_flags::dontwait));
+}
+#endif
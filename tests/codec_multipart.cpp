@@ -207,4 +207,160 @@ TEST_CASE("multipart codec static method decode to multipart_t", "[codec_multipa
 }
 
 
+TEST_CASE("multipart codec compact empty", "[codec_multipart]")
+{
+    using namespace zmq;
+    std::vector<message_t> parts;
+    auto msg = encode_compact(parts);
+    CHECK(msg.size() == 2);
+
+    std::vector<message_t> parts2;
+    decode_compact(msg, std::back_inserter(parts2));
+    CHECK(parts2.empty());
+}
+
+TEST_CASE("multipart codec compact small", "[codec_multipart]")
+{
+    using namespace zmq;
+    multipart_t mmsg;
+    mmsg.addstr("Hello");
+    mmsg.addstr("World!");
+    auto msg = encode_compact(mmsg);
+    // format, count, two one byte sizes
+    CHECK(msg.size() == 1 + 1 + 2 + 5 + 6);
+    CHECK(msg.data<unsigned char>()[2] == 5);
+    CHECK(msg.data<unsigned char>()[4] == 'H');
+
+    multipart_t mmsg2;
+    decode_compact(msg, std::back_inserter(mmsg2));
+    CHECK(mmsg2.size() == 2);
+    CHECK(mmsg2[0].to_string() == "Hello");
+    CHECK(mmsg2[1].to_string() == "World!");
+}
+
+TEST_CASE("multipart codec compact round trip", "[codec_multipart]")
+{
+    using namespace zmq;
+    // sizes of one, two and three varint bytes, runs of each length and
+    // mixed, to cover all paths of the word at a time decoder
+    std::vector<size_t> sizes;
+    for (size_t i = 0; i < 40; ++i)
+        sizes.push_back(i);
+    for (size_t i = 0; i < 24; ++i)
+        sizes.push_back(200 + 37 * i);
+    for (size_t i = 0; i < 100; ++i)
+        sizes.push_back(i % 3 == 0 ? 20 + i : 128 + 2 * i);
+    sizes.push_back(20000);
+    sizes.push_back(3);
+    sizes.push_back(70000);
+
+    std::vector<std::string> data;
+    std::vector<const_buffer> parts;
+    for (size_t i = 0; i < sizes.size(); ++i)
+        data.emplace_back(sizes[i], static_cast<char>('a' + i % 26));
+    for (const auto &d : data)
+        parts.emplace_back(d.data(), d.size());
+
+    auto msg = encode_compact(parts);
+    std::vector<message_t> parts2;
+    decode_compact(msg, std::back_inserter(parts2));
+    REQUIRE(parts2.size() == data.size());
+    for (size_t i = 0; i < data.size(); ++i)
+        CHECK(parts2[i].to_string() == data[i]);
+}
+
+TEST_CASE("multipart codec compact delta sizes", "[codec_multipart]")
+{
+    using namespace zmq;
+    // similar sizes above 255 bytes take two bytes each as plain sizes
+    // and five bytes each with zmq::encode()
+    std::vector<std::string> data;
+    for (size_t i = 0; i < 1000; ++i)
+        data.emplace_back(300 + i % 5, 'x');
+    std::vector<const_buffer> parts;
+    size_t data_size = 0;
+    for (const auto &d : data) {
+        parts.emplace_back(d.data(), d.size());
+        data_size += d.size();
+    }
+
+    auto msg = encode_compact(parts);
+    CHECK(msg.data<unsigned char>()[0] == 1);
+    CHECK(msg.size() == 1 + 2 + 2 + 999 + data_size);
+    CHECK(msg.size() < encode(parts).size());
+
+    std::vector<message_t> parts2;
+    decode_compact(msg, std::back_inserter(parts2));
+    REQUIRE(parts2.size() == data.size());
+    for (size_t i = 0; i < data.size(); ++i)
+        CHECK(parts2[i].size() == data[i].size());
+}
+
+TEST_CASE("multipart codec varint limits", "[codec_multipart]")
+{
+    unsigned char buf[11];
+    const unsigned char *it = buf;
+    uint64_t value = 0;
+    const unsigned char *end = zmq::detail::put_varint(buf, UINT64_MAX);
+    CHECK(end - buf == 10);
+    CHECK(buf[9] == 1);
+    REQUIRE(zmq::detail::get_varint(it, end, value));
+    CHECK(value == UINT64_MAX);
+    CHECK(it == end);
+
+    // bits beyond 64 in the tenth byte, and an eleventh byte
+    buf[9] = 0x02;
+    it = buf;
+    CHECK_FALSE(zmq::detail::get_varint(it, end, value));
+    buf[9] = 0x81;
+    buf[10] = 0;
+    it = buf;
+    CHECK_FALSE(zmq::detail::get_varint(it, buf + 11, value));
+}
+
+TEST_CASE("multipart codec compact decode bad data", "[codec_multipart]")
+{
+    using namespace zmq;
+    std::vector<message_t> parts;
+
+    message_t empty;
+    CHECK_THROWS_AS(decode_compact(empty, std::back_inserter(parts)),
+                    std::out_of_range);
+
+    const unsigned char unknown_format[] = {0x80, 1, 2, 'h', 'i'};
+    message_t msg(unknown_format, sizeof unknown_format);
+    CHECK_THROWS_AS(decode_compact(msg, std::back_inserter(parts)),
+                    std::out_of_range);
+
+    const unsigned char overflow[] = {0, 1, 5, 'h', 'i'};
+    msg.rebuild(overflow, sizeof overflow);
+    CHECK_THROWS_AS(decode_compact(msg, std::back_inserter(parts)),
+                    std::out_of_range);
+
+    const unsigned char extra_data[] = {0, 1, 1, 'h', 'i'};
+    msg.rebuild(extra_data, sizeof extra_data);
+    CHECK_THROWS_AS(decode_compact(msg, std::back_inserter(parts)),
+                    std::out_of_range);
+
+    const unsigned char truncated_size[] = {0, 2, 1, 0x81};
+    msg.rebuild(truncated_size, sizeof truncated_size);
+    CHECK_THROWS_AS(decode_compact(msg, std::back_inserter(parts)),
+                    std::out_of_range);
+
+    const unsigned char too_many_parts[] = {0, 0xFF, 0x01, 1, 'h'};
+    msg.rebuild(too_many_parts, sizeof too_many_parts);
+    CHECK_THROWS_AS(decode_compact(msg, std::back_inserter(parts)),
+                    std::out_of_range);
+
+    // a tenth varint byte may only hold the 64th bit
+    const unsigned char overlong_count[] = {0,    0x80, 0x80, 0x80, 0x80, 0x80,
+                                            0x80, 0x80, 0x80, 0x80, 0x02};
+    msg.rebuild(overlong_count, sizeof overlong_count);
+    CHECK_THROWS_AS(decode_compact(msg, std::back_inserter(parts)),
+                    std::out_of_range);
+
+    CHECK(parts.empty());
+}
+
+
 #endif
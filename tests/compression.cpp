@@ -0,0 +1,247 @@
+#include <catch.hpp>
+#include <zmq_addon.hpp>
+
+#ifdef ZMQ_CPP11
+
+namespace
+{
+std::string compress_roundtrip(zmq::compressor_t &compressor, const std::string &data)
+{
+    std::vector<unsigned char> compressed(compressor.bound(data.size()));
+    const size_t size = compressor.compress(zmq::buffer(data), zmq::buffer(compressed));
+    CHECK(size <= compressed.size());
+    std::string out(data.size(), '\0');
+    CHECK(compressor.decompress(zmq::const_buffer(compressed.data(), size),
+                                zmq::buffer(out)));
+    return out;
+}
+}
+
+TEST_CASE("lz compressor roundtrip", "[compression]")
+{
+    zmq::lz_compressor_t lz;
+    std::string text;
+    for (int i = 0; i < 200; ++i)
+        text += "{\"id\":" + std::to_string(i) + ",\"name\":\"sensor\",\"ok\":true}";
+    std::string random(5000, '\0');
+    uint64_t state = 1;
+    for (auto &c : random)
+        c = static_cast<char>(zmq::detail::next_random(state));
+
+    for (const std::string &data :
+         {std::string(), std::string("abc"), std::string(100000, 'x'), text, random,
+          std::string("abcdabcdabcdabcdabcdabcdabcdabcdabcd")}) {
+        CHECK(compress_roundtrip(lz, data) == data);
+    }
+
+    std::vector<unsigned char> compressed(lz.bound(text.size()));
+    CHECK(lz.compress(zmq::buffer(text), zmq::buffer(compressed)) < text.size() / 4);
+}
+
+TEST_CASE("lz compressor rejects malformed input", "[compression]")
+{
+    zmq::lz_compressor_t lz;
+    const std::string data(1000, 'y');
+    std::vector<unsigned char> compressed(lz.bound(data.size()));
+    const size_t size = lz.compress(zmq::buffer(data), zmq::buffer(compressed));
+    std::string out(data.size(), '\0');
+    for (size_t n = 0; n < size; ++n)
+        CHECK_FALSE(lz.decompress(zmq::const_buffer(compressed.data(), n),
+                                  zmq::buffer(out)));
+    std::string shorter(data.size() - 1, '\0');
+    CHECK_FALSE(lz.decompress(zmq::const_buffer(compressed.data(), size),
+                              zmq::buffer(shorter)));
+    // a match before the start of the output
+    const unsigned char bad_offset[] = {0x10, 'a', 0x02, 0x00};
+    CHECK_FALSE(lz.decompress(zmq::buffer(bad_offset), zmq::buffer(out)));
+}
+
+TEST_CASE("compression codec send recv", "[compression]")
+{
+    zmq::context_t context;
+    zmq::socket_t push(context, zmq::socket_type::push);
+    zmq::socket_t pull(context, zmq::socket_type::pull);
+    pull.bind("inproc://compression");
+    push.connect("inproc://compression");
+
+    zmq::compression_codec_t codec(64);
+    const std::string large(10000, 'z');
+    std::vector<zmq::message_t> parts;
+    parts.emplace_back(std::string("small"));
+    parts.emplace_back(large);
+    parts.emplace_back();
+    auto sret = codec.send(push, parts);
+    REQUIRE(sret);
+    CHECK(*sret == 3);
+    CHECK(codec.statistics().compressed_parts == 1);
+    CHECK(codec.statistics().raw_bytes == large.size());
+    CHECK(codec.statistics().wire_bytes < 100);
+
+    std::vector<zmq::message_t> msgs;
+    auto rret = codec.recv(pull, std::back_inserter(msgs));
+    REQUIRE(rret);
+    CHECK(*rret == 3);
+    REQUIRE(msgs.size() == 3);
+    CHECK(msgs[0].to_string() == "small");
+    CHECK(msgs[1].to_string() == large);
+    CHECK(msgs[2].size() == 0);
+
+    // the receive buffer returns to the pool once released
+    CHECK(codec.pooled_bytes() == 0);
+    msgs.clear();
+    CHECK(codec.pooled_bytes() >= large.size());
+
+    // messages without header pass through, also if they start like
+    // the header frames of earlier versions
+    push.send(zmq::str_buffer("plain"), zmq::send_flags::none);
+    REQUIRE(codec.recv(pull, std::back_inserter(msgs)));
+    REQUIRE(msgs.size() == 1);
+    CHECK(msgs[0].to_string() == "plain");
+    const unsigned char binary[] = {0xC1, 1, 0, 2};
+    push.send(zmq::buffer(binary), zmq::send_flags::sndmore);
+    push.send(zmq::str_buffer("tail"), zmq::send_flags::none);
+    msgs.clear();
+    REQUIRE(codec.recv(pull, std::back_inserter(msgs)));
+    REQUIRE(msgs.size() == 2);
+    CHECK(msgs[0].size() == sizeof binary);
+    CHECK(msgs[1].to_string() == "tail");
+    const unsigned char announcement[] = {0xC3, 0, 0, 0, 1, 'd', 'a', 't', 'a'};
+    push.send(zmq::buffer(announcement), zmq::send_flags::none);
+    msgs.clear();
+    REQUIRE(codec.recv(pull, std::back_inserter(msgs)));
+    REQUIRE(msgs.size() == 1);
+    CHECK(msgs[0].size() == sizeof announcement);
+}
+
+TEST_CASE("compression codec rejects malformed messages", "[compression]")
+{
+    zmq::context_t context;
+    zmq::socket_t push(context, zmq::socket_type::push);
+    zmq::socket_t pull(context, zmq::socket_type::pull);
+    pull.bind("inproc://compression");
+    push.connect("inproc://compression");
+
+    zmq::compression_codec_t codec;
+    std::vector<zmq::message_t> msgs;
+    const unsigned char unknown_id[] = {0xC1, 'Z', 'C',
+                                        zmq::compression_codec_t::header_frame, 9, 0};
+    push.send(zmq::buffer(unknown_id), zmq::send_flags::sndmore);
+    push.send(zmq::str_buffer("a"), zmq::send_flags::none);
+    CHECK_THROWS_AS(codec.recv(pull, std::back_inserter(msgs)), std::runtime_error);
+
+    const unsigned char bad_part[] = {0xC1,
+                                      'Z',
+                                      'C',
+                                      zmq::compression_codec_t::header_frame,
+                                      zmq::lz_compressor_t::compressor_id,
+                                      100};
+    push.send(zmq::buffer(bad_part), zmq::send_flags::sndmore);
+    push.send(zmq::str_buffer("not compressed"), zmq::send_flags::none);
+    CHECK_THROWS_AS(codec.recv(pull, std::back_inserter(msgs)), std::runtime_error);
+
+    // the malformed messages were consumed
+    push.send(zmq::str_buffer("next"), zmq::send_flags::none);
+    REQUIRE(codec.recv(pull, std::back_inserter(msgs)));
+    REQUIRE(msgs.size() == 1);
+    CHECK(msgs[0].to_string() == "next");
+}
+
+namespace
+{
+std::string sensor_update(int i)
+{
+    return "{\"sensor\":\"rack-" + std::to_string(i % 7) + "\",\"seq\":"
+           + std::to_string(i) + ",\"temperature\":" + std::to_string(20 + i % 5)
+           + ",\"status\":\"nominal\",\"unit\":\"celsius\"}";
+}
+}
+
+TEST_CASE("lz compressor with dictionary", "[compression]")
+{
+    zmq::dictionary_trainer_t trainer;
+    for (int i = 0; i < 100; ++i)
+        trainer.add(zmq::buffer(sensor_update(i)));
+    CHECK(trainer.samples() == 100);
+    const std::string dictionary = trainer.train(1024);
+    CHECK(!dictionary.empty());
+    CHECK(dictionary.size() <= 1024);
+
+    zmq::lz_compressor_t plain;
+    zmq::lz_compressor_t lz;
+    REQUIRE(lz.set_dictionary(zmq::buffer(dictionary)));
+    const std::string msg = sensor_update(1234);
+    std::vector<unsigned char> compressed(lz.bound(msg.size()));
+    const size_t with_dictionary = lz.compress(zmq::buffer(msg), zmq::buffer(compressed));
+    CHECK(with_dictionary < msg.size() / 3);
+    CHECK(with_dictionary
+          < plain.compress(zmq::buffer(msg), zmq::buffer(compressed)));
+    CHECK(compress_roundtrip(lz, msg) == msg);
+
+    // the decompressor needs the dictionary
+    lz.compress(zmq::buffer(msg), zmq::buffer(compressed));
+    std::string out(msg.size(), '\0');
+    CHECK_FALSE(plain.decompress(zmq::const_buffer(compressed.data(), with_dictionary),
+                                 zmq::buffer(out)));
+}
+
+TEST_CASE("compression codec announces dictionaries", "[compression]")
+{
+    zmq::context_t context;
+    zmq::socket_t push(context, zmq::socket_type::push);
+    zmq::socket_t pull(context, zmq::socket_type::pull);
+    pull.bind("inproc://compression");
+    push.connect("inproc://compression");
+
+    zmq::dictionary_trainer_t trainer(2);
+    for (int i = 0; i < 200; ++i) {
+        const std::string update = sensor_update(i);
+        std::array<zmq::const_buffer, 1> parts = {zmq::buffer(update)};
+        trainer.add_multipart(parts);
+    }
+    CHECK(trainer.samples() == 100);
+
+    zmq::compression_codec_t sender(32);
+    zmq::compression_codec_t receiver;
+    CHECK_THROWS_AS(sender.send_dictionary(push), std::logic_error);
+    sender.set_dictionary(trainer.train());
+    const uint32_t id = sender.dictionary_id();
+    CHECK(id != 0);
+
+    std::vector<zmq::message_t> msgs;
+    for (int i = 1000; i < 1010; ++i) {
+        const std::string update = sensor_update(i);
+        std::array<zmq::const_buffer, 1> parts = {zmq::buffer(update)};
+        REQUIRE(sender.send(push, parts));
+        msgs.clear();
+        REQUIRE(receiver.recv(pull, std::back_inserter(msgs)));
+        REQUIRE(msgs.size() == 1);
+        CHECK(msgs[0].to_string() == update);
+    }
+    CHECK(receiver.has_dictionary(id));
+    CHECK(sender.statistics().compressed_parts == 10);
+    CHECK(sender.statistics().wire_bytes * 3 < sender.statistics().raw_bytes);
+
+    // a receiver missing the announcement can not decompress
+    zmq::compression_codec_t late;
+    const std::string update = sensor_update(1);
+    std::array<zmq::const_buffer, 1> parts = {zmq::buffer(update)};
+    REQUIRE(sender.send(push, parts));
+    CHECK_THROWS_AS(late.recv(pull, std::back_inserter(msgs)), std::runtime_error);
+    REQUIRE(sender.send_dictionary(push));
+    REQUIRE(sender.send(push, parts));
+    msgs.clear();
+    REQUIRE(late.recv(pull, std::back_inserter(msgs)));
+    CHECK(msgs.at(0).to_string() == update);
+
+    // without dictionary again
+    sender.set_dictionary(std::string());
+    CHECK(sender.dictionary_id() == 0);
+    const std::string large(1000, 'q');
+    std::array<zmq::const_buffer, 1> large_parts = {zmq::buffer(large)};
+    REQUIRE(sender.send(push, large_parts));
+    msgs.clear();
+    REQUIRE(receiver.recv(pull, std::back_inserter(msgs)));
+    CHECK(msgs.at(0).to_string() == large);
+}
+
+#endif
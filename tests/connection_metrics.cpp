@@ -0,0 +1,87 @@
+#include "testutil.hpp"
+#include <zmq_addon.hpp>
+
+#if defined(ZMQ_CPP11) && defined(ZMQ_NEW_MONITOR_EVENT_LAYOUT)
+
+namespace
+{
+zmq::monitor_event make_event(uint16_t type, const char *addr)
+{
+    zmq::monitor_event event;
+    event.event = type;
+    event.value = 0;
+    event.addr = zmq::const_buffer(addr, strlen(addr));
+    return event;
+}
+}
+
+TEST_CASE("connection metrics rolling rates", "[connection_metrics]")
+{
+    using std::chrono::milliseconds;
+    zmq::connection_metrics_t metrics("client", std::chrono::seconds{2});
+    const auto t0 = zmq::connection_metrics_t::clock::now();
+    const char *addr = "tcp://127.0.0.1:5555";
+
+    for (int i = 0; i < 4; ++i)
+        metrics.record(make_event(ZMQ_EVENT_CONNECT_RETRIED, addr),
+                       t0 + milliseconds{100 * i});
+    metrics.record(make_event(ZMQ_EVENT_CONNECT_RETRIED, addr),
+                   t0 + milliseconds{1100});
+    metrics.record(make_event(ZMQ_EVENT_CONNECTED, addr), t0 + milliseconds{1200});
+#if (defined(ZMQ_BUILD_DRAFT_API) && ZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 2, 3))  \
+  || ZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 0)
+    metrics.record(make_event(ZMQ_EVENT_HANDSHAKE_SUCCEEDED, addr),
+                   t0 + milliseconds{1250});
+#endif
+
+    const auto *m = metrics.find(addr);
+    REQUIRE(m != nullptr);
+    CHECK(metrics.find("tcp://127.0.0.1:1") == nullptr);
+    CHECK(m->connect_retries == 5);
+    CHECK(m->connected_peers == 1);
+    // complete seconds only: 4 retries in second 0
+    CHECK(metrics.connect_retry_rate(*m, t0 + milliseconds{1500}) == 2.0);
+    CHECK(metrics.connect_retry_rate(*m, t0 + milliseconds{2500}) == 2.5);
+    CHECK(metrics.connect_retry_rate(*m, t0 + milliseconds{3500}) == 0.5);
+    CHECK(metrics.connect_retry_rate(*m, t0 + milliseconds{9500}) == 0.0);
+#if (defined(ZMQ_BUILD_DRAFT_API) && ZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 2, 3))  \
+  || ZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 0)
+    CHECK(m->handshakes == 1);
+    CHECK(m->handshake_latency_ns == 50000000);
+#endif
+
+    metrics.record(make_event(ZMQ_EVENT_DISCONNECTED, addr),
+                   t0 + milliseconds{1300});
+    CHECK(m->connected_peers == 0);
+    CHECK(m->disconnects == 1);
+    CHECK(metrics.disconnect_rate(*m, t0 + milliseconds{2000}) == 0.5);
+}
+
+TEST_CASE("connection metrics prometheus snapshot", "[connection_metrics]")
+{
+    common_server_client_setup s{false};
+    zmq::monitor_t monitor;
+    monitor.init(s.client, "inproc://connection-metrics");
+    zmq::connection_metrics_t metrics("my \"client\"");
+    s.init();
+
+    const std::string endpoint = s.endpoint.c_str();
+    const zmq::connection_metrics_t::endpoint_metrics *m = nullptr;
+    while (m == nullptr || m->connected_peers == 0) {
+        REQUIRE(monitor.drain_events(metrics, 1000) > 0);
+        m = metrics.find(endpoint);
+    }
+
+    const std::string text = metrics.snapshot();
+    const std::string labels =
+      "{socket=\"my \\\"client\\\"\",endpoint=\"" + endpoint + "\"}";
+    CHECK(text.find("# TYPE zmq_connected_peers gauge\n") != std::string::npos);
+    CHECK(text.find("zmq_connected_peers" + labels + " 1\n") != std::string::npos);
+    CHECK(text.find("zmq_connect_retries_total" + labels + " 0\n")
+          != std::string::npos);
+    CHECK(text.find("# TYPE zmq_handshake_latency_seconds summary\n")
+          != std::string::npos);
+    CHECK(text.find("zmq_handshake_latency_seconds_count" + labels)
+          != std::string::npos);
+}
+#endif
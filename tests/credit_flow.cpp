@@ -0,0 +1,118 @@
+#include <catch.hpp>
+#include <zmq_addon.hpp>
+
+#ifdef ZMQ_CPP11
+#include <thread>
+
+namespace
+{
+struct credit_flow_setup
+{
+    credit_flow_setup()
+    {
+        router.bind("inproc://credit-flow");
+        dealer.connect("inproc://credit-flow");
+    }
+
+    zmq::context_t context;
+    zmq::socket_t router{context, zmq::socket_type::router};
+    zmq::socket_t dealer{context, zmq::socket_type::dealer};
+};
+}
+
+TEST_CASE("credit flow byte window", "[credit_flow]")
+{
+    credit_flow_setup s;
+    zmq::credit_receiver_t receiver(s.router, 100);
+    zmq::credit_sender_t sender(s.dealer, 30);
+    CHECK(sender.chunk_size() == 30);
+
+    const std::string data(250, 'x');
+    CHECK(sender.available() == 0);
+    CHECK_FALSE(sender.send(zmq::buffer(data)));
+
+    zmq::message_t peer, chunk;
+    // processes the hello, no data yet
+    CHECK_FALSE(receiver.recv(peer, chunk, zmq::recv_flags::dontwait));
+    CHECK(receiver.size() == 1);
+    REQUIRE(sender.wait_credit(std::chrono::milliseconds{1000}));
+    CHECK(sender.available() == 100);
+
+    auto sent = sender.send(zmq::buffer(data));
+    REQUIRE(sent);
+    CHECK(*sent == 100);
+    CHECK(sender.available() == 0);
+    CHECK_FALSE(sender.wait_credit(std::chrono::milliseconds{0}));
+
+    const size_t sizes[] = {30, 30, 30, 10};
+    for (size_t size : sizes) {
+        auto ret = receiver.recv(peer, chunk);
+        REQUIRE(ret);
+        CHECK(*ret == size);
+    }
+    CHECK_FALSE(receiver.recv(peer, chunk, zmq::recv_flags::dontwait));
+
+    // credit is returned in batches of at least half the window,
+    // a single grant was sent after 60 bytes were consumed
+    REQUIRE(sender.wait_credit(std::chrono::milliseconds{1000}));
+    CHECK(sender.available() == 60);
+}
+
+TEST_CASE("credit flow message window", "[credit_flow]")
+{
+    credit_flow_setup s;
+    zmq::credit_receiver_t receiver(s.router, 2, zmq::credit_unit::messages);
+    zmq::credit_sender_t sender(s.dealer, 4, zmq::credit_unit::messages);
+
+    zmq::message_t peer, chunk;
+    CHECK_FALSE(receiver.recv(peer, chunk, zmq::recv_flags::dontwait));
+    REQUIRE(sender.wait_credit(std::chrono::milliseconds{1000}));
+    CHECK(sender.available() == 2);
+
+    zmq::message_t large(std::string(100, 'y'));
+    auto sent = sender.send(large);
+    REQUIRE(sent);
+    CHECK(*sent == 100);
+    sent = sender.send(zmq::str_buffer("0123456789"));
+    REQUIRE(sent);
+    CHECK(*sent == 4);
+    zmq::message_t last("z", 1);
+    CHECK_FALSE(sender.send(last));
+    CHECK(last.size() == 1);
+
+    REQUIRE(receiver.recv(peer, chunk));
+    CHECK(chunk.size() == 100);
+    REQUIRE(receiver.recv(peer, chunk));
+    CHECK(chunk.to_string() == "0123");
+    REQUIRE(sender.wait_credit(std::chrono::milliseconds{1000}));
+    CHECK(sender.send(last));
+
+    receiver.remove(peer);
+    CHECK(receiver.size() == 0);
+}
+
+TEST_CASE("credit flow send all", "[credit_flow]")
+{
+    credit_flow_setup s;
+    const uint64_t window = 1000;
+    zmq::credit_receiver_t receiver(s.router, window);
+    std::string data(10000, '\0');
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<char>(i % 251);
+
+    std::thread producer([&] {
+        zmq::credit_sender_t sender(s.dealer, 256);
+        CHECK(sender.send_all(zmq::buffer(data)) == data.size());
+    });
+
+    std::string received;
+    zmq::message_t peer, chunk;
+    while (received.size() < data.size()) {
+        REQUIRE(receiver.recv(peer, chunk));
+        CHECK(chunk.size() <= 256);
+        received += chunk.to_string();
+    }
+    producer.join();
+    CHECK(received == data);
+}
+#endif
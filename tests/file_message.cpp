@@ -0,0 +1,130 @@
+#include <catch.hpp>
+#include <zmq_addon.hpp>
+
+#if defined(ZMQ_CPP11) && !defined(_WIN32)
+#include <cstdio>
+#include <fstream>
+
+namespace
+{
+struct temp_file
+{
+    temp_file(const std::string &path, const std::string &content) : path(path)
+    {
+        std::ofstream(path, std::ios::binary) << content;
+    }
+    ~temp_file() { std::remove(path.c_str()); }
+
+    std::string path;
+};
+
+std::string file_content(size_t size)
+{
+    std::string content(size, '\0');
+    for (size_t i = 0; i < size; ++i)
+        content[i] = static_cast<char>('a' + i % 26);
+    return content;
+}
+}
+
+TEST_CASE("file message maps ranges", "[file_message]")
+{
+    const std::string content = file_content(3 * 4096 + 100);
+    temp_file file("file_message_ranges.bin", content);
+
+    zmq::message_t whole = zmq::file_message(file.path);
+    CHECK(whole.to_string() == content);
+
+    // unaligned offset, clamped to the end of the file
+    zmq::message_t tail = zmq::file_message(file.path, 5000);
+    CHECK(tail.to_string() == content.substr(5000));
+
+    zmq::message_t part = zmq::file_message(file.path.c_str(), 4097, 10);
+    CHECK(part.to_string() == content.substr(4097, 10));
+
+    // the mapping is private
+    *whole.data<char>() = '!';
+    CHECK(zmq::file_message(file.path, 0, 1).to_string() == "a");
+
+    CHECK(zmq::file_message(file.path, content.size()).size() == 0);
+    CHECK_THROWS_AS(zmq::file_message(file.path, content.size() + 1),
+                    std::out_of_range);
+    CHECK_THROWS_AS(zmq::file_message("file_message_missing.bin"),
+                    zmq::error_t);
+}
+
+TEST_CASE("file message sent zero copy", "[file_message]")
+{
+    const std::string content = file_content(100000);
+    temp_file file("file_message_send.bin", content);
+    zmq::context_t context;
+    zmq::socket_t receiving(context, zmq::socket_type::pair);
+    zmq::socket_t sending(context, zmq::socket_type::pair);
+    receiving.bind("inproc://file-message");
+    sending.connect("inproc://file-message");
+
+    CHECK(sending.send(zmq::file_message(file.path), zmq::send_flags::none));
+    zmq::message_t msg;
+    REQUIRE(receiving.recv(msg));
+    CHECK(msg.to_string() == content);
+}
+
+TEST_CASE("file streamer sends chunks", "[file_message]")
+{
+    const std::string content = file_content(10000);
+    temp_file file("file_message_stream.bin", content);
+    zmq::context_t context;
+    zmq::socket_t receiving(context, zmq::socket_type::pair);
+    zmq::socket_t sending(context, zmq::socket_type::pair);
+    receiving.bind("inproc://file-streamer");
+    sending.connect("inproc://file-streamer");
+
+    std::vector<zmq::message_t> msgs;
+    SECTION("blocking") {
+        CHECK(*zmq::send_file(sending, file.path.c_str(), 4096) == 3);
+        REQUIRE(*zmq::recv_multipart(receiving, std::back_inserter(msgs)) == 3);
+        CHECK(msgs[0].size() == 4096);
+        CHECK(msgs[2].size() == 10000 - 2 * 4096);
+    }
+    SECTION("resumed") {
+        zmq::file_streamer_t streamer(file.path, 1000);
+        CHECK(streamer.file_size() == content.size());
+        CHECK(streamer.chunk_size() == 1000);
+        CHECK(!streamer.done());
+        const auto sent = streamer.send(sending, zmq::send_flags::dontwait);
+        REQUIRE(sent);
+        CHECK(*sent == 10);
+        CHECK(streamer.done());
+        CHECK(streamer.bytes_sent() == content.size());
+        CHECK(*streamer.send(sending) == 0);
+        REQUIRE(*zmq::recv_multipart(receiving, std::back_inserter(msgs)) == 10);
+    }
+    std::string received;
+    for (const auto &msg : msgs)
+        received += msg.to_string();
+    CHECK(received == content);
+}
+
+TEST_CASE("file streamer sends empty file", "[file_message]")
+{
+    temp_file file("file_message_empty.bin", "");
+    zmq::context_t context;
+    zmq::socket_t receiving(context, zmq::socket_type::pair);
+    zmq::socket_t sending(context, zmq::socket_type::pair);
+    receiving.bind("inproc://file-streamer-empty");
+    sending.connect("inproc://file-streamer-empty");
+
+    CHECK(*zmq::send_file(sending, file.path.c_str()) == 1);
+    zmq::message_t msg;
+    REQUIRE(receiving.recv(msg));
+    CHECK(msg.size() == 0);
+    CHECK(!msg.more());
+
+    // a timed out send is reported, not dereferenced
+    zmq::socket_t unconnected(context, zmq::socket_type::pair);
+    unconnected.set(zmq::sockopt::sndtimeo, 0);
+    CHECK_FALSE(zmq::send_file(unconnected, file.path.c_str()));
+    CHECK_THROWS_AS(zmq::file_streamer_t(file.path, 0), std::invalid_argument);
+}
+
+#endif
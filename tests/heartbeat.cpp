@@ -0,0 +1,109 @@
+#include <catch.hpp>
+#include <zmq_addon.hpp>
+
+#ifdef ZMQ_CPP11
+
+namespace
+{
+bool recv_heartbeat(zmq::socket_t &dealer)
+{
+    zmq::message_t msg;
+    return dealer.recv(msg, zmq::recv_flags::dontwait)
+           && zmq::heartbeat_manager_t::is_heartbeat(msg);
+}
+}
+
+TEST_CASE("heartbeat piggybacking and expiry", "[heartbeat]")
+{
+    zmq::context_t context;
+    zmq::socket_t router(context, zmq::socket_type::router);
+    zmq::socket_t w1(context, zmq::socket_type::dealer);
+    zmq::socket_t w2(context, zmq::socket_type::dealer);
+    router.bind("inproc://heartbeat");
+    w1.set(zmq::sockopt::routing_id, "w1");
+    w2.set(zmq::sockopt::routing_id, "w2");
+    w1.connect("inproc://heartbeat");
+    w2.connect("inproc://heartbeat");
+
+    using std::chrono::milliseconds;
+    zmq::heartbeat_manager_t manager(router, milliseconds{100}, 3, milliseconds{10});
+    std::vector<std::string> expired;
+    manager.on_expired([&expired](const zmq::message_t &routing_id) {
+        expired.push_back(routing_id.to_string());
+    });
+    const auto t0 = zmq::heartbeat_manager_t::clock::now();
+
+    w1.send(zmq::str_buffer("work"), zmq::send_flags::none);
+    w2.send(zmq::str_buffer("\x02"), zmq::send_flags::none);
+    std::vector<zmq::message_t> msgs;
+    REQUIRE(zmq::recv_multipart(router, std::back_inserter(msgs)));
+    CHECK_FALSE(manager.received(msgs[0], msgs[1], t0));
+    const zmq::message_t id1 = std::move(msgs[0]);
+    msgs.clear();
+    REQUIRE(zmq::recv_multipart(router, std::back_inserter(msgs)));
+    CHECK(manager.received(msgs[0], msgs[1], t0));
+    const zmq::message_t id2 = std::move(msgs[0]);
+    CHECK(manager.size() == 2);
+    CHECK(manager.next_timeout(t0).count() > 0);
+
+    CHECK(manager.process(t0 + milliseconds{50}) == 0);
+    CHECK_FALSE(recv_heartbeat(w1));
+
+    // both peers are idle for one interval
+    CHECK(manager.process(t0 + milliseconds{110}) == 0);
+    CHECK(recv_heartbeat(w1));
+    CHECK(recv_heartbeat(w2));
+
+    // traffic to w1 replaces its heartbeat, w2 answers its heartbeat
+    manager.sent(id1, t0 + milliseconds{150});
+    CHECK(manager.received(id2, zmq::message_t("\x02", 1), t0 + milliseconds{150}));
+    CHECK(manager.process(t0 + milliseconds{220}) == 0);
+    CHECK_FALSE(recv_heartbeat(w1));
+    CHECK(recv_heartbeat(w2));
+
+    // nothing received from w1 for three intervals
+    CHECK(manager.process(t0 + milliseconds{310}) == 1);
+    REQUIRE(expired.size() == 1);
+    CHECK(expired[0] == "w1");
+    CHECK_FALSE(manager.contains(id1));
+    CHECK(manager.contains(id2));
+
+    CHECK(manager.process(t0 + milliseconds{460}) == 1);
+    REQUIRE(expired.size() == 2);
+    CHECK(expired[1] == "w2");
+    CHECK(manager.size() == 0);
+    CHECK(manager.next_timeout(t0).count() == -1);
+}
+
+TEST_CASE("heartbeat remove and unroutable peers", "[heartbeat]")
+{
+    zmq::context_t context;
+    zmq::socket_t router(context, zmq::socket_type::router);
+    router.set(zmq::sockopt::router_mandatory, true);
+    router.bind("inproc://heartbeat-mandatory");
+
+    using std::chrono::milliseconds;
+    zmq::heartbeat_manager_t manager(router, milliseconds{100}, 2, milliseconds{10});
+    size_t expired = 0;
+    manager.on_expired([&expired](const zmq::message_t &) { ++expired; });
+    const auto t0 = zmq::heartbeat_manager_t::clock::now();
+
+    const zmq::message_t ghost("ghost", 5);
+    const zmq::message_t gone("gone", 4);
+    manager.received(ghost, zmq::message_t(), t0);
+    manager.received(gone, zmq::message_t(), t0);
+    manager.remove(gone);
+    CHECK(manager.size() == 1);
+
+    // the heartbeat to the unroutable peer is dropped
+    CHECK_NOTHROW(manager.process(t0 + milliseconds{110}));
+    CHECK(manager.process(t0 + milliseconds{210}) == 1);
+    CHECK(expired == 1);
+
+    // a removed slot is reused
+    manager.received(gone, zmq::message_t(), t0 + milliseconds{210});
+    CHECK(manager.contains(gone));
+    CHECK(manager.process(t0 + milliseconds{520}) == 1);
+    CHECK(expired == 2);
+}
+#endif
@@ -0,0 +1,66 @@
+#include <catch.hpp>
+#include <zmq_addon.hpp>
+
+#ifdef ZMQ_CPP11
+
+TEST_CASE("latency histogram percentiles", "[latency_probe]")
+{
+    zmq::latency_histogram_t histogram;
+    CHECK(histogram.percentile(0.5) == 0);
+    for (uint64_t v = 1; v <= 100; ++v)
+        histogram.record(v * 1000);
+
+    // percentiles are reported as bucket upper bounds, within 1/16
+    const uint64_t p50 = histogram.percentile(0.5);
+    CHECK(p50 >= 50000);
+    CHECK(p50 <= 50000 + 50000 / 16);
+    const uint64_t p99 = histogram.percentile(0.99);
+    CHECK(p99 >= 99000);
+    CHECK(p99 <= 99000 + 99000 / 16);
+    CHECK(histogram.percentile(0.0) >= 1000);
+    CHECK(histogram.percentile(0.0) < 1100);
+    CHECK(histogram.percentile(1.0) >= 100000);
+
+    std::ostringstream os;
+    histogram.write_percentiles(os);
+    const std::string text = os.str();
+    CHECK(text.find("count 100\n") == 0);
+    CHECK(text.find("p50 " + std::to_string(p50) + "\n") != std::string::npos);
+    CHECK(text.find("max ") != std::string::npos);
+}
+
+TEST_CASE("latency probe strips trailing frame", "[latency_probe]")
+{
+    zmq::context_t context;
+    zmq::socket_t pub(context, zmq::socket_type::xpub);
+    zmq::socket_t sub(context, zmq::socket_type::sub);
+    pub.bind("inproc://latency-probe");
+    sub.connect("inproc://latency-probe");
+    sub.set(zmq::sockopt::subscribe, "topic");
+    zmq::message_t subscription;
+    REQUIRE(pub.recv(subscription));
+
+    zmq::latency_probe_t<> sender(4);
+    zmq::latency_probe_t<> receiver;
+    CHECK(sender.sample_every() == 4);
+    const int n = 20;
+    for (int i = 0; i < n; ++i) {
+        std::array<zmq::const_buffer, 2> parts = {zmq::str_buffer("topic"),
+                                                  zmq::str_buffer("payload")};
+        auto ret = sender.send(pub, parts);
+        REQUIRE(ret);
+        CHECK(*ret == 2);
+    }
+    for (int i = 0; i < n; ++i) {
+        std::vector<zmq::message_t> msgs;
+        auto ret = receiver.recv(sub, std::back_inserter(msgs));
+        REQUIRE(ret);
+        CHECK(*ret == 2);
+        REQUIRE(msgs.size() == 2);
+        CHECK(msgs[0].to_string() == "topic");
+        CHECK(msgs[1].to_string() == "payload");
+    }
+    CHECK(receiver.histogram().count() == n / 4);
+    CHECK(receiver.histogram().percentile(1.0) < 10000000000ULL);
+}
+#endif
@@ -0,0 +1,84 @@
+#include <catch.hpp>
+#include <zmq_addon.hpp>
+
+#ifdef ZMQ_CPP11
+
+namespace
+{
+using quote_v1 = zmq::message_schema<1,
+                                     zmq::schema_field<zmq::little_endian<uint64_t>>,
+                                     zmq::schema_bytes,
+                                     zmq::schema_field<zmq::little_endian<int32_t>>>;
+// version 2 appends an optional field
+using quote_v2 = zmq::message_schema<2,
+                                     zmq::schema_field<zmq::little_endian<uint64_t>>,
+                                     zmq::schema_bytes,
+                                     zmq::schema_field<zmq::little_endian<int32_t>>,
+                                     zmq::schema_bytes>;
+}
+
+TEST_CASE("message schema offsets", "[message_schema]")
+{
+    static_assert(quote_v1::offset<0>() == 4, "");
+    static_assert(quote_v1::offset<1>() == 12, "");
+    static_assert(quote_v1::offset<2>() == 20, "");
+    static_assert(quote_v1::fixed_size() == 24, "");
+    static_assert(quote_v2::fixed_size() == 32, "");
+    static_assert(quote_v2::field_count() == 4, "");
+    CHECK(quote_v2::version() == 2);
+}
+
+TEST_CASE("message schema encode and read", "[message_schema]")
+{
+    const std::string symbol = "ZMQ";
+    zmq::message_t msg = quote_v1::encode(uint64_t(42), zmq::buffer(symbol), -7);
+    CHECK(msg.size() == quote_v1::fixed_size() + symbol.size());
+
+    const quote_v1::reader r(msg);
+    CHECK(r.version() == 1);
+    CHECK(r.field_count() == 3);
+    CHECK(r.get<0>() == 42u);
+    const zmq::const_buffer sym = r.get<1>();
+    CHECK(std::string(static_cast<const char *>(sym.data()), sym.size()) == symbol);
+    // bytes are read in place
+    CHECK(sym.data() == msg.data<unsigned char>() + quote_v1::fixed_size());
+    CHECK(r.get<2>() == -7);
+}
+
+TEST_CASE("message schema versions", "[message_schema]")
+{
+    // a newer reader sees the appended field as absent
+    zmq::message_t old_msg = quote_v1::encode(uint64_t(1), zmq::str_buffer("A"), 2);
+    const quote_v2::reader newer(old_msg);
+    CHECK(newer.version() == 1);
+    CHECK(newer.has<2>());
+    CHECK(!newer.has<3>());
+    CHECK(newer.get<3>().size() == 0);
+    CHECK(newer.get<2>() == 2);
+
+    // an older reader ignores it
+    zmq::message_t new_msg =
+      quote_v2::encode(uint64_t(3), zmq::str_buffer("BB"), 4, zmq::str_buffer("venue"));
+    const quote_v1::reader older(new_msg);
+    CHECK(older.field_count() == 4);
+    CHECK(older.get<0>() == 3u);
+    CHECK(older.get<1>().size() == 2);
+    const quote_v2::reader current(new_msg);
+    CHECK(current.get<3>().size() == 5);
+}
+
+TEST_CASE("message schema rejects malformed messages", "[message_schema]")
+{
+    CHECK_THROWS_AS(quote_v1::reader(zmq::message_t(2)), std::out_of_range);
+
+    zmq::message_t msg = quote_v1::encode(uint64_t(1), zmq::str_buffer("abc"), 2);
+    zmq::message_t truncated(msg.data(), quote_v1::fixed_size() - 1);
+    CHECK_THROWS_AS(quote_v1::reader(truncated), std::out_of_range);
+
+    zmq::message_t short_data(msg.data(), msg.size() - 1);
+    const quote_v1::reader r(short_data);
+    CHECK(r.get<0>() == 1u);
+    CHECK_THROWS_AS(r.get<1>(), std::out_of_range);
+}
+
+#endif
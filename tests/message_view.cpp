@@ -0,0 +1,97 @@
+#include <catch.hpp>
+#include <zmq_addon.hpp>
+
+#ifdef ZMQ_CPP11
+
+namespace
+{
+struct order
+{
+    zmq::little_endian<uint64_t> id;
+    zmq::big_endian<int32_t> price;
+    zmq::little_endian<uint16_t> quantity;
+    char side;
+};
+
+struct alignas(16) wide
+{
+    double values[2];
+};
+
+struct alignas(32) large
+{
+    uint64_t values[16];
+};
+}
+
+TEST_CASE("endian value byte order", "[message_view]")
+{
+    zmq::big_endian<uint32_t> big = 0x01020304u;
+    zmq::little_endian<uint32_t> little = 0x01020304u;
+    unsigned char bytes[4];
+    std::memcpy(bytes, &big, 4);
+    CHECK(bytes[0] == 1);
+    CHECK(bytes[3] == 4);
+    std::memcpy(bytes, &little, 4);
+    CHECK(bytes[0] == 4);
+    CHECK(bytes[3] == 1);
+    CHECK(uint32_t(big) == 0x01020304u);
+    little = 7;
+    CHECK(little.load() == 7);
+    static_assert(sizeof(order) == 15, "endian values add no padding");
+    static_assert(alignof(order) == 1, "endian values are not aligned");
+}
+
+TEST_CASE("message builder and view roundtrip", "[message_view]")
+{
+    zmq::context_t context;
+    zmq::socket_t push(context, zmq::socket_type::push);
+    zmq::socket_t pull(context, zmq::socket_type::pull);
+    pull.bind("inproc://message_view");
+    push.connect("inproc://message_view");
+
+    zmq::message_builder<order> builder(uint64_t(42), -5, uint16_t(1), 'S');
+    builder->quantity = 10;
+    builder->side = 'B';
+    zmq::message_t msg = builder.release();
+    CHECK(msg.size() == sizeof(order));
+    push.send(msg, zmq::send_flags::none);
+
+    zmq::message_t received;
+    REQUIRE(pull.recv(received));
+    const zmq::message_view<order> view(std::move(received));
+    CHECK(view->id == 42u);
+    CHECK(view->price == -5);
+    CHECK(view->quantity == 10);
+    CHECK((*view).side == 'B');
+
+    CHECK_THROWS_AS(zmq::message_view<order>(zmq::message_t(3)), std::runtime_error);
+}
+
+TEST_CASE("message builder aligns data", "[message_view]")
+{
+    zmq::message_builder<wide> small(wide{{1.5, 2.5}});
+    CHECK(reinterpret_cast<std::uintptr_t>(small.get()) % alignof(wide) == 0);
+    zmq::message_builder<large> builder;
+    CHECK(reinterpret_cast<std::uintptr_t>(builder.get()) % alignof(large) == 0);
+    CHECK(builder->values[15] == 0);
+    builder->values[15] = 7;
+
+    // large messages are viewed in place if aligned
+    zmq::message_t msg = builder.release();
+    const void *data = msg.data();
+    const zmq::message_view<large> view(std::move(msg));
+    CHECK(!view.copied());
+    CHECK(view.get() == data);
+    CHECK(view->values[15] == 7);
+
+    // misaligned data is copied
+    std::vector<unsigned char> buf(sizeof(large) + 1);
+    zmq::message_t misaligned(buf.data() + 1, sizeof(large), nullptr, nullptr);
+    const zmq::message_view<large> copy(std::move(misaligned));
+    CHECK((copy.copied()
+           || reinterpret_cast<std::uintptr_t>(buf.data() + 1) % alignof(large) == 0));
+    CHECK(reinterpret_cast<std::uintptr_t>(copy.get()) % alignof(large) == 0);
+}
+
+#endif
@@ -143,3 +143,40 @@ TEST_CASE("monitor init abort", "[monitor]")
     thread.join();
 }
 #endif
+
+#if defined(ZMQ_CPP11) && defined(ZMQ_NEW_MONITOR_EVENT_LAYOUT)
+TEST_CASE("monitor drain events", "[monitor]")
+{
+    common_server_client_setup s{false};
+    zmq::monitor_t monitor;
+    monitor.init(s.client, "inproc://monitor-drain");
+
+    std::vector<uint16_t> events;
+    std::string address;
+    auto visitor = [&](const zmq::monitor_event &event) {
+        events.push_back(event.event);
+        address.assign(static_cast<const char *>(event.addr.data()),
+                       event.addr.size());
+#if defined(ZMQ_HAS_STRING_VIEW) && (ZMQ_HAS_STRING_VIEW > 0)
+        CHECK(event.address() == address);
+#endif
+    };
+    CHECK(monitor.drain_events(visitor) == 0);
+
+    s.init();
+    while (std::find(events.begin(), events.end(), ZMQ_EVENT_CONNECTED)
+           == events.end()) {
+        REQUIRE(monitor.drain_events(visitor, 1000) > 0);
+    }
+    CHECK(events[0] == ZMQ_EVENT_CONNECT_DELAYED);
+    CHECK(address == s.endpoint.c_str());
+    CHECK(monitor.drain_events(visitor) == 0);
+
+#ifdef ZMQ_EVENT_MONITOR_STOPPED
+    monitor.abort();
+    events.clear();
+    while (events.empty() || events.back() != ZMQ_EVENT_MONITOR_STOPPED)
+        REQUIRE(monitor.drain_events(visitor, 1000) > 0);
+#endif
+}
+#endif
@@ -0,0 +1,79 @@
+#include "testutil.hpp"
+#include <zmq_addon.hpp>
+
+#if defined(ZMQ_BUILD_DRAFT_API) && defined(ZMQ_CPP11) && defined(ZMQ_HAVE_POLLER) \
+  && defined(ZMQ_NEW_MONITOR_EVENT_LAYOUT)
+
+TEST_CASE("monitor hub aggregates sockets", "[monitor_hub]")
+{
+    zmq::context_t context;
+    zmq::socket_t server(context, zmq::socket_type::router);
+    const std::string endpoint = bind_ip4_loopback(server);
+
+    const size_t n = 5;
+    std::vector<zmq::socket_t> clients;
+    zmq::monitor_hub_t hub(context);
+    std::vector<size_t> tags;
+    for (size_t i = 0; i < n; ++i) {
+        clients.emplace_back(context, zmq::socket_type::dealer);
+        tags.push_back(hub.add(clients.back(), ZMQ_EVENT_CONNECTED
+                                                 | ZMQ_EVENT_DISCONNECTED));
+    }
+    const size_t server_tag = hub.add(server, ZMQ_EVENT_ACCEPTED);
+    CHECK(hub.size() == n + 1);
+
+    std::vector<size_t> sources;
+    hub.on_event([&sources](size_t source, const zmq::monitor_event &event) {
+        CHECK(event.event != ZMQ_EVENT_CONNECT_DELAYED);
+        sources.push_back(source);
+    });
+
+    for (auto &client : clients)
+        client.connect(endpoint.c_str());
+    while (hub.totals().connected < n || hub.totals().accepted < n)
+        REQUIRE(hub.process(std::chrono::milliseconds{1000}) > 0);
+
+    CHECK(hub.totals().connections == static_cast<int64_t>(2 * n));
+    CHECK(hub.counters(server_tag).accepted == n);
+    for (size_t tag : tags) {
+        CHECK(hub.counters(tag).connected == 1);
+        CHECK(std::count(sources.begin(), sources.end(), tag) == 1);
+    }
+
+    // counters remain readable after removal
+    hub.remove(tags[0]);
+    hub.remove(server_tag);
+    CHECK(hub.size() == n - 1);
+    server.close();
+    while (hub.totals().disconnected < n - 1)
+        REQUIRE(hub.process(std::chrono::milliseconds{1000}) > 0);
+    CHECK(hub.counters(tags[0]).connected == 1);
+    CHECK(hub.counters(tags[0]).disconnected == 0);
+    CHECK(hub.counters(tags[1]).disconnected == 1);
+    CHECK(hub.counters(tags[1]).connections == 0);
+    CHECK(hub.totals().connections == static_cast<int64_t>(n + 1));
+    CHECK(hub.totals().events == hub.totals().connected + hub.totals().accepted
+                                   + hub.totals().disconnected);
+}
+
+TEST_CASE("monitor hub detects reconnect storms", "[monitor_hub]")
+{
+    zmq::context_t context;
+    zmq::socket_t client(context, zmq::socket_type::dealer);
+    client.set(zmq::sockopt::reconnect_ivl, 1);
+    client.set(zmq::sockopt::reconnect_ivl_max, 1);
+
+    zmq::monitor_hub_t hub(context, 3, std::chrono::milliseconds{10000});
+    const size_t tag = hub.add(client, ZMQ_EVENT_CONNECT_RETRIED);
+    // nothing listens on the endpoint, the client keeps retrying
+    zmq::socket_t probe(context, zmq::socket_type::router);
+    const std::string endpoint = bind_ip4_loopback(probe);
+    probe.close();
+    client.connect(endpoint.c_str());
+
+    while (hub.counters(tag).connect_retried < 5)
+        REQUIRE(hub.process(std::chrono::milliseconds{1000}) > 0);
+    CHECK(hub.counters(tag).reconnect_storms == 1);
+    CHECK(hub.totals().reconnect_storms == 1);
+}
+#endif
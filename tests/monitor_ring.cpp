@@ -0,0 +1,100 @@
+#include <catch.hpp>
+#include <zmq_addon.hpp>
+
+#if defined(ZMQ_CPP11) && defined(ZMQ_NEW_MONITOR_EVENT_LAYOUT)
+#include <cstdio>
+#include <thread>
+
+namespace
+{
+zmq::monitor_event make_event(uint16_t type, int32_t value, const std::string &addr)
+{
+    zmq::monitor_event event;
+    event.event = type;
+    event.value = value;
+    event.addr = zmq::buffer(addr);
+    return event;
+}
+}
+
+TEST_CASE("monitor ring retains latest records", "[monitor_ring]")
+{
+    zmq::monitor_ring_t ring(4, 2);
+    CHECK(ring.capacity() == 4);
+    CHECK(ring.size() == 0);
+
+    const std::string addrs[] = {"tcp://a:1", "tcp://b:2", "tcp://c:3"};
+    const auto t0 = std::chrono::system_clock::now();
+    for (int i = 0; i < 6; ++i) {
+        ring.record_event(make_event(ZMQ_EVENT_CONNECT_RETRIED, i, addrs[i % 3]),
+                          t0 + std::chrono::milliseconds{i});
+    }
+    CHECK(ring.size() == 4);
+    CHECK(ring.recorded() == 6);
+    CHECK(ring.address(0) == "tcp://a:1");
+    CHECK(ring.address(1) == "tcp://b:2");
+    CHECK(ring.address(2).empty());
+
+    std::vector<zmq::monitor_ring_t::record> records;
+    CHECK(ring.for_each([&records](const zmq::monitor_ring_t::record &r) {
+        records.push_back(r);
+    }) == 4);
+    REQUIRE(records.size() == 4);
+    for (int i = 0; i < 4; ++i) {
+        CHECK(records[i].value == i + 2);
+        CHECK(records[i].event == ZMQ_EVENT_CONNECT_RETRIED);
+        CHECK(records[i].time - t0 == std::chrono::milliseconds{i + 2});
+    }
+    // the interning capacity is exhausted by the first two addresses
+    CHECK(records[0].address_id == zmq::monitor_ring_t::unknown_address);
+    CHECK(records[1].address_id == 0);
+    CHECK(records[2].address_id == 1);
+
+    std::ostringstream text;
+    ring.dump_text(text);
+    std::istringstream lines(text.str());
+    std::string line;
+    std::getline(lines, line);
+    CHECK(line.find(" connect_retried 2 ?") != std::string::npos);
+    std::getline(lines, line);
+    CHECK(line.find(" connect_retried 3 tcp://a:1") != std::string::npos);
+
+    std::ostringstream binary;
+    ring.dump_binary(binary);
+    const std::string data = binary.str();
+    // magic, 2 addresses of 9 bytes, 4 records of 18 bytes
+    CHECK(data.size() == 8 + 4 + 2 * (4 + 9) + 8 + 4 * 18);
+    CHECK(data.compare(0, 8, "ZMQMONR1") == 0);
+    CHECK(data.compare(16, 9, "tcp://a:1") == 0);
+
+    const std::string path = "monitor_ring_dump.bin";
+    ring.dump(path, zmq::dump_format::binary);
+    std::ifstream file(path, std::ios::binary);
+    const std::string contents((std::istreambuf_iterator<char>(file)),
+                               std::istreambuf_iterator<char>());
+    CHECK(contents == data);
+    file.close();
+    std::remove(path.c_str());
+}
+
+TEST_CASE("monitor ring concurrent reader", "[monitor_ring]")
+{
+    zmq::monitor_ring_t ring(64);
+    const std::string addr = "tcp://127.0.0.1:5555";
+    const int n = 20000;
+    std::thread writer([&] {
+        for (int i = 0; i < n; ++i)
+            ring(make_event(ZMQ_EVENT_CONNECTED, i, addr));
+    });
+    while (ring.recorded() < static_cast<uint64_t>(n)) {
+        int32_t last = -1;
+        ring.for_each([&last](const zmq::monitor_ring_t::record &r) {
+            CHECK(r.value > last);
+            CHECK(r.address_id == 0);
+            last = r.value;
+        });
+    }
+    writer.join();
+    CHECK(ring.size() == 64);
+}
+#endif
@@ -0,0 +1,111 @@
+#include <catch.hpp>
+#include <zmq_addon.hpp>
+
+#if defined(ZMQ_CPP11) && defined(__linux__) && defined(ZMQ_THREAD_AFFINITY_CPU_ADD)
+#include <fstream>
+
+namespace
+{
+// minimal fake of /sys/devices/system, removed on destruction
+struct fake_sysfs
+{
+    explicit fake_sysfs(const std::string &root) : root(root)
+    {
+        make_dir(root);
+        make_dir(root + "/cpu");
+        write(root + "/cpu/online", "0-5\n");
+    }
+
+    ~fake_sysfs()
+    {
+        for (auto it = files.rbegin(); it != files.rend(); ++it)
+            ::remove(it->c_str());
+    }
+
+    void add_node(int id, const std::string &cpulist)
+    {
+        make_dir(root + "/node");
+        make_dir(root + "/node/node" + std::to_string(id));
+        write(root + "/node/node" + std::to_string(id) + "/cpulist", cpulist);
+    }
+
+    void make_dir(const std::string &path)
+    {
+        if (::mkdir(path.c_str(), 0700) == 0)
+            files.push_back(path);
+    }
+
+    void write(const std::string &path, const std::string &content)
+    {
+        std::ofstream(path) << content;
+        files.push_back(path);
+    }
+
+    std::string root;
+    std::vector<std::string> files;
+};
+}
+
+TEST_CASE("cpu list parsing", "[numa_context]")
+{
+    CHECK(zmq::detail::parse_cpu_list("0-3,8,10-11")
+          == std::vector<int>{0, 1, 2, 3, 8, 10, 11});
+    CHECK(zmq::detail::parse_cpu_list("").empty());
+    CHECK_THROWS_AS(zmq::detail::parse_cpu_list("3-1"), std::invalid_argument);
+    CHECK(zmq::detail::format_cpu_list({0, 1, 2, 3, 8, 10, 11}) == "0-3,8,10-11");
+}
+
+TEST_CASE("cpu topology from sysfs", "[numa_context]")
+{
+    fake_sysfs sysfs("numa_context_sysfs");
+    SECTION("without numa") {
+        zmq::cpu_topology_t topology(sysfs.root);
+        REQUIRE(topology.nodes().size() == 1);
+        CHECK(topology.node(0).cpus.size() == 6);
+    }
+    SECTION("two nodes and a memory only node") {
+        sysfs.add_node(0, "0-2\n");
+        sysfs.add_node(1, "3-5\n");
+        sysfs.add_node(2, "\n");
+        sysfs.write(sysfs.root + "/node/online", "0-2\n");
+        zmq::cpu_topology_t topology(sysfs.root);
+        REQUIRE(topology.nodes().size() == 2);
+        CHECK(topology.node(1).cpus == std::vector<int>{3, 4, 5});
+        CHECK(topology.node_of_cpu(4) == 1);
+        CHECK(topology.node_of_cpu(7) == -1);
+        CHECK_THROWS_AS(topology.node(2), std::out_of_range);
+    }
+}
+
+TEST_CASE("numa context places sockets", "[numa_context]")
+{
+    const zmq::cpu_topology_t topology;
+    const int node = topology.nodes().front().id;
+    CHECK_THROWS_AS(zmq::numa_context_t(topology, node, 0), std::invalid_argument);
+
+    zmq::numa_context_t context(topology, node, 2);
+    CHECK(context.node() == node);
+    CHECK(context.io_threads() == 2);
+    CHECK(!context.cpus().empty());
+
+    zmq::socket_t a(context, zmq::socket_type::pair);
+    zmq::socket_t b(context, zmq::socket_type::pair);
+    CHECK(context.place(a, "frontend") == 0);
+    CHECK(context.place(b) == 1);
+    CHECK(a.get(zmq::sockopt::affinity) == 1);
+    CHECK(b.get(zmq::sockopt::affinity) == 2);
+    REQUIRE(context.placements().size() == 2);
+    CHECK(context.placements()[1].name == "socket 1");
+    const std::string report = context.report();
+    CHECK(report.find("frontend -> io thread 0") != std::string::npos);
+    CHECK(report.find("socket 1 -> io thread 1") != std::string::npos);
+
+    a.bind("tcp://127.0.0.1:*");
+    b.connect(a.get(zmq::sockopt::last_endpoint));
+    b.send(zmq::str_buffer("hi"), zmq::send_flags::none);
+    zmq::message_t msg;
+    REQUIRE(a.recv(msg));
+    CHECK(msg.to_string() == "hi");
+}
+
+#endif
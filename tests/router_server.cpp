@@ -0,0 +1,112 @@
+#include <catch.hpp>
+#include <zmq_addon.hpp>
+
+#ifdef ZMQ_CPP11
+
+namespace
+{
+struct peer_stats
+{
+    int requests;
+    size_t bytes;
+};
+}
+
+TEST_CASE("router server per peer state", "[router_server]")
+{
+    zmq::context_t context;
+    zmq::socket_t router(context, zmq::socket_type::router);
+    router.bind("inproc://router-server");
+
+    // few expected peers to exercise growing the index
+    const int n = 50;
+    std::vector<zmq::socket_t> dealers;
+    for (int i = 0; i < n; ++i) {
+        dealers.emplace_back(context, zmq::socket_type::dealer);
+        dealers.back().set(zmq::sockopt::routing_id, "peer" + std::to_string(i));
+        dealers.back().connect("inproc://router-server");
+    }
+
+    zmq::router_server_t<peer_stats> server(router, 4);
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < n; ++i)
+            dealers[i].send(zmq::buffer(std::to_string(i)), zmq::send_flags::none);
+        for (int i = 0; i < n; ++i) {
+            std::vector<zmq::message_t> parts;
+            zmq::router_server_t<peer_stats>::handle_type peer{};
+            auto ret = server.recv(peer, std::back_inserter(parts));
+            REQUIRE(ret);
+            REQUIRE(*ret == 1);
+            CHECK(server.routing_id(peer).to_string()
+                  == "peer" + parts[0].to_string());
+            server.state(peer).requests++;
+            server.state(peer).bytes += parts[0].size();
+            CHECK(server.send(peer, parts));
+        }
+    }
+    CHECK(server.size() == n);
+
+    for (int i = 0; i < n; ++i) {
+        const std::string id = "peer" + std::to_string(i);
+        zmq::router_server_t<peer_stats>::handle_type peer{};
+        REQUIRE(server.find(zmq::buffer(id), peer));
+        // handles are dense
+        CHECK(peer < static_cast<unsigned>(n));
+        CHECK(server.state(peer).requests == 3);
+        for (int round = 0; round < 3; ++round) {
+            zmq::message_t reply;
+            REQUIRE(dealers[i].recv(reply));
+            CHECK(reply.to_string() == std::to_string(i));
+        }
+    }
+}
+
+TEST_CASE("router server remove reuses handles", "[router_server]")
+{
+    zmq::context_t context;
+    zmq::socket_t router(context, zmq::socket_type::router);
+    zmq::socket_t a(context, zmq::socket_type::dealer);
+    zmq::socket_t b(context, zmq::socket_type::dealer);
+    router.bind("inproc://router-server-remove");
+    a.set(zmq::sockopt::routing_id, "a");
+    b.set(zmq::sockopt::routing_id, "b");
+    a.connect("inproc://router-server-remove");
+    b.connect("inproc://router-server-remove");
+
+    zmq::router_server_t<int> server(router);
+    CHECK(server.empty());
+    std::vector<zmq::message_t> parts;
+    zmq::router_server_t<int>::handle_type first{}, second{};
+    a.send(zmq::str_buffer("x"), zmq::send_flags::none);
+    REQUIRE(server.recv(first, std::back_inserter(parts)));
+    server.state(first) = 42;
+
+    server.remove(first);
+    CHECK(server.empty());
+    CHECK_FALSE(server.contains(first));
+    zmq::router_server_t<int>::handle_type found{};
+    CHECK_FALSE(server.find(zmq::str_buffer("a"), found));
+
+    b.send(zmq::str_buffer("y"), zmq::send_flags::none);
+    REQUIRE(server.recv(second, std::back_inserter(parts)));
+    CHECK(second == first);
+    CHECK(server.state(second) == 0);
+    CHECK(server.routing_id(second).to_string() == "b");
+    CHECK_FALSE(server.recv(second, std::back_inserter(parts),
+                            zmq::recv_flags::dontwait));
+
+    // an empty range would leave the routing id frame unterminated
+    std::vector<zmq::message_t> empty;
+    CHECK_THROWS_AS(server.send(second, empty), std::invalid_argument);
+
+    std::array<zmq::const_buffer, 2> reply = {zmq::str_buffer("r"),
+                                              zmq::str_buffer("s")};
+    auto ret = server.send(second, reply);
+    REQUIRE(ret);
+    CHECK(*ret == 2);
+    std::vector<zmq::message_t> received;
+    REQUIRE(zmq::recv_multipart(b, std::back_inserter(received)));
+    REQUIRE(received.size() == 2);
+    CHECK(received[1].to_string() == "s");
+}
+#endif
@@ -0,0 +1,214 @@
+#include <catch.hpp>
+#include <zmq_addon.hpp>
+
+#ifdef ZMQ_CPP11
+#include <thread>
+
+namespace
+{
+struct seq_pubsub_setup
+{
+    seq_pubsub_setup()
+    {
+        pub.bind("inproc://seq-pubsub");
+        router.bind("inproc://seq-pubsub-recovery");
+        sub.connect("inproc://seq-pubsub");
+        sub.set(zmq::sockopt::subscribe, "");
+        dealer.connect("inproc://seq-pubsub-recovery");
+        // wait for the subscription to arrive at the publisher
+        zmq::message_t subscription;
+        REQUIRE(pub.recv(subscription));
+    }
+
+    // consume a message bypassing the subscriber, simulating a drop
+    void drop()
+    {
+        std::vector<zmq::message_t> msgs;
+        REQUIRE(zmq::recv_multipart(sub, std::back_inserter(msgs)));
+    }
+
+    zmq::context_t context;
+    zmq::socket_t pub{context, zmq::socket_type::xpub};
+    zmq::socket_t sub{context, zmq::socket_type::sub};
+    zmq::socket_t router{context, zmq::socket_type::router};
+    zmq::socket_t dealer{context, zmq::socket_type::dealer};
+};
+
+void publish(zmq::seq_publisher_t &publisher, const std::string &topic, int n)
+{
+    for (int i = 0; i < n; ++i) {
+        const std::string payload = topic + std::to_string(i + 1);
+        std::array<zmq::const_buffer, 1> parts = {zmq::buffer(payload)};
+        REQUIRE(publisher.send(topic, parts));
+    }
+}
+}
+
+TEST_CASE("seq pubsub in order", "[seq_pubsub]")
+{
+    seq_pubsub_setup s;
+    zmq::seq_publisher_t publisher(s.pub);
+    zmq::seq_subscriber_t subscriber(s.sub, s.dealer);
+
+    publish(publisher, "a", 2);
+    publish(publisher, "b", 1);
+    CHECK(publisher.sequence("a") == 2);
+    CHECK(publisher.sequence("b") == 1);
+    CHECK(publisher.sequence("c") == 0);
+
+    zmq::multipart_t msg;
+    const char *expected[][2] = {{"a", "a1"}, {"a", "a2"}, {"b", "b1"}};
+    for (const auto &e : expected) {
+        auto ret = subscriber.recv(msg);
+        REQUIRE(ret);
+        CHECK(*ret == 2);
+        CHECK(msg.peekstr(0) == e[0]);
+        CHECK(msg.peekstr(1) == e[1]);
+    }
+    CHECK(subscriber.sequence("a") == 2);
+    CHECK(subscriber.lost() == 0);
+    CHECK_FALSE(subscriber.recv(msg, zmq::recv_flags::dontwait));
+}
+
+TEST_CASE("seq pubsub message parts are shared", "[seq_pubsub]")
+{
+    seq_pubsub_setup s;
+    zmq::seq_publisher_t publisher(s.pub);
+    zmq::seq_subscriber_t subscriber(s.sub, s.dealer);
+
+    std::vector<zmq::message_t> parts;
+    parts.emplace_back(std::string(1000, 'x'));
+    parts.emplace_back("tail", 4);
+    auto sret = publisher.send("t", parts);
+    REQUIRE(sret);
+    CHECK(*sret == 2);
+    CHECK(parts[0].size() == 1000);
+
+    zmq::multipart_t msg;
+    REQUIRE(subscriber.recv(msg));
+    REQUIRE(msg.size() == 3);
+    CHECK(msg.peekstr(1) == std::string(1000, 'x'));
+    CHECK(msg.peekstr(2) == "tail");
+}
+
+TEST_CASE("seq pubsub gap recovery", "[seq_pubsub]")
+{
+    seq_pubsub_setup s;
+    zmq::seq_publisher_t publisher(s.pub, 2);
+    zmq::seq_subscriber_t subscriber(s.sub, s.dealer);
+    std::vector<std::pair<uint64_t, uint64_t>> losses;
+    subscriber.on_loss(
+      [&](const std::string &topic, uint64_t first, uint64_t last) {
+          CHECK(topic == "a");
+          losses.emplace_back(first, last);
+      });
+
+    publish(publisher, "a", 5);
+    zmq::multipart_t msg;
+    REQUIRE(subscriber.recv(msg));
+    CHECK(msg.peekstr(1) == "a1");
+
+    // seq 2 and 3 were evicted, 4 is still retained by the publisher
+    s.drop();
+    s.drop();
+    s.drop();
+    std::thread server([&] { CHECK(publisher.handle_recovery(s.router)); });
+    REQUIRE(subscriber.recv(msg));
+    server.join();
+    CHECK(msg.peekstr(1) == "a4");
+    REQUIRE(subscriber.recv(msg));
+    CHECK(msg.peekstr(1) == "a5");
+
+    REQUIRE(losses.size() == 1);
+    CHECK(losses[0].first == 2);
+    CHECK(losses[0].second == 3);
+    CHECK(subscriber.lost() == 2);
+    CHECK(subscriber.sequence("a") == 5);
+}
+
+TEST_CASE("seq pubsub recovery timeout", "[seq_pubsub]")
+{
+    seq_pubsub_setup s;
+    zmq::seq_publisher_t publisher(s.pub);
+    zmq::seq_subscriber_t subscriber(s.sub, s.dealer,
+                                     std::chrono::milliseconds{10});
+
+    publish(publisher, "a", 3);
+    zmq::multipart_t msg;
+    REQUIRE(subscriber.recv(msg));
+    s.drop();
+    REQUIRE(subscriber.recv(msg));
+    CHECK(msg.peekstr(1) == "a3");
+    CHECK(subscriber.lost() == 1);
+
+    // the late reply to the timed out request is skipped
+    CHECK(publisher.handle_recovery(s.router));
+    publish(publisher, "a", 2);
+    s.drop();
+    std::thread server([&] { CHECK(publisher.handle_recovery(s.router)); });
+    REQUIRE(subscriber.recv(msg));
+    server.join();
+    CHECK(msg.peekstr(1) == "a1");
+    REQUIRE(subscriber.recv(msg));
+    CHECK(msg.peekstr(1) == "a2");
+    CHECK(subscriber.sequence("a") == 5);
+    CHECK(subscriber.lost() == 1);
+}
+
+TEST_CASE("seq pubsub publisher restart", "[seq_pubsub]")
+{
+    seq_pubsub_setup s;
+    zmq::seq_subscriber_t subscriber(s.sub, s.dealer);
+    std::vector<uint64_t> resets;
+    subscriber.on_reset([&](const std::string &topic, uint64_t sequence) {
+        CHECK(topic == "a");
+        resets.push_back(sequence);
+    });
+
+    zmq::multipart_t msg;
+    {
+        zmq::seq_publisher_t publisher(s.pub);
+        publish(publisher, "a", 3);
+        for (int i = 0; i < 3; ++i)
+            REQUIRE(subscriber.recv(msg));
+    }
+    zmq::seq_publisher_t restarted(s.pub);
+    publish(restarted, "a", 2);
+    REQUIRE(subscriber.recv(msg));
+    CHECK(msg.peekstr(1) == "a1");
+    REQUIRE(subscriber.recv(msg));
+    CHECK(msg.peekstr(1) == "a2");
+
+    REQUIRE(resets.size() == 1);
+    CHECK(resets[0] == 1);
+    CHECK(subscriber.resets() == 1);
+    CHECK(subscriber.lost() == 0);
+    CHECK(subscriber.sequence("a") == 2);
+}
+
+TEST_CASE("seq pubsub recovery dontwait", "[seq_pubsub]")
+{
+    seq_pubsub_setup s;
+    zmq::seq_publisher_t publisher(s.pub);
+    zmq::seq_subscriber_t subscriber(s.sub, s.dealer,
+                                     std::chrono::milliseconds{60000});
+
+    publish(publisher, "a", 3);
+    zmq::multipart_t msg;
+    REQUIRE(subscriber.recv(msg));
+    s.drop();
+    // the gap is detected, the recovery reply is outstanding
+    CHECK_FALSE(subscriber.recv(msg, zmq::recv_flags::dontwait));
+    CHECK_FALSE(subscriber.recv(msg, zmq::recv_flags::dontwait));
+
+    CHECK(publisher.handle_recovery(s.router));
+    zmq::recv_result_t ret;
+    for (int i = 0; i < 1000 && !ret; ++i)
+        ret = subscriber.recv(msg, zmq::recv_flags::dontwait);
+    REQUIRE(ret);
+    CHECK(msg.peekstr(1) == "a2");
+    REQUIRE(subscriber.recv(msg, zmq::recv_flags::dontwait));
+    CHECK(msg.peekstr(1) == "a3");
+    CHECK(subscriber.lost() == 0);
+}
+#endif
@@ -0,0 +1,83 @@
+#include <catch.hpp>
+#include <zmq_addon.hpp>
+
+#ifdef ZMQ_CPP11
+
+TEST_CASE("shared socket sends from many threads", "[shared_socket]")
+{
+    zmq::context_t context;
+    zmq::socket_t pull(context, zmq::socket_type::pull);
+    pull.bind("inproc://shared-socket");
+    zmq::socket_t push(context, zmq::socket_type::push);
+    push.connect("inproc://shared-socket");
+
+    const int senders = 4;
+    const int n = 1000;
+    zmq::shared_socket_t shared(std::move(push));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < senders; ++t) {
+        threads.emplace_back([&shared, t] {
+            for (int i = 0; i < n; ++i) {
+                std::vector<zmq::message_t> parts;
+                parts.emplace_back(std::to_string(t));
+                parts.emplace_back(std::to_string(i));
+                CHECK(shared.send_multipart(parts) == 2);
+                CHECK(parts[0].size() == 0);
+            }
+        });
+    }
+
+    // parts are never interleaved, each sender's messages keep their order
+    std::vector<int> next(senders, 0);
+    for (int i = 0; i < senders * n; ++i) {
+        std::vector<zmq::message_t> msgs;
+        REQUIRE(zmq::recv_multipart(pull, std::back_inserter(msgs)));
+        REQUIRE(msgs.size() == 2);
+        const int t = std::stoi(msgs[0].to_string());
+        CHECK(std::stoi(msgs[1].to_string()) == next[t]++);
+    }
+    for (auto &thread : threads)
+        thread.join();
+    shared.flush();
+    CHECK(shared.sent() == senders * n);
+    CHECK(shared.dropped() == 0);
+}
+
+TEST_CASE("shared socket sends queued messages on destruction", "[shared_socket]")
+{
+    zmq::context_t context;
+    zmq::socket_t pull(context, zmq::socket_type::pull);
+    pull.bind("inproc://shared-socket");
+    zmq::socket_t push(context, zmq::socket_type::push);
+    push.connect("inproc://shared-socket");
+    {
+        zmq::shared_socket_t shared(std::move(push));
+        zmq::message_t msg("abc", 3);
+        CHECK(shared.send(msg) == 3);
+        CHECK(msg.size() == 0);
+        CHECK(shared.send(zmq::str_buffer("de")) == 2);
+    }
+    zmq::message_t msg;
+    REQUIRE(pull.recv(msg));
+    CHECK(msg.to_string() == "abc");
+    REQUIRE(pull.recv(msg));
+    CHECK(msg.to_string() == "de");
+}
+
+TEST_CASE("shared socket stops on socket errors", "[shared_socket]")
+{
+    zmq::context_t context;
+    zmq::socket_t router(context, zmq::socket_type::router);
+    router.set(zmq::sockopt::router_mandatory, true);
+    zmq::shared_socket_t shared(std::move(router));
+    std::vector<zmq::message_t> parts;
+    parts.emplace_back(std::string("unknown peer"));
+    parts.emplace_back(std::string("payload"));
+    shared.send_multipart(parts);
+    CHECK_THROWS_AS(shared.flush(), zmq::error_t);
+    CHECK_THROWS_AS(shared.send(zmq::str_buffer("x")), zmq::error_t);
+    CHECK(shared.sent() == 0);
+    CHECK(shared.dropped() == 1);
+}
+
+#endif
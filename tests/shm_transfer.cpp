@@ -0,0 +1,168 @@
+#include <catch.hpp>
+#include <zmq_addon.hpp>
+
+#if defined(ZMQ_CPP11) && !defined(_WIN32)
+
+namespace
+{
+struct shm_setup
+{
+    shm_setup()
+    {
+        receiving.bind("inproc://shm-transfer");
+        sending.connect("inproc://shm-transfer");
+    }
+
+    zmq::context_t context;
+    zmq::socket_t sending{context, zmq::socket_type::pair};
+    zmq::socket_t receiving{context, zmq::socket_type::pair};
+};
+}
+
+TEST_CASE("shm transfer inline and shared payloads", "[shm_transfer]")
+{
+    shm_setup s;
+    zmq::shm_sender_t sender(s.sending, 1024);
+    zmq::shm_receiver_t receiver(s.receiving);
+    CHECK(sender.inline_threshold() == 1024);
+
+    CHECK(sender.send(zmq::str_buffer("small")));
+    CHECK(sender.in_flight() == 0);
+    zmq::message_t msg;
+    auto ret = receiver.recv(msg);
+    REQUIRE(ret);
+    CHECK(msg.to_string() == "small");
+
+    std::string large(1 << 20, 'x');
+    large[12345] = 'y';
+    ret = sender.send(zmq::buffer(large));
+    REQUIRE(ret);
+    CHECK(*ret == large.size());
+    CHECK(sender.in_flight() == 1);
+
+    {
+        zmq::message_t shared;
+        REQUIRE(receiver.recv(shared));
+        CHECK(shared.size() == large.size());
+        CHECK(shared.to_string() == large);
+        // copy-on-write, the sender's segment is not modified
+        shared.data<char>()[0] = 'z';
+        CHECK(sender.process_releases() == 0);
+    }
+    CHECK(receiver.flush_releases() == 1);
+    CHECK(sender.process_releases() == 1);
+    CHECK(sender.in_flight() == 0);
+}
+
+TEST_CASE("shm transfer fills allocated blocks in place", "[shm_transfer]")
+{
+    shm_setup s;
+    zmq::shm_sender_t sender(s.sending, 0, 1);
+    zmq::shm_receiver_t receiver(s.receiving);
+
+    zmq::shm_sender_t::block b = sender.allocate(4096);
+    REQUIRE(b.size == 4096);
+    memset(b.data, 'a', b.size);
+    REQUIRE(sender.send(b));
+
+    zmq::message_t msg;
+    REQUIRE(receiver.recv(msg));
+    CHECK(msg.to_string() == std::string(4096, 'a'));
+    msg.rebuild();
+
+    // the release is sent by the next receive, empty payloads are
+    // released right away
+    CHECK(sender.send(zmq::str_buffer("")));
+    REQUIRE(receiver.recv(msg));
+    CHECK(msg.size() == 0);
+    CHECK(sender.process_releases() == 1);
+    CHECK(receiver.flush_releases() == 1);
+    CHECK(sender.process_releases() == 1);
+
+    // the pooled segment is reused for a smaller block
+    const zmq::shm_sender_t::block reused = sender.allocate(100);
+    CHECK(reused.id == b.id);
+    CHECK(reused.data == b.data);
+    CHECK(reused.size == 100);
+}
+
+TEST_CASE("shm transfer ignores releases of segments not in flight",
+          "[shm_transfer]")
+{
+    shm_setup s;
+    zmq::shm_sender_t sender(s.sending, 0, 4);
+
+    const auto send_release = [&](uint64_t id) {
+        zmq::message_t msg(8);
+        for (int i = 0; i < 8; ++i)
+            msg.data<unsigned char>()[i] =
+              static_cast<unsigned char>(id >> (56 - 8 * i));
+        s.receiving.send(
+          zmq::detail::shm_kind_message(zmq::detail::shm_kind::release),
+          zmq::send_flags::sndmore);
+        s.receiving.send(msg, zmq::send_flags::none);
+    };
+
+    const zmq::shm_sender_t::block b = sender.allocate(100);
+    const zmq::shm_sender_t::block unsent = sender.allocate(100);
+    CHECK(unsent.id != b.id);
+    REQUIRE(sender.send(b));
+    zmq::message_t descriptor;
+    REQUIRE(s.receiving.recv(descriptor));
+    REQUIRE(s.receiving.recv(descriptor));
+    CHECK(sender.in_flight() == 1);
+
+    // duplicate release, and a release of an allocated unsent block
+    send_release(b.id);
+    send_release(b.id);
+    send_release(unsent.id);
+    CHECK(sender.process_releases() == 1);
+    CHECK(sender.in_flight() == 0);
+
+    // the segment is pooled once, so live blocks never share it
+    const zmq::shm_sender_t::block first = sender.allocate(100);
+    const zmq::shm_sender_t::block second = sender.allocate(100);
+    CHECK(first.id == b.id);
+    CHECK(second.id != b.id);
+    CHECK(second.id != unsent.id);
+    CHECK(second.data != first.data);
+}
+
+TEST_CASE("shm transfer discards invalid descriptors", "[shm_transfer]")
+{
+    shm_setup s;
+    zmq::shm_receiver_t receiver(s.receiving);
+
+    // a segment smaller than the size claimed by the descriptor
+    const std::string name =
+      "/zmq-shm-" + std::to_string(getpid()) + "-999999-1";
+    const int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+    REQUIRE(fd != -1);
+    REQUIRE(ftruncate(fd, 16) == 0);
+    ::close(fd);
+
+    const auto send_descriptor = [&](const std::string &segment, uint64_t size) {
+        zmq::message_t descriptor(16 + segment.size());
+        unsigned char *data = descriptor.data<unsigned char>();
+        for (int i = 0; i < 8; ++i) {
+            data[i] = 0;
+            data[8 + i] = static_cast<unsigned char>(size >> (56 - 8 * i));
+        }
+        memcpy(data + 16, segment.data(), segment.size());
+        s.sending.send(zmq::detail::shm_kind_message(zmq::detail::shm_kind::shared),
+                       zmq::send_flags::sndmore);
+        s.sending.send(descriptor, zmq::send_flags::none);
+    };
+    send_descriptor(name, 1 << 20);
+    send_descriptor("/some-other-object", 16);
+    send_descriptor("/zmq-shm-1-2", 16);
+
+    zmq::message_t msg;
+    CHECK_FALSE(receiver.recv(msg, zmq::recv_flags::dontwait));
+    send_descriptor(name, 16);
+    REQUIRE(receiver.recv(msg, zmq::recv_flags::dontwait));
+    CHECK(msg.size() == 16);
+    msg.rebuild();
+    shm_unlink(name.c_str());
+}
+#endif
@@ -0,0 +1,54 @@
+#include <catch.hpp>
+#include <zmq_addon.hpp>
+
+#ifdef ZMQ_CPP11
+
+namespace
+{
+using worker_config =
+  zmq::socket_config<zmq::option_value<zmq::sockopt::linger_t, 0>,
+                     zmq::option_value<zmq::sockopt::sndhwm_t, 100>,
+                     zmq::option_value<zmq::sockopt::immediate_t, true>,
+                     zmq::option_value<zmq::sockopt::maxmsgsize_t, 1 << 20>>;
+
+static_assert(worker_config::size() == 4, "");
+static_assert(worker_config::contains<zmq::sockopt::sndhwm_t>(), "");
+static_assert(!worker_config::contains<zmq::sockopt::rcvhwm_t>(), "");
+static_assert(worker_config::get<zmq::sockopt::sndhwm_t>() == 100, "");
+static_assert(worker_config::get<zmq::sockopt::maxmsgsize_t>() == 1 << 20, "");
+static_assert(zmq::socket_config<>::size() == 0, "");
+}
+
+TEST_CASE("socket config applies options", "[socket_config]")
+{
+    zmq::context_t context;
+    zmq::socket_t socket = worker_config::make(context, zmq::socket_type::dealer);
+    CHECK(socket.get(zmq::sockopt::linger) == 0);
+    CHECK(socket.get(zmq::sockopt::sndhwm) == 100);
+    CHECK(socket.get(zmq::sockopt::immediate) == 1);
+    CHECK(socket.get(zmq::sockopt::maxmsgsize) == 1 << 20);
+
+    zmq::socket_t pull(context, zmq::socket_type::pull);
+    zmq::socket_config<>::apply(pull);
+    zmq::socket_config<zmq::option_value<zmq::sockopt::rcvhwm_t, 7>>::apply(pull);
+    CHECK(pull.get(zmq::sockopt::rcvhwm) == 7);
+}
+
+#ifdef ZMQ_ROUTER_MANDATORY
+TEST_CASE("socket config rejected option", "[socket_config]")
+{
+    zmq::context_t context;
+    using config = zmq::socket_config<zmq::option_value<zmq::sockopt::router_mandatory_t, 1>,
+                                      zmq::option_value<zmq::sockopt::linger_t, 0>>;
+    zmq::socket_t socket(context, zmq::socket_type::dealer);
+    try {
+        config::apply(socket);
+        FAIL("router_mandatory on a dealer socket was accepted");
+    }
+    catch (const zmq::socket_profile_error &e) {
+        CHECK(e.option() == ZMQ_ROUTER_MANDATORY);
+    }
+}
+#endif
+
+#endif
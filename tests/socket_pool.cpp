@@ -0,0 +1,129 @@
+#include <catch.hpp>
+#include <zmq_addon.hpp>
+
+#if defined(ZMQ_CPP11) && defined(ZMQ_NEW_MONITOR_EVENT_LAYOUT)
+
+namespace
+{
+struct pool_setup
+{
+    pool_setup()
+    {
+        backend.bind("tcp://127.0.0.1:*");
+        endpoint = backend.get(zmq::sockopt::last_endpoint);
+    }
+
+    // Echo one request on the backend.
+    void echo()
+    {
+        std::vector<zmq::message_t> msgs;
+        REQUIRE(zmq::recv_multipart(backend, std::back_inserter(msgs)));
+        zmq::send_multipart(backend, msgs);
+    }
+
+    void roundtrip(zmq::socket_pool_t::lease &lease)
+    {
+        lease->send(zmq::str_buffer("ping"), zmq::send_flags::none);
+        echo();
+        zmq::message_t msg;
+        REQUIRE(lease->recv(msg));
+        CHECK(msg.to_string() == "ping");
+    }
+
+    zmq::context_t context;
+    zmq::socket_t backend{context, zmq::socket_type::router};
+    std::string endpoint;
+};
+}
+
+TEST_CASE("socket pool reuses idle sockets", "[socket_pool]")
+{
+    pool_setup s;
+    zmq::socket_pool_t pool(s.context);
+    void *handle;
+    {
+        auto lease = pool.acquire(zmq::socket_type::dealer, s.endpoint);
+        REQUIRE(lease);
+        handle = lease.socket().handle();
+        s.roundtrip(lease);
+    }
+    CHECK(pool.idle() == 1);
+
+    std::thread([&] {
+        auto lease = pool.acquire(zmq::socket_type::dealer, s.endpoint);
+        CHECK(lease.socket().handle() == handle);
+        s.roundtrip(lease);
+    }).join();
+
+    {
+        // a different profile is a different key
+        auto lease = pool.acquire(zmq::socket_type::dealer, s.endpoint,
+                                  zmq::socket_profile_t::low_latency());
+        CHECK(lease.socket().handle() != handle);
+        CHECK(lease->get(zmq::sockopt::linger) == 0);
+        lease.discard();
+    }
+    const auto stats = pool.statistics();
+    CHECK(stats.hits == 1);
+    CHECK(stats.misses == 2);
+    CHECK(pool.idle() == 1);
+    pool.clear();
+    CHECK(pool.idle() == 0);
+}
+
+TEST_CASE("socket pool caps idle sockets", "[socket_pool]")
+{
+    pool_setup s;
+    zmq::socket_pool_t pool(s.context, 2);
+    CHECK(pool.max_idle() == 2);
+    {
+        std::vector<zmq::socket_pool_t::lease> leases;
+        for (int i = 0; i < 3; ++i)
+            leases.push_back(pool.acquire(zmq::socket_type::push, s.endpoint));
+    }
+    CHECK(pool.idle() == 2);
+    CHECK(pool.statistics().evicted == 1);
+}
+
+TEST_CASE("socket pool drops unhealthy sockets", "[socket_pool]")
+{
+    pool_setup s;
+    zmq::socket_pool_t pool(s.context);
+    SECTION("unread messages") {
+        {
+            auto lease = pool.acquire(zmq::socket_type::dealer, s.endpoint);
+            lease->send(zmq::str_buffer("ping"), zmq::send_flags::none);
+            s.echo();
+            // wait for the reply, but leave it unread
+            zmq::pollitem_t items[] = {{lease->handle(), 0, ZMQ_POLLIN, 0}};
+            REQUIRE(zmq::poll(items, 1, std::chrono::milliseconds{1000}) == 1);
+        }
+        auto lease = pool.acquire(zmq::socket_type::dealer, s.endpoint);
+        CHECK(pool.statistics().unhealthy == 1);
+        s.roundtrip(lease);
+    }
+    SECTION("req waiting for a reply") {
+        {
+            auto lease = pool.acquire(zmq::socket_type::req, s.endpoint);
+            lease->send(zmq::str_buffer("ping"), zmq::send_flags::none);
+            // take the request, but do not reply
+            std::vector<zmq::message_t> msgs;
+            REQUIRE(zmq::recv_multipart(s.backend, std::back_inserter(msgs)));
+        }
+        auto lease = pool.acquire(zmq::socket_type::req, s.endpoint);
+        CHECK(pool.statistics().unhealthy == 1);
+    }
+    SECTION("disconnected") {
+        {
+            auto lease = pool.acquire(zmq::socket_type::dealer, s.endpoint);
+            s.roundtrip(lease);
+        }
+        s.backend.close();
+        std::this_thread::sleep_for(std::chrono::milliseconds{100});
+        auto lease = pool.acquire(zmq::socket_type::dealer, s.endpoint);
+        CHECK(pool.statistics().unhealthy == 1);
+        CHECK(pool.statistics().misses == 2);
+    }
+}
+
+#endif
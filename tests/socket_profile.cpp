@@ -0,0 +1,78 @@
+#include <catch.hpp>
+#include <zmq_addon.hpp>
+
+#ifdef ZMQ_CPP11
+
+TEST_CASE("socket profile validates values", "[socket_profile]")
+{
+    zmq::socket_profile_t profile("test");
+    CHECK(profile.name() == "test");
+    CHECK_THROWS_AS(profile.set(zmq::sockopt::sndhwm, -1), std::invalid_argument);
+    CHECK_THROWS_AS(profile.set(zmq::sockopt::linger, -2), std::invalid_argument);
+    CHECK_THROWS_AS(profile.set(zmq::sockopt::tcp_keepalive, 2),
+                    std::invalid_argument);
+    CHECK(profile.size() == 0);
+
+    profile.set(zmq::sockopt::linger, -1).set(zmq::sockopt::sndhwm, 10);
+    profile.set(zmq::sockopt::sndhwm, 20);
+    CHECK(profile.size() == 2);
+    CHECK(profile.contains(ZMQ_SNDHWM));
+    CHECK(!profile.contains(ZMQ_RCVHWM));
+}
+
+TEST_CASE("socket profile applied at creation", "[socket_profile]")
+{
+    zmq::context_t context;
+    const auto profile = zmq::socket_profile_t::low_latency()
+                           .set(zmq::sockopt::sndhwm, 5)
+                           .set(zmq::sockopt::routing_id, "peer");
+    zmq::socket_t socket = zmq::make_socket(context, zmq::socket_type::dealer, profile);
+    CHECK(socket.get(zmq::sockopt::sndhwm) == 5);
+    CHECK(socket.get(zmq::sockopt::rcvhwm) == 1000);
+    CHECK(socket.get(zmq::sockopt::linger) == 0);
+    CHECK(socket.get(zmq::sockopt::immediate) == 1);
+    CHECK(socket.get(zmq::sockopt::routing_id) == "peer");
+
+    for (const auto &builtin : {zmq::socket_profile_t::bulk_throughput(),
+                                zmq::socket_profile_t::many_subscribers()}) {
+        zmq::socket_t pub = zmq::make_socket(context, zmq::socket_type::pub, builtin);
+        CHECK(pub.get(zmq::sockopt::sndhwm) > 1000);
+    }
+}
+
+TEST_CASE("socket profile rejected option", "[socket_profile]")
+{
+    zmq::context_t context;
+    zmq::socket_profile_t profile;
+    profile.set(zmq::sockopt::linger, 0).set(zmq::sockopt::subscribe, "topic");
+    try {
+        zmq::make_socket(context, zmq::socket_type::push, profile);
+        FAIL("subscribe on a push socket was accepted");
+    }
+    catch (const zmq::socket_profile_error &e) {
+        CHECK(e.option() == ZMQ_SUBSCRIBE);
+        CHECK(e.num() == EINVAL);
+    }
+}
+
+TEST_CASE("profiled socket caches immutable options", "[socket_profile]")
+{
+    zmq::context_t context;
+    zmq::profiled_socket_t socket(context, zmq::socket_type::pull,
+                                  zmq::socket_profile_t::bulk_throughput());
+    CHECK(socket.type() == zmq::socket_type::pull);
+    CHECK(socket.get(zmq::sockopt::type) == ZMQ_PULL);
+    CHECK(socket.get(zmq::sockopt::fd) == socket.socket_t::get(zmq::sockopt::fd));
+    CHECK(socket.get(zmq::sockopt::rcvhwm) == 100000);
+    CHECK(socket.profile().name() == "bulk_throughput");
+
+    socket.bind("inproc://profiled-socket");
+    zmq::socket_t push(context, zmq::socket_type::push);
+    push.connect("inproc://profiled-socket");
+    push.send(zmq::str_buffer("hi"), zmq::send_flags::none);
+    zmq::message_t msg;
+    REQUIRE(socket.recv(msg));
+    CHECK(msg.to_string() == "hi");
+}
+
+#endif
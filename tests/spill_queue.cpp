@@ -0,0 +1,113 @@
+#include <catch.hpp>
+#include <zmq_addon.hpp>
+
+#if defined(ZMQ_CPP11) && !defined(_WIN32)
+
+namespace
+{
+struct spill_setup
+{
+    explicit spill_setup(const std::string &directory) : directory(directory)
+    {
+        pushing.set(zmq::sockopt::sndhwm, 1);
+        pulling.set(zmq::sockopt::rcvhwm, 1);
+    }
+
+    ~spill_setup() { ::rmdir(directory.c_str()); }
+
+    void connect()
+    {
+        pulling.bind("inproc://spill-queue");
+        pushing.connect("inproc://spill-queue");
+    }
+
+    std::string directory;
+    zmq::context_t context;
+    zmq::socket_t pushing{context, zmq::socket_type::push};
+    zmq::socket_t pulling{context, zmq::socket_type::pull};
+};
+}
+
+TEST_CASE("spill queue preserves order past the hwm", "[spill_queue]")
+{
+    spill_setup s("spill_queue_order");
+    s.connect();
+    zmq::spill_queue_t queue(s.pushing, s.directory, 4096);
+    CHECK(queue.empty());
+    CHECK(queue.directory() == s.directory);
+
+    const int count = 200;
+    int sent = 0;
+    for (int i = 0; i < count; ++i) {
+        const std::string payload = std::to_string(i);
+        std::array<zmq::const_buffer, 2> parts = {zmq::str_buffer("part"),
+                                                  zmq::buffer(payload)};
+        if (queue.send_multipart(parts))
+            ++sent;
+    }
+    CHECK(sent > 0);
+    CHECK(sent < count);
+    CHECK(queue.pending() == static_cast<size_t>(count - sent));
+    CHECK(queue.segments() > 1);
+
+    // nothing can be sent until the receiver makes room
+    CHECK(queue.flush() == 0);
+
+    for (int i = 0; i < count; ++i) {
+        std::vector<zmq::message_t> msgs;
+        zmq::recv_result_t ret;
+        while (!(ret = zmq::recv_multipart(s.pulling, std::back_inserter(msgs),
+                                           zmq::recv_flags::dontwait)))
+            queue.drain(std::chrono::milliseconds{10});
+        REQUIRE(*ret == 2);
+        CHECK(msgs[0].to_string() == "part");
+        CHECK(msgs[1].to_string() == std::to_string(i));
+    }
+    CHECK(queue.empty());
+    CHECK(queue.pending_bytes() == 0);
+    CHECK(queue.segments() == 1);
+}
+
+TEST_CASE("spill queue resumes from disk", "[spill_queue]")
+{
+    spill_setup s("spill_queue_resume");
+    {
+        zmq::spill_queue_t queue(s.pushing, s.directory);
+        // no peer connected, everything is spilled
+        zmq::message_t msg("first", 5);
+        CHECK(!queue.send(msg));
+        CHECK(msg.to_string() == "first");
+        CHECK(!queue.send(zmq::str_buffer("second")));
+        CHECK(queue.pending() == 2);
+        CHECK(queue.pending_bytes() == 11);
+        queue.sync();
+    }
+    // stray files with segment like names are skipped
+    const std::string stray[] = {s.directory + "/spill-0000000000000000000x.log",
+                                 s.directory + "/spill-99999999999999999999.log"};
+    for (const auto &path : stray)
+        std::ofstream(path) << "stray";
+
+    zmq::spill_queue_t queue(s.pushing, s.directory);
+    CHECK(queue.pending() == 2);
+    CHECK(queue.pending_bytes() == 11);
+    CHECK(!queue.send(zmq::str_buffer("third")));
+    CHECK(!queue.drain(std::chrono::milliseconds{0}));
+
+    s.connect();
+    zmq::message_t msg;
+    for (const char *expected : {"first", "second", "third"}) {
+        queue.drain(std::chrono::milliseconds{100});
+        REQUIRE(s.pulling.recv(msg));
+        CHECK(msg.to_string() == expected);
+    }
+    CHECK(queue.empty());
+    queue.send(zmq::str_buffer("last"));
+    CHECK(queue.drain(std::chrono::milliseconds{100}));
+    REQUIRE(s.pulling.recv(msg));
+    CHECK(msg.to_string() == "last");
+    for (const auto &path : stray)
+        ::unlink(path.c_str());
+}
+
+#endif
@@ -0,0 +1,92 @@
+#include <catch.hpp>
+#include <zmq_addon.hpp>
+
+#ifdef ZMQ_CPP11
+
+TEST_CASE("latency histogram buckets", "[tracing]")
+{
+    zmq::latency_histogram_t histogram;
+    CHECK(histogram.count() == 0);
+    for (uint64_t v : {uint64_t(0), uint64_t(15), uint64_t(16), uint64_t(17),
+                       uint64_t(1000), uint64_t(1) << 40, ~uint64_t(0)}) {
+        const size_t bucket = zmq::latency_histogram_t::bucket(v);
+        CHECK(bucket < zmq::latency_histogram_t::bucket_count);
+        CHECK(zmq::latency_histogram_t::bucket_lower(bucket) <= v);
+        // relative error of a bucket is bounded by 1/16
+        CHECK(v - zmq::latency_histogram_t::bucket_lower(bucket) <= v / 16);
+        histogram.record(v);
+    }
+    CHECK(zmq::latency_histogram_t::bucket(16) == 16);
+    CHECK(zmq::latency_histogram_t::bucket(32) == 32);
+    CHECK(zmq::latency_histogram_t::bucket(34) == 33);
+    CHECK(histogram.count() == 7);
+    CHECK(histogram.bucket_value(zmq::latency_histogram_t::bucket(1000)) == 1);
+    histogram.record(std::chrono::nanoseconds{-5});
+    CHECK(histogram.bucket_value(0) == 2);
+    histogram.reset();
+    CHECK(histogram.count() == 0);
+}
+
+TEST_CASE("tracer propagates context", "[tracing]")
+{
+    zmq::context_t context;
+    zmq::socket_t push(context, zmq::socket_type::push);
+    zmq::socket_t pull(context, zmq::socket_type::pull);
+    pull.bind("inproc://tracing");
+    push.connect("inproc://tracing");
+
+    zmq::tracer_t tracer(42);
+    const zmq::trace_context root = tracer.start_trace();
+    CHECK(root.valid());
+    const zmq::trace_context span = tracer.child(root);
+    CHECK(span.trace_id_low == root.trace_id_low);
+    CHECK(span.span_id != root.span_id);
+
+    std::array<zmq::const_buffer, 2> parts = {zmq::str_buffer("a"),
+                                              zmq::str_buffer("b")};
+    auto sret = tracer.send(push, span, parts);
+    REQUIRE(sret);
+    CHECK(*sret == 2);
+
+    zmq::trace_context received;
+    std::vector<zmq::message_t> msgs;
+    auto rret = tracer.recv(pull, std::back_inserter(msgs), received);
+    REQUIRE(rret);
+    CHECK(*rret == 2);
+    REQUIRE(msgs.size() == 2);
+    CHECK(msgs[0].to_string() == "a");
+    CHECK(received.trace_id_high == span.trace_id_high);
+    CHECK(received.trace_id_low == span.trace_id_low);
+    CHECK(received.span_id == span.span_id);
+    CHECK(received.send_time_ns > 0);
+    CHECK(received.send_time_ns <= zmq::tracer_t::now_ns());
+    CHECK(tracer.hop_latency().count() == 1);
+
+    // untraced messages pass unchanged
+    push.send(zmq::str_buffer("plain"), zmq::send_flags::none);
+    msgs.clear();
+    rret = tracer.recv(pull, std::back_inserter(msgs), received);
+    REQUIRE(rret);
+    CHECK(*rret == 1);
+    CHECK(msgs[0].to_string() == "plain");
+    CHECK_FALSE(received.valid());
+    CHECK(tracer.hop_latency().count() == 1);
+
+    const zmq::message_t frame = zmq::tracer_t::make_frame(root, 7);
+    CHECK(frame.size() <= 33); // stored inline in the message
+    zmq::trace_context parsed;
+    REQUIRE(zmq::tracer_t::parse_frame(frame, parsed));
+    CHECK(parsed.span_id == root.span_id);
+    CHECK(parsed.send_time_ns == 7);
+
+    // frames of the same size are no trace frames without version and ids
+    std::string data(frame.data<char>(), frame.size());
+    data[0] = 'X';
+    CHECK_FALSE(zmq::tracer_t::parse_frame(zmq::message_t(data), parsed));
+    zmq::trace_context untraced = root;
+    untraced.trace_id_high = untraced.trace_id_low = 0;
+    CHECK_FALSE(zmq::tracer_t::parse_frame(
+      zmq::tracer_t::make_frame(untraced, 7), parsed));
+    CHECK(parsed.span_id == root.span_id);
+}
+#endif
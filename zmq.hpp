@@ -2162,6 +2162,74 @@ inline void proxy_steerable(socket_ref frontend,
 }
 #endif
 
+#if defined(ZMQ_CPP11) && defined(ZMQ_NEW_MONITOR_EVENT_LAYOUT)
+/*  A monitor event decoded in place by monitor_t::drain_events.
+
+    The address refers to the received frame and is only valid during
+    the visitor call.
+*/
+struct monitor_event
+{
+    uint16_t event; // one of ZMQ_EVENT_*
+    int32_t value;  // fd, errno or reconnect interval, depending on event
+    const_buffer addr;
+
+#if defined(ZMQ_HAS_STRING_VIEW) && (ZMQ_HAS_STRING_VIEW > 0)
+    std::string_view address() const noexcept
+    {
+        return std::string_view(static_cast<const char *>(addr.data()),
+                                addr.size());
+    }
+#endif
+};
+
+namespace detail
+{
+// implements monitor_t::drain_events on any monitor PAIR socket
+template<class Visitor>
+size_t
+drain_monitor_events(socket_ref monitor_socket, Visitor &&visitor, int timeout)
+{
+    message_t event_msg;
+    message_t addr_msg;
+    size_t count = 0;
+    while (true) {
+        int rc = zmq_msg_recv(event_msg.handle(), monitor_socket.handle(),
+                              ZMQ_DONTWAIT);
+        if (rc == -1) {
+            if (zmq_errno() != EAGAIN || count > 0 || timeout == 0)
+                break;
+            zmq::pollitem_t items[] = {
+              {monitor_socket.handle(), 0, ZMQ_POLLIN, 0},
+            };
+            zmq::poll(&items[0], 1, timeout);
+            if (!(items[0].revents & ZMQ_POLLIN))
+                break;
+            timeout = 0;
+            continue;
+        }
+        rc = zmq_msg_recv(addr_msg.handle(), monitor_socket.handle(), 0);
+        if (rc == -1 && zmq_errno() == ETERM)
+            break;
+        assert(rc != -1);
+
+        const char *data = event_msg.data<char>();
+        monitor_event event;
+        memcpy(&event.event, data, sizeof(uint16_t));
+        memcpy(&event.value, data + sizeof(uint16_t), sizeof(int32_t));
+        event.addr = const_buffer(addr_msg.data(), addr_msg.size());
+        ++count;
+        visitor(static_cast<const monitor_event &>(event));
+#ifdef ZMQ_EVENT_MONITOR_STOPPED
+        if (event.event == ZMQ_EVENT_MONITOR_STOPPED)
+            break;
+#endif
+    }
+    return count;
+}
+} // namespace detail
+#endif
+
 class monitor_t
 {
   public:
@@ -2343,6 +2411,25 @@ class monitor_t
         return true;
     }
 
+#if defined(ZMQ_CPP11) && defined(ZMQ_NEW_MONITOR_EVENT_LAYOUT)
+    /*  Decode all pending events in place and pass them to
+        visitor(const monitor_event &), bypassing the on_event_* callbacks.
+        Waits up to timeout milliseconds (-1 waits forever) if no event is
+        pending. The received frames are reused, no memory is allocated
+        for events with addresses short enough for small messages.
+
+        Draining stops after ZMQ_EVENT_MONITOR_STOPPED, which is passed
+        to the visitor as well.
+        Returns: the number of events passed to the visitor.
+    */
+    template<class Visitor> size_t drain_events(Visitor &&visitor, int timeout = 0)
+    {
+        assert(_monitor_socket);
+        return detail::drain_monitor_events(_monitor_socket,
+                                            std::forward<Visitor>(visitor), timeout);
+    }
+#endif
+
 #ifdef ZMQ_EVENT_MONITOR_STOPPED
     void abort()
     {
@@ -2534,6 +2621,23 @@ template<typename T = no_user_data> class poller_t
         add_impl(socket, events, nullptr);
     }
 
+#ifdef _WIN32
+    using fd_type = SOCKET;
+#else
+    using fd_type = int;
+#endif
+
+    template<
+      typename Dummy = void,
+      typename =
+        typename std::enable_if<!std::is_same<T, no_user_data>::value, Dummy>::type>
+    void add_fd(fd_type fd, event_flags events, T *user_data)
+    {
+        add_fd_impl(fd, events, user_data);
+    }
+
+    void add_fd(fd_type fd, event_flags events) { add_fd_impl(fd, events, nullptr); }
+
     void remove(zmq::socket_ref socket)
     {
         if (0 != zmq_poller_remove(poller_ptr.get(), socket.handle())) {
@@ -2550,6 +2654,22 @@ template<typename T = no_user_data> class poller_t
         }
     }
 
+    void remove_fd(fd_type fd)
+    {
+        if (0 != zmq_poller_remove_fd(poller_ptr.get(), fd)) {
+            throw error_t();
+        }
+    }
+
+    void modify_fd(fd_type fd, event_flags events)
+    {
+        if (0
+            != zmq_poller_modify_fd(poller_ptr.get(), fd,
+                                    static_cast<short>(events))) {
+            throw error_t();
+        }
+    }
+
     size_t wait_all(std::vector<event_type> &poller_events,
                     const std::chrono::milliseconds timeout)
     {
@@ -2591,6 +2711,15 @@ template<typename T = no_user_data> class poller_t
             throw error_t();
         }
     }
+
+    void add_fd_impl(fd_type fd, event_flags events, T *user_data)
+    {
+        if (0
+            != zmq_poller_add_fd(poller_ptr.get(), fd, user_data,
+                                 static_cast<short>(events))) {
+            throw error_t();
+        }
+    }
 };
 #endif //  defined(ZMQ_BUILD_DRAFT_API) && defined(ZMQ_CPP11) && defined(ZMQ_HAVE_POLLER)
 
@@ -27,14 +27,34 @@
 #include "zmq.hpp"
 
 #include <deque>
+#include <fstream>
 #include <iomanip>
 #include <sstream>
 #include <stdexcept>
 #ifdef ZMQ_CPP11
 #include <limits>
+#include <atomic>
+#include <condition_variable>
 #include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <thread>
 #include <unordered_map>
 #endif
+#if defined(ZMQ_CPP11) && !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/eventfd.h>
+#endif
+#endif
 
 namespace zmq
 {
@@ -271,6 +291,275 @@ template<class OutputIt> OutputIt decode(const message_t &encoded, OutputIt out)
     return out;
 }
 
+namespace detail
+{
+// unsigned LEB128, 7 bits per byte, least significant group first
+inline size_t varint_size(uint64_t value) noexcept
+{
+    size_t n = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        ++n;
+    }
+    return n;
+}
+
+inline unsigned char *put_varint(unsigned char *out, uint64_t value) noexcept
+{
+    while (value >= 0x80) {
+        *out++ = static_cast<unsigned char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    *out++ = static_cast<unsigned char>(value);
+    return out;
+}
+
+inline void put_varint(std::string &out, uint64_t value)
+{
+    unsigned char buf[10];
+    out.append(reinterpret_cast<char *>(buf),
+               static_cast<size_t>(put_varint(buf, value) - buf));
+}
+
+// Returns false on truncated or overlong input.
+inline bool get_varint(const unsigned char *&it,
+                       const unsigned char *end,
+                       uint64_t &value) noexcept
+{
+    value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (it == end)
+            return false;
+        const unsigned char byte = *it++;
+        if (shift == 63 && byte > 1)
+            return false; // bits beyond 64
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+// maps small negative and positive differences to small unsigned values
+inline uint64_t zigzag_encode(uint64_t difference) noexcept
+{
+    return (difference << 1) ^ (0 - (difference >> 63));
+}
+
+inline uint64_t zigzag_decode(uint64_t value) noexcept
+{
+    return (value >> 1) ^ (0 - (value & 1));
+}
+
+inline uint64_t load_le64(const unsigned char *p) noexcept
+{
+    // compiles to a single load on little endian targets
+    uint64_t word = 0;
+    for (unsigned i = 0; i < 8; ++i)
+        word |= static_cast<uint64_t>(p[i]) << (8 * i);
+    return word;
+}
+
+inline unsigned count_trailing_zeros(uint64_t value) noexcept
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_ctzll(value));
+#else
+    unsigned n = 0;
+    while (!(value & 1)) {
+        value >>= 1;
+        ++n;
+    }
+    return n;
+#endif
+}
+
+/*  Decodes count varints into out, eight input bytes at a time while
+    whole words are available. The clear high bits of a word mark the
+    last byte of each value, so words of only one byte or only two byte
+    values are decoded without a loop over the bytes and words of mixed
+    lengths without a branch per byte. Values not ending within the word
+    are left for the next one. Returns false on truncated or overlong
+    input.
+*/
+inline bool get_varints(const unsigned char *&it,
+                        const unsigned char *end,
+                        uint64_t *out,
+                        size_t count) noexcept
+{
+    const uint64_t high_bits = 0x8080808080808080ULL;
+    const uint64_t two_byte_stops = 0x8000800080008000ULL;
+    uint64_t *const out_end = out + count;
+    while (end - it >= 8 && out != out_end) {
+        const uint64_t word = load_le64(it);
+        uint64_t stops = ~word & high_bits;
+        if (stops == high_bits && out_end - out >= 8) {
+            for (unsigned i = 0; i < 8; ++i)
+                out[i] = (word >> (8 * i)) & 0xFF;
+            out += 8;
+            it += 8;
+            continue;
+        }
+        if (stops == two_byte_stops && out_end - out >= 4) {
+            const uint64_t low = word & 0x007F007F007F007FULL;
+            const uint64_t high = (word >> 8) & 0x007F007F007F007FULL;
+            const uint64_t values = low | (high << 7);
+            for (unsigned i = 0; i < 4; ++i)
+                out[i] = (values >> (16 * i)) & 0x3FFF;
+            out += 4;
+            it += 8;
+            continue;
+        }
+        unsigned start = 0;
+        while (stops && out != out_end) {
+            const unsigned stop = count_trailing_zeros(stops) / 8;
+            uint64_t value = 0;
+            for (unsigned i = start; i <= stop; ++i)
+                value |= ((word >> (8 * i)) & 0x7F) << (7 * (i - start));
+            *out++ = value;
+            start = stop + 1;
+            stops &= stops - 1;
+        }
+        if (start == 0)
+            break; // a value longer than eight bytes
+        it += start;
+    }
+    while (out != out_end) {
+        if (!get_varint(it, end, *out++))
+            return false;
+    }
+    return true;
+}
+
+enum : unsigned char
+{
+    compact_delta_sizes = 0x01
+};
+} // namespace detail
+
+/*  Encode a multipart message with compact framing.
+
+    Takes the same ranges as zmq::encode(). Intended for bundles of many
+    small parts, where the one byte size prefix of zmq::encode() for
+    parts below 255 bytes and five bytes above dominate the framing.
+
+    The encoding is a format byte, the number of parts and the sizes of
+    all parts as unsigned LEB128 varints, followed by the data of all
+    parts placed contiguously. Parts below 128 bytes take one size byte,
+    below 16 KiB two. If it is shorter, the sizes are instead coded as
+    zigzag encoded differences to the previous size, which takes one
+    byte for each part of a bundle of similar sizes. Keeping the sizes
+    together lets zmq::decode_compact() decode them a word at a time.
+
+    The encoding is not compatible with zmq::encode().
+
+    Returns: a zmq::message_t holding the encoded multipart data.
+*/
+template<class Range
+#ifndef ZMQ_CPP11_PARTIAL
+         ,
+         typename = typename std::enable_if<
+           detail::is_range<Range>::value
+           && (std::is_same<detail::range_value_t<Range>, message_t>::value
+               || detail::is_buffer<detail::range_value_t<Range>>::value)>::type
+#endif
+         >
+message_t encode_compact(const Range &parts)
+{
+    size_t part_count = 0;
+    size_t data_size = 0;
+    size_t plain_size = 0;
+    size_t delta_size = 0;
+    uint64_t previous = 0;
+
+    // First pass picks the shorter coding of the sizes
+    for (const auto &part : parts) {
+        const uint64_t part_size = part.size();
+        ++part_count;
+        data_size += part_size;
+        plain_size += detail::varint_size(part_size);
+        delta_size +=
+          detail::varint_size(detail::zigzag_encode(part_size - previous));
+        previous = part_size;
+    }
+    const bool delta = delta_size < plain_size;
+
+    message_t encoded(1 + detail::varint_size(part_count)
+                      + (delta ? delta_size : plain_size) + data_size);
+    unsigned char *buf = encoded.data<unsigned char>();
+    *buf++ = delta ? detail::compact_delta_sizes : 0;
+    buf = detail::put_varint(buf, part_count);
+    previous = 0;
+    for (const auto &part : parts) {
+        const uint64_t part_size = part.size();
+        buf = detail::put_varint(
+          buf, delta ? detail::zigzag_encode(part_size - previous) : part_size);
+        previous = part_size;
+    }
+    for (const auto &part : parts) {
+        const size_t part_size = part.size();
+        memcpy(buf, part.data(), part_size);
+        buf += part_size;
+    }
+    return encoded;
+}
+
+/*  Decode a message encoded by zmq::encode_compact() to multiple parts.
+
+    The given output iterator must be a ForwardIterator to a container
+    holding zmq::message_t such as a zmq::multipart_t or various STL
+    containers.
+
+    Returns the ForwardIterator advanced once past the last decoded
+    part.
+
+    Throws: a std::out_of_range is thrown if the encoding is malformed,
+    i.e. the sizes are truncated or do not add up to the message data.
+    Nothing is written to out in that case.
+ */
+template<class OutputIt>
+OutputIt decode_compact(const message_t &encoded, OutputIt out)
+{
+    const unsigned char *source = encoded.data<unsigned char>();
+    const unsigned char *const limit = source + encoded.size();
+
+    if (source == limit)
+        throw std::out_of_range("Malformed encoding, missing format");
+    const unsigned char format = *source++;
+    if (format & ~detail::compact_delta_sizes)
+        throw std::out_of_range("Malformed encoding, unknown format");
+
+    uint64_t part_count;
+    // every size takes at least one byte
+    if (!detail::get_varint(source, limit, part_count)
+        || part_count > static_cast<uint64_t>(limit - source)) {
+        throw std::out_of_range("Malformed encoding, overflow in reading size");
+    }
+    std::vector<uint64_t> sizes(static_cast<size_t>(part_count));
+    if (!detail::get_varints(source, limit, sizes.data(), sizes.size()))
+        throw std::out_of_range("Malformed encoding, overflow in reading size");
+
+    uint64_t remaining = static_cast<uint64_t>(limit - source);
+    uint64_t previous = 0;
+    for (auto &part_size : sizes) {
+        if (format & detail::compact_delta_sizes)
+            part_size = previous + detail::zigzag_decode(part_size);
+        if (part_size > remaining)
+            throw std::out_of_range("Malformed encoding, overflow in reading part");
+        remaining -= part_size;
+        previous = part_size;
+    }
+    if (remaining != 0)
+        throw std::out_of_range("Malformed encoding, extra data");
+
+    for (const auto part_size : sizes) {
+        *out = message_t(source, static_cast<size_t>(part_size));
+        ++out;
+        source += part_size;
+    }
+    return out;
+}
+
 #endif
 
 
@@ -709,6 +998,6500 @@ class active_poller_t
 #endif //  defined(ZMQ_BUILD_DRAFT_API) && defined(ZMQ_CPP11) && defined(ZMQ_HAVE_POLLER)
 
 
+#ifdef ZMQ_CPP11
+
+namespace detail
+{
+// 64 bit unsigned integers are framed big-endian (network byte order)
+inline void put_uint64(unsigned char *buf, uint64_t value) noexcept
+{
+    for (int i = 7; i >= 0; --i) {
+        buf[i] = static_cast<unsigned char>(value & 0xFF);
+        value >>= 8;
+    }
+}
+
+inline uint64_t get_uint64(const unsigned char *buf) noexcept
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i)
+        value = (value << 8) | buf[i];
+    return value;
+}
+
+inline message_t uint64_message(uint64_t value)
+{
+    message_t msg(sizeof(uint64_t));
+    put_uint64(msg.data<unsigned char>(), value);
+    return msg;
+}
+
+inline uint64_t message_uint64(const message_t &msg)
+{
+    if (msg.size() != sizeof(uint64_t))
+        throw std::runtime_error("Invalid size, expected 64 bit integer frame");
+    return get_uint64(msg.data<unsigned char>());
+}
+
+// Identifies one run of a publisher, differs between restarts.
+inline uint64_t random_epoch()
+{
+    std::random_device device;
+    const uint64_t entropy = (static_cast<uint64_t>(device()) << 32) ^ device();
+    return entropy
+           ^ static_cast<uint64_t>(
+             std::chrono::system_clock::now().time_since_epoch().count());
+}
+
+inline message_t sequence_message(uint64_t epoch, uint64_t seq)
+{
+    message_t msg(2 * sizeof(uint64_t));
+    put_uint64(msg.data<unsigned char>(), epoch);
+    put_uint64(msg.data<unsigned char>() + sizeof(uint64_t), seq);
+    return msg;
+}
+
+// Return a message sharing the content of part (zmq_msg_copy, no data copy
+// for messages that are not stored inline).
+inline message_t share_part(const message_t &part)
+{
+    message_t msg;
+    int rc = zmq_msg_copy(msg.handle(), const_cast<zmq_msg_t *>(part.handle()));
+    if (rc != 0)
+        throw error_t();
+    return msg;
+}
+
+inline message_t share_part(const_buffer part)
+{
+    return message_t(part.data(), part.size());
+}
+} // namespace detail
+
+/*  Publisher side of a sequenced PUB/SUB stream.
+
+    Every message is sent as [topic][epoch sequence][payload...], where
+    sequence is a per-topic 8 byte big-endian counter starting at 1 and
+    epoch an 8 byte big-endian random number chosen by the constructor,
+    so that subscribers can tell a restarted publisher from a gap. The
+    payload of the last `capacity` messages (over all topics) is retained,
+    sharing the buffers with the sent messages, so that a seq_subscriber_t
+    that detected a gap can request the missing range over a ROUTER socket
+    served by handle_recovery().
+
+    Recovery request: [topic][first][last][epoch]
+    Recovery reply:   [topic][first][first retained] followed by
+                      [sequence][zmq::encode(payload)] for every
+                      retained message in [first, last]. Nothing is
+                      retained for requests of another epoch.
+*/
+class seq_publisher_t
+{
+  public:
+    explicit seq_publisher_t(socket_ref pub, size_t capacity = 4096) :
+        _pub(pub), _ring(capacity == 0 ? 1 : capacity),
+        _epoch(detail::random_epoch())
+    {
+    }
+
+    seq_publisher_t(const seq_publisher_t &) = delete;
+    seq_publisher_t &operator=(const seq_publisher_t &) = delete;
+
+    /*  Send a sequenced message on topic.
+
+        The range must be a ForwardRange of zmq::message_t,
+        zmq::const_buffer or zmq::mutable_buffer. Messages in the range
+        are not consumed, their content is shared with the retransmit ring.
+
+        Returns: the number of payload parts sent or nullopt (on EAGAIN),
+        in which case no sequence number is consumed.
+    */
+    template<class Range
+#ifndef ZMQ_CPP11_PARTIAL
+             ,
+             typename = typename std::enable_if<
+               detail::is_range<Range>::value
+               && (std::is_same<detail::range_value_t<Range>, message_t>::value
+                   || detail::is_buffer<detail::range_value_t<Range>>::value)>::type
+#endif
+             >
+    send_result_t send(const std::string &topic,
+                       Range &&parts,
+                       send_flags flags = send_flags::none)
+    {
+        flags = flags & ~send_flags::sndmore;
+        if (!_pub.send(buffer(topic), flags | send_flags::sndmore))
+            return {};
+
+        topic_state &state = _topics[topic];
+        const uint64_t seq = state.next_seq++;
+        slot &entry = evict_next();
+        entry.topic = &state;
+        state.slots.push_back(_head);
+        _head = (_head + 1) % _ring.size();
+
+        for (auto &&part : parts)
+            entry.parts.push_back(detail::share_part(part));
+
+        const bool has_parts = !entry.parts.empty();
+        _pub.send(detail::sequence_message(_epoch, seq),
+                  has_parts ? flags | send_flags::sndmore : flags);
+        for (size_t i = 0; i < entry.parts.size(); ++i) {
+            const bool more = i + 1 < entry.parts.size();
+            _pub.send(detail::share_part(entry.parts[i]),
+                      more ? flags | send_flags::sndmore : flags);
+        }
+        return entry.parts.size();
+    }
+
+    // Last sequence number sent on topic, 0 if none.
+    uint64_t sequence(const std::string &topic) const
+    {
+        const auto it = _topics.find(topic);
+        return it == _topics.end() ? 0 : it->second.next_seq - 1;
+    }
+
+    uint64_t epoch() const noexcept { return _epoch; }
+
+    /*  Serve one recovery request received on the ROUTER socket.
+
+        Returns: false if no request was available (on EAGAIN), true otherwise.
+        Malformed requests are discarded without reply.
+    */
+    bool handle_recovery(socket_ref router, recv_flags flags = recv_flags::none)
+    {
+        std::vector<message_t> request;
+        if (!recv_multipart(router, std::back_inserter(request), flags))
+            return false;
+        if (request.size() != 5 || request[2].size() != sizeof(uint64_t)
+            || request[3].size() != sizeof(uint64_t)
+            || request[4].size() != sizeof(uint64_t))
+            return true;
+
+        const uint64_t first = detail::message_uint64(request[2]);
+        const uint64_t last = detail::message_uint64(request[3]);
+        const uint64_t epoch = detail::message_uint64(request[4]);
+
+        std::vector<message_t> reply;
+        reply.push_back(std::move(request[0]));
+        reply.push_back(std::move(request[1]));
+        reply.push_back(detail::uint64_message(first));
+
+        const auto it = _topics.find(reply[1].to_string());
+        if (it == _topics.end() || epoch != _epoch) {
+            reply.push_back(detail::uint64_message(last + 1));
+        } else {
+            const topic_state &state = it->second;
+            const uint64_t retained = state.next_seq - state.slots.size();
+            const uint64_t from = (std::max)(first, retained);
+            const uint64_t to = (std::min)(last, state.next_seq - 1);
+            reply.push_back(detail::uint64_message(from));
+            for (uint64_t seq = from; seq <= to; ++seq) {
+                const slot &entry =
+                  _ring[state.slots[static_cast<size_t>(seq - retained)]];
+                reply.push_back(detail::uint64_message(seq));
+                reply.push_back(encode(entry.parts));
+            }
+        }
+        send_multipart(router, reply);
+        return true;
+    }
+
+  private:
+    struct topic_state
+    {
+        uint64_t next_seq{1};
+        std::deque<size_t> slots; // ring positions of retained messages
+    };
+
+    struct slot
+    {
+        topic_state *topic{nullptr};
+        std::vector<message_t> parts;
+    };
+
+    slot &evict_next()
+    {
+        slot &entry = _ring[_head];
+        if (entry.topic != nullptr) {
+            // ring and per topic order are both FIFO
+            assert(entry.topic->slots.front() == _head);
+            entry.topic->slots.pop_front();
+            entry.topic = nullptr;
+        }
+        entry.parts.clear();
+        return entry;
+    }
+
+    socket_ref _pub;
+    std::vector<slot> _ring;
+    size_t _head{0};
+    std::unordered_map<std::string, topic_state> _topics;
+    uint64_t _epoch;
+};
+
+/*  Subscriber side of a sequenced PUB/SUB stream, see seq_publisher_t.
+
+    Gaps are detected per topic in O(1). A gap is recovered by requesting
+    the missing range over the recovery socket (a DEALER connected to the
+    publisher's ROUTER) and waiting at most recovery_timeout for the reply,
+    before the messages following the gap are delivered. Messages that can
+    not be recovered (evicted from the publisher's ring or timed out) are
+    reported to the loss handler. A message of another publisher epoch
+    restarts the sequence of its topic and is reported to the reset handler.
+    Messages are delivered as [topic][payload...] in sequence order.
+*/
+class seq_subscriber_t
+{
+  public:
+    using loss_handler_type =
+      std::function<void(const std::string &topic, uint64_t first, uint64_t last)>;
+    using reset_handler_type =
+      std::function<void(const std::string &topic, uint64_t sequence)>;
+
+    seq_subscriber_t(socket_ref sub,
+                     socket_ref recovery,
+                     std::chrono::milliseconds recovery_timeout =
+                       std::chrono::milliseconds{1000}) :
+        _sub(sub), _recovery(recovery), _recovery_timeout(recovery_timeout)
+    {
+    }
+
+    seq_subscriber_t(const seq_subscriber_t &) = delete;
+    seq_subscriber_t &operator=(const seq_subscriber_t &) = delete;
+
+    void on_loss(loss_handler_type handler) { _on_loss = std::move(handler); }
+
+    void on_reset(reset_handler_type handler) { _on_reset = std::move(handler); }
+
+    /*  Receive the next message in sequence order as [topic][payload...].
+
+        With recv_flags::dontwait a recovery in progress does not block,
+        nullopt is returned until its reply arrived or it timed out.
+
+        Returns: the number of parts written to msg or nullopt (on EAGAIN).
+        Throws: std::runtime_error if a message without sequence frame
+        is received, or if recv throws.
+    */
+    recv_result_t recv(multipart_t &msg, recv_flags flags = recv_flags::none)
+    {
+        while (_pending.empty()) {
+            if (_recovering) {
+                if (!complete_recovery(flags))
+                    return {};
+                continue;
+            }
+            multipart_t incoming;
+            if (!recv_multipart(_sub, std::back_inserter(incoming), flags))
+                return {};
+            if (incoming.size() < 2 || incoming[1].size() != 2 * sizeof(uint64_t))
+                throw std::runtime_error("Invalid sequenced message");
+
+            message_t topic = incoming.pop();
+            const message_t sequence = incoming.pop();
+            const uint64_t epoch = detail::get_uint64(sequence.data<unsigned char>());
+            const uint64_t seq = detail::get_uint64(sequence.data<unsigned char>()
+                                                    + sizeof(uint64_t));
+            _key.assign(topic.data<char>(), topic.size());
+            incoming.push(std::move(topic));
+
+            const auto it = _expected.find(_key);
+            if (it == _expected.end()) {
+                // late joiner, the stream starts here
+                _expected.emplace(_key, topic_state{epoch, seq + 1});
+            } else if (it->second.epoch != epoch) {
+                // restarted publisher, the stream starts again
+                it->second = topic_state{epoch, seq + 1};
+                ++_resets;
+                if (_on_reset)
+                    _on_reset(_key, seq);
+            } else if (seq < it->second.next) {
+                continue; // duplicate of a recovered message
+            } else if (seq > it->second.next) {
+                const uint64_t first = it->second.next;
+                it->second.next = seq + 1;
+                start_recovery(first, seq - 1, epoch, std::move(incoming));
+                continue;
+            } else {
+                it->second.next = seq + 1;
+            }
+            _pending.push_back(std::move(incoming));
+        }
+        msg = std::move(_pending.front());
+        _pending.pop_front();
+        return msg.size();
+    }
+
+    // Next expected sequence number minus one, 0 if topic was never seen.
+    uint64_t sequence(const std::string &topic) const
+    {
+        const auto it = _expected.find(topic);
+        return it == _expected.end() ? 0 : it->second.next - 1;
+    }
+
+    // Number of messages that could not be recovered.
+    uint64_t lost() const noexcept { return _lost; }
+
+    // Number of sequences restarted by a new publisher epoch.
+    uint64_t resets() const noexcept { return _resets; }
+
+  private:
+    struct topic_state
+    {
+        uint64_t epoch;
+        uint64_t next;
+    };
+
+    void start_recovery(uint64_t first,
+                        uint64_t last,
+                        uint64_t epoch,
+                        multipart_t held)
+    {
+        std::array<message_t, 4> request = {
+          message_t(_key.data(), _key.size()), detail::uint64_message(first),
+          detail::uint64_message(last), detail::uint64_message(epoch)};
+        send_multipart(_recovery, request);
+
+        _recovering = true;
+        _recovery_topic = _key;
+        _recovery_first = first;
+        _recovery_last = last;
+        _recovery_deadline = std::chrono::steady_clock::now() + _recovery_timeout;
+        _held = std::move(held);
+    }
+
+    // Returns false if the reply is outstanding and flags is dontwait.
+    bool complete_recovery(recv_flags flags)
+    {
+        const bool wait = (flags & recv_flags::dontwait) == recv_flags::none;
+        std::vector<message_t> reply;
+        while (true) {
+            const auto remaining =
+              std::chrono::duration_cast<std::chrono::milliseconds>(
+                _recovery_deadline - std::chrono::steady_clock::now());
+            if (remaining.count() <= 0) {
+                reply.clear(); // timed out
+                break;
+            }
+            zmq::pollitem_t items[] = {{_recovery.handle(), 0, ZMQ_POLLIN, 0}};
+            if (poll(items, 1, wait ? static_cast<long>(remaining.count()) : 0)
+                == 0) {
+                if (!wait)
+                    return false;
+                continue;
+            }
+            if (recv_multipart(_recovery, std::back_inserter(reply),
+                               recv_flags::dontwait)
+                && is_reply(reply))
+                break;
+            // stale replies to timed out requests are skipped
+            reply.clear();
+        }
+
+        uint64_t next = _recovery_first;
+        for (size_t i = 3; i + 1 < reply.size(); i += 2) {
+            const uint64_t seq = detail::message_uint64(reply[i]);
+            if (seq < next || seq > _recovery_last)
+                continue;
+            if (seq > next)
+                report_loss(next, seq - 1);
+            multipart_t recovered;
+            recovered.add(
+              message_t(_recovery_topic.data(), _recovery_topic.size()));
+            decode(reply[i + 1], std::back_inserter(recovered));
+            _pending.push_back(std::move(recovered));
+            next = seq + 1;
+        }
+        if (next <= _recovery_last)
+            report_loss(next, _recovery_last);
+        _pending.push_back(std::move(_held));
+        _recovering = false;
+        return true;
+    }
+
+    bool is_reply(const std::vector<message_t> &reply) const
+    {
+        return reply.size() >= 3 && reply[0].to_string() == _recovery_topic
+               && reply[1].size() == sizeof(uint64_t)
+               && detail::message_uint64(reply[1]) == _recovery_first;
+    }
+
+    void report_loss(uint64_t first, uint64_t last)
+    {
+        _lost += last - first + 1;
+        if (_on_loss)
+            _on_loss(_recovery_topic, first, last);
+    }
+
+    socket_ref _sub;
+    socket_ref _recovery;
+    std::chrono::milliseconds _recovery_timeout;
+    loss_handler_type _on_loss;
+    reset_handler_type _on_reset;
+    std::unordered_map<std::string, topic_state> _expected;
+    std::deque<multipart_t> _pending;
+    std::string _key;
+    uint64_t _lost{0};
+    uint64_t _resets{0};
+
+    // the gap being recovered, messages following it wait in _held
+    bool _recovering{false};
+    std::string _recovery_topic;
+    uint64_t _recovery_first{0};
+    uint64_t _recovery_last{0};
+    std::chrono::steady_clock::time_point _recovery_deadline;
+    multipart_t _held;
+};
+
+#endif // ZMQ_CPP11
+
+#ifdef ZMQ_CPP11
+
+// unit in which credit_receiver_t grants credit to a credit_sender_t
+enum class credit_unit
+{
+    bytes,
+    messages
+};
+
+namespace detail
+{
+// command frames of the credit based flow control protocol
+enum class credit_command : unsigned char
+{
+    hello = 1, // sender -> receiver: [hello]
+    data = 2,  // sender -> receiver: [data][chunk]
+    grant = 3  // receiver -> sender: [grant][8 byte cumulative credit limit]
+};
+
+inline message_t credit_command_message(credit_command cmd)
+{
+    const unsigned char c = static_cast<unsigned char>(cmd);
+    return message_t(&c, 1);
+}
+
+inline bool is_credit_command(const message_t &msg, credit_command cmd) noexcept
+{
+    return msg.size() == 1
+           && *msg.data<unsigned char>() == static_cast<unsigned char>(cmd);
+}
+
+inline uint64_t credit_cost(credit_unit unit, size_t size) noexcept
+{
+    return unit == credit_unit::bytes ? size : 1;
+}
+} // namespace detail
+
+/*  Sending side of a credit based flow controlled stream over a DEALER
+    socket connected to a ROUTER socket driven by a credit_receiver_t.
+
+    The receiver grants a window of credit (bytes or messages) and extends
+    it as the application consumes chunks. The sender pipelines chunks of
+    at most chunk_size bytes while credit is available, so that the data in
+    flight never exceeds the receiver's window. Chunks larger than the
+    window are never sent in credit_unit::bytes mode.
+
+    The constructor announces the sender to the receiver, which replies
+    with the initial grant.
+*/
+class credit_sender_t
+{
+  public:
+    explicit credit_sender_t(socket_ref dealer,
+                             size_t chunk_size = 64 * 1024,
+                             credit_unit unit = credit_unit::bytes) :
+        _socket(dealer), _chunk_size(chunk_size == 0 ? 1 : chunk_size), _unit(unit)
+    {
+        _socket.send(detail::credit_command_message(detail::credit_command::hello),
+                     send_flags::none);
+    }
+
+    credit_sender_t(const credit_sender_t &) = delete;
+    credit_sender_t &operator=(const credit_sender_t &) = delete;
+
+    /*  Send as much of buf as the available credit allows,
+        in chunks of at most chunk_size bytes.
+
+        Returns: the number of bytes sent or nullopt if no credit
+        was available (after processing pending grants).
+    */
+    send_result_t send(const_buffer buf)
+    {
+        process_grants(recv_flags::dontwait);
+        const char *data = static_cast<const char *>(buf.data());
+        size_t sent = 0;
+        size_t chunks = 0;
+        do {
+            const size_t size = next_chunk(buf.size() - sent);
+            if (!has_credit(size))
+                break;
+            send_chunk(message_t(data + sent, size));
+            sent += size;
+            ++chunks;
+        } while (sent < buf.size());
+        if (chunks == 0)
+            return {};
+        return sent;
+    }
+
+    /*  Send msg as a single chunk, regardless of chunk_size.
+
+        Returns: the size of msg or nullopt if the available credit
+        does not cover it, in which case msg is left unchanged.
+    */
+    send_result_t send(message_t &msg)
+    {
+        process_grants(recv_flags::dontwait);
+        if (!has_credit(msg.size()))
+            return {};
+        const size_t size = msg.size();
+        send_chunk(std::move(msg));
+        return size;
+    }
+
+    /*  Send all of buf, waiting for grants when the credit is exhausted.
+
+        Returns: the number of bytes sent, less than buf.size()
+        if no credit was granted within timeout between two chunks.
+    */
+    size_t send_all(const_buffer buf,
+                    std::chrono::milliseconds timeout = std::chrono::milliseconds{
+                      -1})
+    {
+        size_t sent = 0;
+        do {
+            const auto ret = send(buf + sent);
+            if (ret)
+                sent += *ret;
+            else if (!wait_credit(timeout))
+                break;
+        } while (sent < buf.size());
+        return sent;
+    }
+
+    /*  Wait up to timeout (-1 waits forever) for credit to become available.
+
+        Returns: true if credit is available.
+    */
+    bool wait_credit(std::chrono::milliseconds timeout)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        process_grants(recv_flags::dontwait);
+        while (available() == 0) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+              deadline - std::chrono::steady_clock::now());
+            if (timeout.count() < 0)
+                remaining = timeout;
+            else if (remaining.count() <= 0)
+                return false;
+            zmq::pollitem_t items[] = {{_socket.handle(), 0, ZMQ_POLLIN, 0}};
+            if (poll(items, 1, remaining) == 0)
+                return false;
+            process_grants(recv_flags::dontwait);
+        }
+        return true;
+    }
+
+    // Credit left in the current window.
+    uint64_t available() const noexcept
+    {
+        return _limit > _used ? _limit - _used : 0;
+    }
+
+    size_t chunk_size() const noexcept { return _chunk_size; }
+
+  private:
+    size_t next_chunk(size_t remaining) const noexcept
+    {
+        size_t size = (std::min)(remaining, _chunk_size);
+        if (_unit == credit_unit::bytes && size > available())
+            size = static_cast<size_t>(available());
+        return size;
+    }
+
+    bool has_credit(size_t size) const noexcept
+    {
+        return available() > 0 && detail::credit_cost(_unit, size) <= available();
+    }
+
+    void send_chunk(message_t &&chunk)
+    {
+        _used += detail::credit_cost(_unit, chunk.size());
+        _socket.send(detail::credit_command_message(detail::credit_command::data),
+                     send_flags::sndmore);
+        _socket.send(chunk, send_flags::none);
+    }
+
+    // Returns true if at least one grant was processed.
+    bool process_grants(recv_flags flags)
+    {
+        bool granted = false;
+        std::vector<message_t> msgs;
+        while (recv_multipart(_socket, std::back_inserter(msgs), flags)) {
+            if (msgs.size() == 2
+                && detail::is_credit_command(msgs[0],
+                                             detail::credit_command::grant)) {
+                // grants are cumulative, reordering can not inflate the window
+                _limit = (std::max)(_limit, detail::message_uint64(msgs[1]));
+                granted = true;
+            }
+            msgs.clear();
+        }
+        return granted;
+    }
+
+    socket_ref _socket;
+    size_t _chunk_size;
+    credit_unit _unit;
+    uint64_t _used{0};
+    uint64_t _limit{0};
+};
+
+/*  Receiving side of a credit based flow controlled stream, serving any
+    number of credit_sender_t peers on a ROUTER socket.
+
+    Each peer is granted `window` credit when it announces itself. Credit
+    is returned to the peer as chunks are handed to the application by
+    recv(), batched so that a grant is sent once at least half of the
+    window was consumed. The memory queued for a peer is thereby bounded
+    by the window.
+*/
+class credit_receiver_t
+{
+  public:
+    explicit credit_receiver_t(socket_ref router,
+                               uint64_t window = 1024 * 1024,
+                               credit_unit unit = credit_unit::bytes) :
+        _socket(router), _window(window == 0 ? 1 : window), _unit(unit)
+    {
+    }
+
+    credit_receiver_t(const credit_receiver_t &) = delete;
+    credit_receiver_t &operator=(const credit_receiver_t &) = delete;
+
+    /*  Receive the next chunk from any peer.
+
+        The routing id of the sending peer is written to peer.
+        Returns: the size of the chunk or nullopt (on EAGAIN).
+    */
+    recv_result_t
+    recv(message_t &peer, message_t &chunk, recv_flags flags = recv_flags::none)
+    {
+        std::vector<message_t> msgs;
+        while (true) {
+            msgs.clear();
+            if (!recv_multipart(_socket, std::back_inserter(msgs), flags))
+                return {};
+            if (msgs.size() < 2)
+                continue;
+            _key.assign(msgs[0].data<char>(), msgs[0].size());
+            if (msgs.size() == 2
+                && detail::is_credit_command(msgs[1],
+                                             detail::credit_command::hello)) {
+                peer_state &state = _peers[_key];
+                state = peer_state{};
+                state.granted = _window;
+                grant(msgs[0], state.granted);
+                continue;
+            }
+            if (msgs.size() != 3
+                || !detail::is_credit_command(msgs[1], detail::credit_command::data))
+                continue;
+
+            peer_state &state = _peers[_key];
+            state.consumed += detail::credit_cost(_unit, msgs[2].size());
+            // outstanding credit dropped to half the window
+            if (state.consumed + _window - state.granted >= _window / 2) {
+                state.granted = state.consumed + _window;
+                grant(msgs[0], state.granted);
+            }
+            peer = std::move(msgs[0]);
+            chunk = std::move(msgs[2]);
+            return chunk.size();
+        }
+    }
+
+    // Forget the state of a peer, e.g. after its stream completed.
+    void remove(const message_t &peer)
+    {
+        _peers.erase(std::string(peer.data<char>(), peer.size()));
+    }
+
+    size_t size() const noexcept { return _peers.size(); }
+
+    uint64_t window() const noexcept { return _window; }
+
+  private:
+    struct peer_state
+    {
+        uint64_t consumed{0};
+        uint64_t granted{0};
+    };
+
+    void grant(const message_t &peer, uint64_t limit)
+    {
+        std::array<message_t, 3> msgs = {
+          detail::share_part(peer),
+          detail::credit_command_message(detail::credit_command::grant),
+          detail::uint64_message(limit)};
+        send_multipart(_socket, msgs);
+    }
+
+    socket_ref _socket;
+    uint64_t _window;
+    credit_unit _unit;
+    std::unordered_map<std::string, peer_state> _peers;
+    std::string _key;
+};
+
+#endif // ZMQ_CPP11
+
+#ifdef ZMQ_CPP11
+
+/*  Hashed timer wheel with O(1) scheduling.
+
+    Keys are scheduled to expire after a timeout, rounded up to the wheel
+    resolution. Timers can not be cancelled; owners drop expirations they
+    are no longer interested in (lazy cancellation), which keeps both
+    scheduling and cancelling O(1). Expirations further away than one
+    revolution stay in their slot until due.
+*/
+class timer_wheel_t
+{
+  public:
+    using clock = std::chrono::steady_clock;
+
+    explicit timer_wheel_t(
+      std::chrono::milliseconds resolution = std::chrono::milliseconds{1},
+      size_t slots = 512) :
+        _resolution(resolution.count() <= 0 ? std::chrono::milliseconds{1}
+                                             : resolution),
+        _slots(slots == 0 ? 1 : slots),
+        _start(clock::now())
+    {
+    }
+
+    // Schedule key to expire timeout after now.
+    void schedule(uint64_t key,
+                  std::chrono::milliseconds timeout,
+                  clock::time_point now = clock::now())
+    {
+        const auto due =
+          std::chrono::duration_cast<std::chrono::milliseconds>(now - _start)
+          + (std::max)(timeout, std::chrono::milliseconds{0});
+        // round up, a timer never expires early
+        uint64_t tick = static_cast<uint64_t>(
+          (due + _resolution - std::chrono::milliseconds{1}) / _resolution);
+        if (tick <= _tick)
+            tick = _tick + 1;
+        _slots[tick % _slots.size()].push_back(entry{key, tick});
+        ++_size;
+    }
+
+    /*  Advance the wheel to now, calling fn(key) for every expired key.
+
+        Returns: the number of expired keys.
+    */
+    template<class Fn> size_t advance(Fn &&fn, clock::time_point now = clock::now())
+    {
+        const uint64_t target = tick_at(now);
+        if (target <= _tick)
+            return 0;
+        const uint64_t steps =
+          (std::min)(target - _tick, static_cast<uint64_t>(_slots.size()));
+        _expired.clear();
+        for (uint64_t i = 1; i <= steps; ++i) {
+            auto &slot = _slots[(_tick + i) % _slots.size()];
+            for (size_t j = 0; j < slot.size();) {
+                if (slot[j].tick <= target) {
+                    _expired.push_back(slot[j].key);
+                    slot[j] = slot.back();
+                    slot.pop_back();
+                } else {
+                    ++j;
+                }
+            }
+        }
+        _tick = target;
+        _size -= _expired.size();
+        // fn may schedule again, _expired is not touched by schedule
+        for (size_t i = 0; i < _expired.size(); ++i)
+            fn(_expired[i]);
+        return _expired.size();
+    }
+
+    /*  Time until the next scheduled expiration, -1 if none is scheduled.
+        Suitable as poll timeout.
+    */
+    std::chrono::milliseconds
+    next_timeout(clock::time_point now = clock::now()) const
+    {
+        if (_size == 0)
+            return std::chrono::milliseconds{-1};
+        // the first slot holding a timer of the current revolution is due
+        // next, otherwise the earliest timer of a later revolution
+        uint64_t next = 0;
+        for (size_t i = 1; i <= _slots.size(); ++i) {
+            const uint64_t tick = _tick + i;
+            for (const auto &e : _slots[tick % _slots.size()]) {
+                if (next == 0 || e.tick < next)
+                    next = e.tick;
+            }
+            if (next == tick)
+                break;
+        }
+        const auto due =
+          _start
+          + std::chrono::milliseconds(
+            static_cast<std::chrono::milliseconds::rep>(next) * _resolution.count());
+        if (due <= now)
+            return std::chrono::milliseconds{0};
+        return std::chrono::duration_cast<std::chrono::milliseconds>(due - now)
+               + std::chrono::milliseconds{1};
+    }
+
+    size_t size() const noexcept { return _size; }
+
+    ZMQ_NODISCARD bool empty() const noexcept { return _size == 0; }
+
+    std::chrono::milliseconds resolution() const noexcept { return _resolution; }
+
+  private:
+    struct entry
+    {
+        uint64_t key;
+        uint64_t tick;
+    };
+
+    uint64_t tick_at(clock::time_point tp) const
+    {
+        const auto elapsed =
+          std::chrono::duration_cast<std::chrono::milliseconds>(tp - _start);
+        return elapsed.count() <= 0
+                 ? 0
+                 : static_cast<uint64_t>(elapsed.count() / _resolution.count());
+    }
+
+    std::chrono::milliseconds _resolution;
+    std::vector<std::vector<entry>> _slots;
+    clock::time_point _start;
+    uint64_t _tick{0};
+    size_t _size{0};
+    std::vector<uint64_t> _expired;
+};
+
+// completion status of a request made through async_client_t
+enum class request_status
+{
+    ok,
+    timeout
+};
+
+class request_timeout_error : public std::runtime_error
+{
+  public:
+    request_timeout_error() : std::runtime_error("Request timed out") {}
+};
+
+/*  Pipelined request/reply client over a DEALER socket.
+
+    Any number of requests may be outstanding. Each request is sent as
+    [correlation id][empty delimiter][payload...], the envelope used by
+    REQ sockets with req_correlate, so it can be served by REP sockets
+    and by ROUTER servers echoing the envelope. Replies may arrive in any
+    order and complete the matching request's handler or future.
+    Per-request timeouts are tracked by a timer_wheel_t; late replies to
+    timed out requests are discarded.
+
+    Completions only happen inside process(), on the calling thread.
+*/
+class async_client_t
+{
+  public:
+    using handler_type = std::function<void(request_status, multipart_t &&)>;
+
+    explicit async_client_t(
+      socket_ref dealer,
+      std::chrono::milliseconds resolution = std::chrono::milliseconds{1}) :
+        _socket(dealer), _timers(resolution)
+    {
+    }
+
+    async_client_t(const async_client_t &) = delete;
+    async_client_t &operator=(const async_client_t &) = delete;
+
+    /*  Send a request, handler is called with the reply or on timeout.
+
+        The range must be a ForwardRange of zmq::message_t,
+        zmq::const_buffer or zmq::mutable_buffer (message_t parts are
+        shared, not consumed).
+        Returns: the correlation id of the request.
+    */
+    template<class Range
+#ifndef ZMQ_CPP11_PARTIAL
+             ,
+             typename = typename std::enable_if<
+               detail::is_range<Range>::value
+               && (std::is_same<detail::range_value_t<Range>, message_t>::value
+                   || detail::is_buffer<detail::range_value_t<Range>>::value)>::type
+#endif
+             >
+    uint64_t
+    send(Range &&parts, std::chrono::milliseconds timeout, handler_type handler)
+    {
+        const uint64_t id = ++_last_id;
+        _socket.send(detail::uint64_message(id), send_flags::sndmore);
+        _socket.send(message_t(), send_flags::sndmore);
+        auto it = detail::ranges::begin(parts);
+        const auto end = detail::ranges::end(parts);
+        if (it == end)
+            _socket.send(message_t(), send_flags::none);
+        while (it != end) {
+            const auto next = std::next(it);
+            _socket.send(detail::share_part(*it),
+                         next == end ? send_flags::none : send_flags::sndmore);
+            it = next;
+        }
+        _pending.emplace(id, std::move(handler));
+        _timers.schedule(id, timeout);
+        return id;
+    }
+
+    /*  Send a request and return a future for the reply.
+
+        The future throws request_timeout_error if no reply arrived in time.
+    */
+    template<class Range
+#ifndef ZMQ_CPP11_PARTIAL
+             ,
+             typename = typename std::enable_if<
+               detail::is_range<Range>::value
+               && (std::is_same<detail::range_value_t<Range>, message_t>::value
+                   || detail::is_buffer<detail::range_value_t<Range>>::value)>::type
+#endif
+             >
+    std::future<multipart_t> send(Range &&parts, std::chrono::milliseconds timeout)
+    {
+        auto promise = std::make_shared<std::promise<multipart_t>>();
+        auto future = promise->get_future();
+        send(std::forward<Range>(parts), timeout,
+             [promise](request_status status, multipart_t &&reply) {
+                 if (status == request_status::ok)
+                     promise->set_value(std::move(reply));
+                 else
+                     promise->set_exception(
+                       std::make_exception_ptr(request_timeout_error()));
+             });
+        return future;
+    }
+
+    /*  Complete requests with the replies received and expire timed out
+        requests. Waits at most timeout for a reply if nothing completed.
+
+        Returns: the number of completed requests (replied or timed out).
+    */
+    size_t process(std::chrono::milliseconds timeout = std::chrono::milliseconds{0})
+    {
+        size_t completed = drain() + expire();
+        if (completed > 0 || timeout.count() == 0 || _pending.empty())
+            return completed;
+
+        const auto next = _timers.next_timeout();
+        if (timeout.count() < 0 || (next.count() >= 0 && next < timeout))
+            timeout = next;
+        zmq::pollitem_t items[] = {{_socket.handle(), 0, ZMQ_POLLIN, 0}};
+        poll(items, 1, timeout);
+        return drain() + expire();
+    }
+
+    // Number of outstanding requests.
+    size_t pending() const noexcept { return _pending.size(); }
+
+  private:
+    size_t drain()
+    {
+        size_t completed = 0;
+        multipart_t reply;
+        while (recv_multipart(_socket, std::back_inserter(reply),
+                              recv_flags::dontwait)) {
+            if (reply.size() >= 2 && reply[0].size() == sizeof(uint64_t)
+                && reply[1].size() == 0) {
+                const auto it = _pending.find(detail::message_uint64(reply[0]));
+                if (it != _pending.end()) {
+                    handler_type handler = std::move(it->second);
+                    _pending.erase(it);
+                    reply.pop();
+                    reply.pop();
+                    ++completed;
+                    if (handler)
+                        handler(request_status::ok, std::move(reply));
+                }
+            }
+            reply.clear();
+        }
+        return completed;
+    }
+
+    size_t expire()
+    {
+        size_t expired = 0;
+        _timers.advance([this, &expired](uint64_t id) {
+            const auto it = _pending.find(id);
+            if (it == _pending.end())
+                return; // already replied
+            handler_type handler = std::move(it->second);
+            _pending.erase(it);
+            ++expired;
+            if (handler)
+                handler(request_status::timeout, multipart_t());
+        });
+        return expired;
+    }
+
+    socket_ref _socket;
+    timer_wheel_t _timers;
+    uint64_t _last_id{0};
+    std::unordered_map<uint64_t, handler_type> _pending;
+};
+
+#endif // ZMQ_CPP11
+
+#ifdef ZMQ_CPP11
+
+namespace detail
+{
+// FNV-1a, used to hash routing ids
+inline uint64_t fnv1a(const void *data, size_t size) noexcept
+{
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+} // namespace detail
+
+/*  Server helper for ROUTER sockets keeping per-peer state in a flat table.
+
+    Routing ids are interned into dense integer handles through an open
+    addressing index, so receiving from a known peer costs one hash of the
+    routing id and no allocation. The state of a peer is stored by value
+    in a contiguous table indexed by its handle. Replies reuse the interned
+    routing id message through zmq_msg_copy instead of rebuilding the
+    envelope.
+
+    Handles of removed peers are reused for new peers.
+*/
+template<class State> class router_server_t
+{
+  public:
+    using handle_type = uint32_t;
+
+    explicit router_server_t(socket_ref router, size_t expected_peers = 64) :
+        _socket(router)
+    {
+        size_t capacity = 16;
+        while (capacity < expected_peers * 2)
+            capacity *= 2;
+        _index.assign(capacity, 0);
+        _ids.reserve(expected_peers);
+        _hashes.reserve(expected_peers);
+        _states.reserve(expected_peers);
+    }
+
+    router_server_t(const router_server_t &) = delete;
+    router_server_t &operator=(const router_server_t &) = delete;
+
+    /*  Receive a message from any peer.
+
+        The handle of the sending peer is written to peer, the message
+        parts following the routing id are written to OutputIterator out.
+        Returns: the number of parts written or nullopt (on EAGAIN).
+    */
+    template<class OutputIt>
+    recv_result_t
+    recv(handle_type &peer, OutputIt out, recv_flags flags = recv_flags::none)
+    {
+        message_t id;
+        if (!_socket.recv(id, flags))
+            return {};
+        if (!id.more())
+            throw std::runtime_error("Invalid message, expected routing id frame");
+        peer = intern(std::move(id));
+
+        size_t count = 0;
+        bool more = true;
+        while (more) {
+            message_t msg;
+            // zmq ensures atomic delivery of messages
+            const auto ret = _socket.recv(msg, recv_flags::none);
+            assert(ret);
+            (void) ret;
+            more = msg.more();
+            *out++ = std::move(msg);
+            ++count;
+        }
+        return count;
+    }
+
+    /*  Send a message to peer.
+
+        The range must be a ForwardRange of zmq::message_t,
+        zmq::const_buffer or zmq::mutable_buffer, message_t parts are
+        sent without copying and left empty.
+        Returns: the number of parts sent or nullopt (on EAGAIN).
+        Throws: std::invalid_argument if parts is empty, a message
+        consisting of the routing id only can not be sent.
+    */
+    template<class Range
+#ifndef ZMQ_CPP11_PARTIAL
+             ,
+             typename = typename std::enable_if<
+               detail::is_range<Range>::value
+               && (std::is_same<detail::range_value_t<Range>, message_t>::value
+                   || detail::is_buffer<detail::range_value_t<Range>>::value)>::type
+#endif
+             >
+    send_result_t
+    send(handle_type peer, Range &&parts, send_flags flags = send_flags::none)
+    {
+        assert(contains(peer));
+        auto it = detail::ranges::begin(parts);
+        const auto end = detail::ranges::end(parts);
+        if (it == end)
+            throw std::invalid_argument("Empty message, expected message parts");
+        flags = flags & ~send_flags::sndmore;
+        if (!_socket.send(detail::share_part(_ids[peer]),
+                          flags | send_flags::sndmore))
+            return {};
+        size_t count = 0;
+        while (it != end) {
+            const auto next = std::next(it);
+            _socket.send(*it, next == end ? flags : flags | send_flags::sndmore);
+            ++count;
+            it = next;
+        }
+        return count;
+    }
+
+    // State of peer, value initialized when the peer is first seen.
+    State &state(handle_type peer)
+    {
+        assert(contains(peer));
+        return _states[peer];
+    }
+
+    const State &state(handle_type peer) const
+    {
+        assert(contains(peer));
+        return _states[peer];
+    }
+
+    // The interned routing id of peer.
+    const message_t &routing_id(handle_type peer) const
+    {
+        assert(contains(peer));
+        return _ids[peer];
+    }
+
+    // Look up the handle of a routing id, returns false if unknown.
+    bool find(const_buffer routing_id, handle_type &peer) const
+    {
+        const size_t pos =
+          lookup(routing_id, detail::fnv1a(routing_id.data(), routing_id.size()));
+        if (_index[pos] == 0)
+            return false;
+        peer = _index[pos] - 1;
+        return true;
+    }
+
+    bool contains(handle_type peer) const noexcept
+    {
+        // routing ids are never empty, an empty id marks a free handle
+        return peer < _ids.size() && !_ids[peer].empty();
+    }
+
+    // Forget a peer, its handle may be reused by a new peer.
+    void remove(handle_type peer)
+    {
+        if (!contains(peer))
+            return;
+        erase_index(lookup(_ids[peer], _hashes[peer]));
+        _ids[peer].rebuild();
+        _states[peer] = State();
+        _free.push_back(peer);
+        --_size;
+    }
+
+    size_t size() const noexcept { return _size; }
+
+    ZMQ_NODISCARD bool empty() const noexcept { return _size == 0; }
+
+  private:
+    handle_type intern(message_t &&id)
+    {
+        const uint64_t hash = detail::fnv1a(id.data(), id.size());
+        const size_t pos = lookup(buffer(id.data(), id.size()), hash);
+        if (_index[pos] != 0)
+            return _index[pos] - 1;
+
+        handle_type peer;
+        if (_free.empty()) {
+            peer = static_cast<handle_type>(_ids.size());
+            _ids.push_back(std::move(id));
+            _hashes.push_back(hash);
+            _states.emplace_back();
+        } else {
+            peer = _free.back();
+            _free.pop_back();
+            _ids[peer] = std::move(id);
+            _hashes[peer] = hash;
+        }
+        _index[pos] = peer + 1;
+        if (++_size * 2 > _index.size())
+            rehash(_index.size() * 2);
+        return peer;
+    }
+
+    // Position of routing_id in the index, or of the empty slot to insert it.
+    size_t lookup(const_buffer routing_id, uint64_t hash) const
+    {
+        const size_t mask = _index.size() - 1;
+        size_t pos = static_cast<size_t>(hash) & mask;
+        while (_index[pos] != 0) {
+            const handle_type peer = _index[pos] - 1;
+            if (_hashes[peer] == hash && _ids[peer].size() == routing_id.size()
+                && memcmp(_ids[peer].data(), routing_id.data(), routing_id.size())
+                     == 0)
+                return pos;
+            pos = (pos + 1) & mask;
+        }
+        return pos;
+    }
+
+    size_t lookup(const message_t &routing_id, uint64_t hash) const
+    {
+        return lookup(buffer(routing_id.data(), routing_id.size()), hash);
+    }
+
+    // linear probing deletion by backward shifting
+    void erase_index(size_t pos)
+    {
+        const size_t mask = _index.size() - 1;
+        _index[pos] = 0;
+        size_t next = pos;
+        while (true) {
+            next = (next + 1) & mask;
+            if (_index[next] == 0)
+                return;
+            const size_t ideal =
+              static_cast<size_t>(_hashes[_index[next] - 1]) & mask;
+            const bool movable = pos <= next ? (ideal <= pos || ideal > next)
+                                             : (ideal <= pos && ideal > next);
+            if (movable) {
+                _index[pos] = _index[next];
+                _index[next] = 0;
+                pos = next;
+            }
+        }
+    }
+
+    void rehash(size_t capacity)
+    {
+        _index.assign(capacity, 0);
+        const size_t mask = capacity - 1;
+        for (handle_type peer = 0; peer < _ids.size(); ++peer) {
+            if (!contains(peer))
+                continue;
+            size_t pos = static_cast<size_t>(_hashes[peer]) & mask;
+            while (_index[pos] != 0)
+                pos = (pos + 1) & mask;
+            _index[pos] = peer + 1;
+        }
+    }
+
+    socket_ref _socket;
+    std::vector<handle_type> _index; // handle + 1, 0 marks an empty slot
+    std::vector<message_t> _ids;
+    std::vector<uint64_t> _hashes;
+    std::vector<State> _states;
+    std::vector<handle_type> _free;
+    size_t _size{0};
+};
+
+#endif // ZMQ_CPP11
+
+#ifdef ZMQ_CPP11
+
+/*  Application level heartbeating and dead peer detection for ROUTER sockets.
+
+    Every message received from a peer counts as a sign of life and every
+    message sent to a peer counts as a heartbeat, heartbeats are only sent
+    to peers without other traffic for one interval (piggybacking). A peer
+    is considered dead if nothing was received from it for liveness
+    intervals, as in the Paranoid Pirate pattern; it is then forgotten and
+    the expiry handler is called with its routing id.
+
+    A heartbeat is a message consisting of the single byte frame "\x02".
+    Peers are registered by the first message received from them.
+
+    Each peer owns exactly one timer in a timer_wheel_t, traffic only
+    updates timestamps and the deadline is re-evaluated when the timer
+    fires, so neither traffic nor process() scans the peers.
+*/
+class heartbeat_manager_t
+{
+  public:
+    using clock = timer_wheel_t::clock;
+    using expiry_handler = std::function<void(const message_t &)>;
+
+    explicit heartbeat_manager_t(
+      socket_ref router,
+      std::chrono::milliseconds interval = std::chrono::milliseconds{1000},
+      unsigned liveness = 3,
+      std::chrono::milliseconds resolution = std::chrono::milliseconds{1}) :
+        _socket(router),
+        _interval(interval),
+        _timeout(interval * (liveness == 0 ? 1 : liveness)),
+        _timers(resolution)
+    {
+    }
+
+    heartbeat_manager_t(const heartbeat_manager_t &) = delete;
+    heartbeat_manager_t &operator=(const heartbeat_manager_t &) = delete;
+
+    void on_expired(expiry_handler handler) { _handler = std::move(handler); }
+
+    /*  Record a message received from the peer routing_id, body is the
+        first frame after the routing id.
+
+        Returns: true if the message is a heartbeat, which the application
+        should drop.
+    */
+    bool received(const message_t &routing_id,
+                  const message_t &body,
+                  clock::time_point now = clock::now())
+    {
+        peer_state &peer = _peers[intern(routing_id, now)];
+        peer.last_recv = now;
+        return is_heartbeat(body);
+    }
+
+    // Record a message sent to the peer routing_id, postponing its heartbeat.
+    void sent(const message_t &routing_id, clock::time_point now = clock::now())
+    {
+        const auto it = find(routing_id);
+        if (it != _index.end())
+            _peers[it->second].last_send = now;
+    }
+
+    /*  Send due heartbeats and expire dead peers.
+
+        Returns: the number of expired peers.
+    */
+    size_t process(clock::time_point now = clock::now())
+    {
+        size_t expired = 0;
+        _timers.advance(
+          [this, now, &expired](uint64_t key) {
+              const uint32_t slot = static_cast<uint32_t>(key);
+              // the peer was removed since the timer was scheduled
+              if (slot >= _peers.size() || _peers[slot].key != key)
+                  return;
+              if (check(slot, now))
+                  ++expired;
+          },
+          now);
+        return expired;
+    }
+
+    // Forget a peer without calling the expiry handler.
+    void remove(const message_t &routing_id)
+    {
+        const auto it = find(routing_id);
+        if (it == _index.end())
+            return;
+        release(it->second);
+        _index.erase(it);
+    }
+
+    bool contains(const message_t &routing_id) const
+    {
+        _key.assign(routing_id.data<char>(), routing_id.size());
+        return _index.count(_key) != 0;
+    }
+
+    // Time until the next heartbeat or expiry is due, suitable as poll timeout.
+    std::chrono::milliseconds
+    next_timeout(clock::time_point now = clock::now()) const
+    {
+        return _timers.next_timeout(now);
+    }
+
+    size_t size() const noexcept { return _index.size(); }
+
+    std::chrono::milliseconds interval() const noexcept { return _interval; }
+
+    std::chrono::milliseconds timeout() const noexcept { return _timeout; }
+
+    static bool is_heartbeat(const message_t &body) noexcept
+    {
+        return body.size() == 1 && *body.data<char>() == '\x02';
+    }
+
+  private:
+    struct peer_state
+    {
+        message_t routing_id;
+        clock::time_point last_recv;
+        clock::time_point last_send;
+        // generation << 32 | slot, identifies the live timer of the slot
+        uint64_t key;
+    };
+
+    std::unordered_map<std::string, uint32_t>::iterator
+    find(const message_t &routing_id)
+    {
+        _key.assign(routing_id.data<char>(), routing_id.size());
+        return _index.find(_key);
+    }
+
+    uint32_t intern(const message_t &routing_id, clock::time_point now)
+    {
+        const auto it = find(routing_id);
+        if (it != _index.end())
+            return it->second;
+
+        uint32_t slot;
+        if (_free.empty()) {
+            slot = static_cast<uint32_t>(_peers.size());
+            _peers.emplace_back();
+            _peers[slot].key = slot;
+        } else {
+            slot = _free.back();
+            _free.pop_back();
+        }
+        peer_state &peer = _peers[slot];
+        peer.routing_id = detail::share_part(routing_id);
+        peer.last_send = now;
+        _index.emplace(_key, slot);
+        _timers.schedule(peer.key, (std::min)(_interval, _timeout), now);
+        return slot;
+    }
+
+    // Returns true if the peer in slot expired.
+    bool check(uint32_t slot, clock::time_point now)
+    {
+        peer_state &peer = _peers[slot];
+        const auto dead_at = peer.last_recv + _timeout;
+        if (dead_at <= now) {
+            message_t routing_id = std::move(peer.routing_id);
+            _index.erase(std::string(routing_id.data<char>(), routing_id.size()));
+            release(slot);
+            if (_handler)
+                _handler(routing_id);
+            return true;
+        }
+        if (peer.last_send + _interval <= now) {
+            std::array<message_t, 2> msgs = {detail::share_part(peer.routing_id),
+                                             message_t("\x02", 1)};
+            // a full or unroutable peer misses the heartbeat, its liveness
+            // is decided by the traffic received from it
+            try {
+                send_multipart(_socket, msgs, send_flags::dontwait);
+            }
+            catch (const error_t &e) {
+                if (e.num() != EHOSTUNREACH)
+                    throw;
+            }
+            peer.last_send = now;
+        }
+        const auto due = (std::min)(dead_at, peer.last_send + _interval);
+        _timers.schedule(
+          peer.key, std::chrono::duration_cast<std::chrono::milliseconds>(due - now),
+          now);
+        return false;
+    }
+
+    void release(uint32_t slot)
+    {
+        peer_state &peer = _peers[slot];
+        // invalidate the pending timer of the slot
+        peer.key += uint64_t(1) << 32;
+        peer.routing_id.rebuild();
+        _free.push_back(slot);
+    }
+
+    socket_ref _socket;
+    std::chrono::milliseconds _interval;
+    std::chrono::milliseconds _timeout;
+    timer_wheel_t _timers;
+    expiry_handler _handler;
+    std::vector<peer_state> _peers;
+    std::vector<uint32_t> _free;
+    std::unordered_map<std::string, uint32_t> _index;
+    mutable std::string _key;
+};
+
+#endif // ZMQ_CPP11
+
+#if defined(ZMQ_BUILD_DRAFT_API) && defined(ZMQ_CPP11) && defined(ZMQ_HAVE_POLLER) \
+  && defined(ZMQ_NEW_MONITOR_EVENT_LAYOUT)
+
+/*  Connection counters maintained by monitor_hub_t.
+
+    Updated by the thread driving the hub, readable from any thread.
+*/
+struct monitor_counters
+{
+    std::atomic<uint64_t> events{0};
+    std::atomic<int64_t> connections{0}; // connected + accepted - disconnected
+    std::atomic<uint64_t> connected{0};
+    std::atomic<uint64_t> accepted{0};
+    std::atomic<uint64_t> disconnected{0};
+    std::atomic<uint64_t> connect_retried{0};
+    std::atomic<uint64_t> accept_failed{0};
+    std::atomic<uint64_t> bind_failed{0};
+    std::atomic<uint64_t> handshake_failed{0};
+    // windows in which connect_retried exceeded the storm threshold
+    std::atomic<uint64_t> reconnect_storms{0};
+};
+
+/*  Monitors any number of sockets from a single thread.
+
+    The monitor PAIR sockets of all registered sockets are waited on by
+    one poller_t, pending events are drained as they arrive, counted into
+    per-socket and total monitor_counters and passed to the event handler
+    tagged with the source returned by add().
+
+    add(), remove() and process() must be called from the same thread,
+    the counters may be read from any thread.
+*/
+class monitor_hub_t
+{
+  public:
+    using handler_type = std::function<void(size_t, const monitor_event &)>;
+
+    explicit monitor_hub_t(
+      context_t &context,
+      uint64_t storm_threshold = 10,
+      std::chrono::milliseconds storm_window = std::chrono::milliseconds{1000}) :
+        _context(context),
+        _storm_threshold(storm_threshold == 0 ? 1 : storm_threshold),
+        _storm_window(storm_window)
+    {
+    }
+
+    monitor_hub_t(const monitor_hub_t &) = delete;
+    monitor_hub_t &operator=(const monitor_hub_t &) = delete;
+
+    ~monitor_hub_t()
+    {
+        for (auto &src : _sources) {
+            if (src->monitor)
+                zmq_socket_monitor(src->socket.handle(), ZMQ_NULLPTR, 0);
+        }
+    }
+
+    void on_event(handler_type handler) { _handler = std::move(handler); }
+
+    /*  Start monitoring socket for events (ZMQ_EVENT_* bit mask).
+
+        Returns: the source tag of the socket's events and counters.
+    */
+    size_t add(socket_ref socket, int events = ZMQ_EVENT_ALL)
+    {
+        const size_t tag = _sources.size();
+        std::ostringstream endpoint;
+        endpoint << "inproc://zmq-monitor-hub-" << static_cast<const void *>(this)
+                 << "-" << tag;
+        std::unique_ptr<source> src(new source(tag, socket));
+        if (zmq_socket_monitor(socket.handle(), endpoint.str().c_str(), events)
+            != 0)
+            throw error_t();
+        try {
+            src->monitor = socket_t(_context, socket_type::pair);
+            src->monitor.connect(endpoint.str());
+            _poller.add(src->monitor, event_flags::pollin, src.get());
+        }
+        catch (...) {
+            zmq_socket_monitor(socket.handle(), ZMQ_NULLPTR, 0);
+            throw;
+        }
+        _sources.push_back(std::move(src));
+        ++_active;
+        return tag;
+    }
+
+    // Stop monitoring the socket of source, its counters remain readable.
+    void remove(size_t tag)
+    {
+        source &src = *_sources.at(tag);
+        if (!src.monitor)
+            return;
+        _poller.remove(src.monitor);
+        zmq_socket_monitor(src.socket.handle(), ZMQ_NULLPTR, 0);
+        src.monitor.close();
+        --_active;
+    }
+
+    /*  Wait up to timeout for events and process all pending events.
+
+        Returns: the number of events processed, 0 if no socket is monitored.
+    */
+    size_t process(std::chrono::milliseconds timeout)
+    {
+        if (_active == 0)
+            return 0;
+        _ready.resize(_active);
+        const size_t ready = _poller.wait_all(_ready, timeout);
+        const auto now = std::chrono::steady_clock::now();
+        size_t count = 0;
+        for (size_t i = 0; i < ready; ++i) {
+            source &src = *_ready[i].user_data;
+            count += detail::drain_monitor_events(
+              src.monitor,
+              [this, &src, now](const monitor_event &event) {
+                  record(src, event, now);
+                  if (_handler)
+                      _handler(src.tag, event);
+              },
+              0);
+        }
+        return count;
+    }
+
+    const monitor_counters &counters(size_t tag) const
+    {
+        return _sources.at(tag)->counters;
+    }
+
+    const monitor_counters &totals() const noexcept { return _totals; }
+
+    // Number of monitored sockets.
+    size_t size() const noexcept { return _active; }
+
+  private:
+    struct source
+    {
+        source(size_t tag_, socket_ref socket_) : tag(tag_), socket(socket_) {}
+
+        size_t tag;
+        socket_ref socket;
+        socket_t monitor;
+        monitor_counters counters;
+        std::chrono::steady_clock::time_point storm_start{};
+        uint64_t storm_retries{0};
+    };
+
+    static void increment(std::atomic<uint64_t> &counter,
+                          std::atomic<uint64_t> &total)
+    {
+        counter.fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void add_connections(source &src, int64_t n)
+    {
+        src.counters.connections.fetch_add(n, std::memory_order_relaxed);
+        _totals.connections.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void record(source &src,
+                const monitor_event &event,
+                std::chrono::steady_clock::time_point now)
+    {
+        monitor_counters &c = src.counters;
+        increment(c.events, _totals.events);
+        switch (event.event) {
+            case ZMQ_EVENT_CONNECTED:
+                increment(c.connected, _totals.connected);
+                add_connections(src, 1);
+                break;
+            case ZMQ_EVENT_ACCEPTED:
+                increment(c.accepted, _totals.accepted);
+                add_connections(src, 1);
+                break;
+            case ZMQ_EVENT_DISCONNECTED:
+                increment(c.disconnected, _totals.disconnected);
+                add_connections(src, -1);
+                break;
+            case ZMQ_EVENT_CONNECT_RETRIED:
+                increment(c.connect_retried, _totals.connect_retried);
+                if (now - src.storm_start > _storm_window) {
+                    src.storm_start = now;
+                    src.storm_retries = 0;
+                }
+                if (++src.storm_retries == _storm_threshold)
+                    increment(c.reconnect_storms, _totals.reconnect_storms);
+                break;
+            case ZMQ_EVENT_ACCEPT_FAILED:
+                increment(c.accept_failed, _totals.accept_failed);
+                break;
+            case ZMQ_EVENT_BIND_FAILED:
+                increment(c.bind_failed, _totals.bind_failed);
+                break;
+#if ZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 2, 3)
+            case ZMQ_EVENT_HANDSHAKE_FAILED_NO_DETAIL:
+            case ZMQ_EVENT_HANDSHAKE_FAILED_PROTOCOL:
+            case ZMQ_EVENT_HANDSHAKE_FAILED_AUTH:
+                increment(c.handshake_failed, _totals.handshake_failed);
+                break;
+#endif
+            default:
+                break;
+        }
+    }
+
+    context_t &_context;
+    uint64_t _storm_threshold;
+    std::chrono::milliseconds _storm_window;
+    handler_type _handler;
+    poller_t<source> _poller;
+    std::vector<std::unique_ptr<source>> _sources;
+    std::vector<poller_event<source>> _ready;
+    size_t _active{0};
+    monitor_counters _totals;
+};
+
+#endif //  defined(ZMQ_BUILD_DRAFT_API) && defined(ZMQ_CPP11) && defined(ZMQ_HAVE_POLLER)
+       //  && defined(ZMQ_NEW_MONITOR_EVENT_LAYOUT)
+
+#if defined(ZMQ_CPP11) && defined(ZMQ_NEW_MONITOR_EVENT_LAYOUT)
+
+namespace detail
+{
+/*  Event counter over a rolling window of one second buckets.
+
+    Written by a single thread, read from any thread. Buckets older than
+    the window are skipped by readers and reset by the writer on reuse.
+*/
+template<size_t Buckets> class rolling_counter
+{
+  public:
+    rolling_counter()
+    {
+        for (size_t i = 0; i < Buckets; ++i) {
+            _counts[i] = 0;
+            _seconds[i] = -1;
+        }
+    }
+
+    void add(int64_t second, uint64_t n = 1) noexcept
+    {
+        const size_t i = static_cast<size_t>(second) % Buckets;
+        if (_seconds[i].load(std::memory_order_relaxed) != second) {
+            _counts[i].store(0, std::memory_order_relaxed);
+            _seconds[i].store(second, std::memory_order_relaxed);
+        }
+        _counts[i].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // Events per second over the complete seconds before second.
+    double rate(int64_t second, size_t window) const noexcept
+    {
+        window = (std::min)((std::max)(window, size_t(1)), Buckets - 1);
+        uint64_t sum = 0;
+        for (size_t i = 0; i < Buckets; ++i) {
+            const int64_t s = _seconds[i].load(std::memory_order_relaxed);
+            if (s < second && s >= second - static_cast<int64_t>(window))
+                sum += _counts[i].load(std::memory_order_relaxed);
+        }
+        return static_cast<double>(sum) / static_cast<double>(window);
+    }
+
+  private:
+    std::atomic<uint64_t> _counts[Buckets];
+    std::atomic<int64_t> _seconds[Buckets];
+};
+
+inline void write_prometheus_label(std::ostream &os, const std::string &value)
+{
+    for (char c : value) {
+        if (c == '\\' || c == '"')
+            os << '\\' << c;
+        else if (c == '\n')
+            os << "\\n";
+        else
+            os << c;
+    }
+}
+} // namespace detail
+
+/*  Connection metrics of a monitored socket, per endpoint.
+
+    Pass as visitor to monitor_t::drain_events (or call record() from a
+    monitor_hub_t handler). Counters are atomics and rates are kept in
+    rolling windows of one second buckets, so a snapshot in Prometheus
+    text format can be taken from any thread while events are recorded
+    by the monitoring thread.
+
+    Handshake latency is measured from ZMQ_EVENT_CONNECTED or
+    ZMQ_EVENT_ACCEPTED to the handshake outcome, matching pending
+    handshakes per endpoint in order.
+*/
+class connection_metrics_t
+{
+  public:
+    using clock = std::chrono::steady_clock;
+
+    struct endpoint_metrics
+    {
+        std::atomic<int64_t> connected_peers{0};
+        std::atomic<uint64_t> connect_retries{0};
+        std::atomic<uint64_t> accept_failures{0};
+        std::atomic<uint64_t> disconnects{0};
+        std::atomic<uint64_t> handshake_failures{0};
+        std::atomic<uint64_t> handshakes{0};
+        std::atomic<uint64_t> handshake_latency_ns{0}; // sum over handshakes
+        detail::rolling_counter<64> connect_retry_window;
+        detail::rolling_counter<64> disconnect_window;
+
+      private:
+        friend class connection_metrics_t;
+        std::deque<clock::time_point> pending_handshakes;
+    };
+
+    explicit connection_metrics_t(
+      std::string socket_name,
+      std::chrono::seconds window = std::chrono::seconds{10}) :
+        _socket_name(std::move(socket_name)),
+        _window(static_cast<size_t>(window.count())),
+        _start(clock::now())
+    {
+    }
+
+    connection_metrics_t(const connection_metrics_t &) = delete;
+    connection_metrics_t &operator=(const connection_metrics_t &) = delete;
+
+    void operator()(const monitor_event &event) { record(event, clock::now()); }
+
+    // Account event, must be called from a single thread.
+    void record(const monitor_event &event, clock::time_point now)
+    {
+        endpoint_metrics &m = lookup(event.addr);
+        const int64_t second = seconds_at(now);
+        switch (event.event) {
+            case ZMQ_EVENT_CONNECTED:
+            case ZMQ_EVENT_ACCEPTED:
+                m.connected_peers.fetch_add(1, std::memory_order_relaxed);
+                if (m.pending_handshakes.size() < max_pending_handshakes)
+                    m.pending_handshakes.push_back(now);
+                break;
+            case ZMQ_EVENT_DISCONNECTED:
+                m.connected_peers.fetch_sub(1, std::memory_order_relaxed);
+                m.disconnects.fetch_add(1, std::memory_order_relaxed);
+                m.disconnect_window.add(second);
+                break;
+            case ZMQ_EVENT_CONNECT_RETRIED:
+                m.connect_retries.fetch_add(1, std::memory_order_relaxed);
+                m.connect_retry_window.add(second);
+                break;
+            case ZMQ_EVENT_ACCEPT_FAILED:
+                m.accept_failures.fetch_add(1, std::memory_order_relaxed);
+                break;
+#if (defined(ZMQ_BUILD_DRAFT_API) && ZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 2, 3))  \
+  || ZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 0)
+            case ZMQ_EVENT_HANDSHAKE_SUCCEEDED:
+                if (!m.pending_handshakes.empty()) {
+                    const auto latency = now - m.pending_handshakes.front();
+                    m.pending_handshakes.pop_front();
+                    m.handshake_latency_ns.fetch_add(
+                      static_cast<uint64_t>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(latency)
+                          .count()),
+                      std::memory_order_relaxed);
+                    m.handshakes.fetch_add(1, std::memory_order_relaxed);
+                }
+                break;
+            case ZMQ_EVENT_HANDSHAKE_FAILED_NO_DETAIL:
+            case ZMQ_EVENT_HANDSHAKE_FAILED_PROTOCOL:
+            case ZMQ_EVENT_HANDSHAKE_FAILED_AUTH:
+                if (!m.pending_handshakes.empty())
+                    m.pending_handshakes.pop_front();
+                m.handshake_failures.fetch_add(1, std::memory_order_relaxed);
+                break;
+#endif
+            default:
+                break;
+        }
+    }
+
+    // Metrics of endpoint, nullptr if no event was recorded for it.
+    const endpoint_metrics *find(const std::string &endpoint) const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        const auto it = _endpoints.find(endpoint);
+        return it == _endpoints.end() ? nullptr : it->second.get();
+    }
+
+    // Rates in events per second over the window before now.
+    double connect_retry_rate(const endpoint_metrics &m,
+                              clock::time_point now = clock::now()) const
+    {
+        return m.connect_retry_window.rate(seconds_at(now), _window);
+    }
+
+    double disconnect_rate(const endpoint_metrics &m,
+                           clock::time_point now = clock::now()) const
+    {
+        return m.disconnect_window.rate(seconds_at(now), _window);
+    }
+
+    // Write all metrics in Prometheus text exposition format.
+    void snapshot(std::ostream &os, clock::time_point now = clock::now()) const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        gauge(os, "zmq_connected_peers", [](const endpoint_metrics &m) {
+            return static_cast<double>(m.connected_peers.load());
+        });
+        counter(os, "zmq_connect_retries_total", &endpoint_metrics::connect_retries);
+        gauge(os, "zmq_connect_retry_rate", [this, now](const endpoint_metrics &m) {
+            return connect_retry_rate(m, now);
+        });
+        counter(os, "zmq_accept_failures_total", &endpoint_metrics::accept_failures);
+        counter(os, "zmq_disconnects_total", &endpoint_metrics::disconnects);
+        gauge(os, "zmq_disconnect_rate", [this, now](const endpoint_metrics &m) {
+            return disconnect_rate(m, now);
+        });
+        counter(os, "zmq_handshake_failures_total",
+                &endpoint_metrics::handshake_failures);
+
+        os << "# TYPE zmq_handshake_latency_seconds summary\n";
+        for (const auto &e : _endpoints) {
+            sample(os, "zmq_handshake_latency_seconds_sum", e.first)
+              << static_cast<double>(e.second->handshake_latency_ns.load()) / 1e9
+              << '\n';
+            sample(os, "zmq_handshake_latency_seconds_count", e.first)
+              << e.second->handshakes.load() << '\n';
+        }
+    }
+
+    std::string snapshot(clock::time_point now = clock::now()) const
+    {
+        std::ostringstream os;
+        snapshot(os, now);
+        return os.str();
+    }
+
+    const std::string &socket_name() const noexcept { return _socket_name; }
+
+  private:
+    static constexpr size_t max_pending_handshakes = 1024;
+
+    endpoint_metrics &lookup(const_buffer addr)
+    {
+        // only the recording thread modifies the map, it may read unlocked
+        _key.assign(static_cast<const char *>(addr.data()), addr.size());
+        const auto it = _endpoints.find(_key);
+        if (it != _endpoints.end())
+            return *it->second;
+        std::unique_ptr<endpoint_metrics> m(new endpoint_metrics());
+        endpoint_metrics &ref = *m;
+        std::lock_guard<std::mutex> lock(_mutex);
+        _endpoints.emplace(_key, std::move(m));
+        return ref;
+    }
+
+    int64_t seconds_at(clock::time_point now) const
+    {
+        return std::chrono::duration_cast<std::chrono::seconds>(now - _start)
+          .count();
+    }
+
+    std::ostream &
+    sample(std::ostream &os, const char *name, const std::string &endpoint) const
+    {
+        os << name << "{socket=\"";
+        detail::write_prometheus_label(os, _socket_name);
+        os << "\",endpoint=\"";
+        detail::write_prometheus_label(os, endpoint);
+        return os << "\"} ";
+    }
+
+    void counter(std::ostream &os,
+                 const char *name,
+                 std::atomic<uint64_t> endpoint_metrics::*member) const
+    {
+        os << "# TYPE " << name << " counter\n";
+        for (const auto &e : _endpoints)
+            sample(os, name, e.first) << ((*e.second).*member).load() << '\n';
+    }
+
+    template<class Fn> void gauge(std::ostream &os, const char *name, Fn fn) const
+    {
+        os << "# TYPE " << name << " gauge\n";
+        for (const auto &e : _endpoints)
+            sample(os, name, e.first) << fn(*e.second) << '\n';
+    }
+
+    std::string _socket_name;
+    size_t _window;
+    clock::time_point _start;
+    std::map<std::string, std::unique_ptr<endpoint_metrics>> _endpoints;
+    std::string _key;
+    mutable std::mutex _mutex;
+};
+
+#endif
+
+#if defined(ZMQ_CPP11) && defined(ZMQ_NEW_MONITOR_EVENT_LAYOUT)
+
+// Name of a ZMQ_EVENT_* constant without prefix, "unknown" for others.
+inline const char *monitor_event_name(uint16_t event) noexcept
+{
+    switch (event) {
+        case ZMQ_EVENT_CONNECTED:
+            return "connected";
+        case ZMQ_EVENT_CONNECT_DELAYED:
+            return "connect_delayed";
+        case ZMQ_EVENT_CONNECT_RETRIED:
+            return "connect_retried";
+        case ZMQ_EVENT_LISTENING:
+            return "listening";
+        case ZMQ_EVENT_BIND_FAILED:
+            return "bind_failed";
+        case ZMQ_EVENT_ACCEPTED:
+            return "accepted";
+        case ZMQ_EVENT_ACCEPT_FAILED:
+            return "accept_failed";
+        case ZMQ_EVENT_CLOSED:
+            return "closed";
+        case ZMQ_EVENT_CLOSE_FAILED:
+            return "close_failed";
+        case ZMQ_EVENT_DISCONNECTED:
+            return "disconnected";
+#ifdef ZMQ_EVENT_MONITOR_STOPPED
+        case ZMQ_EVENT_MONITOR_STOPPED:
+            return "monitor_stopped";
+#endif
+#if (defined(ZMQ_BUILD_DRAFT_API) && ZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 2, 3))  \
+  || ZMQ_VERSION >= ZMQ_MAKE_VERSION(4, 3, 0)
+        case ZMQ_EVENT_HANDSHAKE_FAILED_NO_DETAIL:
+            return "handshake_failed_no_detail";
+        case ZMQ_EVENT_HANDSHAKE_SUCCEEDED:
+            return "handshake_succeeded";
+        case ZMQ_EVENT_HANDSHAKE_FAILED_PROTOCOL:
+            return "handshake_failed_protocol";
+        case ZMQ_EVENT_HANDSHAKE_FAILED_AUTH:
+            return "handshake_failed_auth";
+#endif
+        default:
+            return "unknown";
+    }
+}
+
+enum class dump_format
+{
+    text,
+    binary
+};
+
+/*  Fixed size ring buffer of the most recent monitor events.
+
+    Pass as visitor to monitor_t::drain_events. Each event is stored as a
+    fixed size record with a wall clock timestamp, addresses are interned
+    into ids. All memory is allocated by the constructor, recording never
+    allocates; addresses beyond the interning capacity are recorded with
+    id unknown_address.
+
+    Events must be recorded by a single thread. Records may be read and
+    dumped from any thread concurrently, records overwritten while being
+    read are skipped.
+
+    The binary dump consists of the magic "ZMQMONR1", the address count
+    (4 bytes) followed by each address as length (4 bytes) and bytes, the
+    record count (8 bytes) followed by each record as timestamp in ns
+    since the epoch (8 bytes), event (2 bytes), value (4 bytes) and
+    address id (4 bytes), all integers in network byte order.
+*/
+class monitor_ring_t
+{
+  public:
+    enum : uint32_t
+    {
+        unknown_address = 0xFFFFFFFF
+    };
+
+    struct record
+    {
+        std::chrono::system_clock::time_point time;
+        uint16_t event;
+        int32_t value;
+        uint32_t address_id;
+    };
+
+    explicit monitor_ring_t(size_t capacity = 4096,
+                            size_t max_addresses = 256,
+                            size_t address_bytes = 16 * 1024) :
+        _slots(capacity == 0 ? 1 : capacity),
+        _addresses(max_addresses),
+        _arena(address_bytes)
+    {
+        size_t index_size = 16;
+        while (index_size < max_addresses * 2)
+            index_size *= 2;
+        _index.assign(index_size, 0);
+    }
+
+    monitor_ring_t(const monitor_ring_t &) = delete;
+    monitor_ring_t &operator=(const monitor_ring_t &) = delete;
+
+    void operator()(const monitor_event &event)
+    {
+        record_event(event, std::chrono::system_clock::now());
+    }
+
+    void record_event(const monitor_event &event,
+                      std::chrono::system_clock::time_point time)
+    {
+        const uint64_t n = _recorded.load(std::memory_order_relaxed);
+        slot &s = _slots[n % _slots.size()];
+        // odd sequence marks a slot being written (seqlock)
+        s.seq.store(2 * n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        s.time.store(static_cast<uint64_t>(
+                       std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         time.time_since_epoch())
+                         .count()),
+                     std::memory_order_relaxed);
+        s.event_value.store(uint64_t(event.event) << 32
+                              | static_cast<uint32_t>(event.value),
+                            std::memory_order_relaxed);
+        s.address_id.store(intern(event.addr), std::memory_order_relaxed);
+        s.seq.store(2 * n + 2, std::memory_order_release);
+        _recorded.store(n + 1, std::memory_order_release);
+    }
+
+    /*  Call fn(const record &) for the retained records, oldest first.
+
+        Returns: the number of records visited.
+    */
+    template<class Fn> size_t for_each(Fn &&fn) const
+    {
+        const uint64_t end = _recorded.load(std::memory_order_acquire);
+        const uint64_t begin = end > _slots.size() ? end - _slots.size() : 0;
+        size_t count = 0;
+        for (uint64_t n = begin; n < end; ++n) {
+            const slot &s = _slots[n % _slots.size()];
+            if (s.seq.load(std::memory_order_acquire) != 2 * n + 2)
+                continue;
+            const uint64_t time = s.time.load(std::memory_order_relaxed);
+            const uint64_t event_value =
+              s.event_value.load(std::memory_order_relaxed);
+            const uint32_t address_id = s.address_id.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s.seq.load(std::memory_order_relaxed) != 2 * n + 2)
+                continue; // overwritten meanwhile
+            record r;
+            r.time = std::chrono::system_clock::time_point(
+              std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                std::chrono::nanoseconds(time)));
+            r.event = static_cast<uint16_t>(event_value >> 32);
+            r.value = static_cast<int32_t>(static_cast<uint32_t>(event_value));
+            r.address_id = address_id;
+            fn(static_cast<const record &>(r));
+            ++count;
+        }
+        return count;
+    }
+
+    // The interned address of id, empty if unknown.
+    std::string address(uint32_t id) const
+    {
+        if (id >= _address_count.load(std::memory_order_acquire))
+            return std::string();
+        return std::string(_arena.data() + _addresses[id].offset,
+                           _addresses[id].size);
+    }
+
+    // Write the retained records, one line per record, oldest first.
+    void dump_text(std::ostream &os) const
+    {
+        for_each([this, &os](const record &r) {
+            os << std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    r.time.time_since_epoch())
+                    .count()
+               << ' ' << monitor_event_name(r.event) << ' ' << r.value << ' '
+               << (r.address_id == unknown_address ? std::string("?")
+                                                   : address(r.address_id))
+               << '\n';
+        });
+    }
+
+    // Write the retained records in the binary format described above.
+    void dump_binary(std::ostream &os) const
+    {
+        std::vector<record> records;
+        records.reserve(_slots.size());
+        for_each([&records](const record &r) { records.push_back(r); });
+
+        os.write("ZMQMONR1", 8);
+        const uint32_t addresses = _address_count.load(std::memory_order_acquire);
+        write_uint(os, addresses, 4);
+        for (uint32_t id = 0; id < addresses; ++id) {
+            write_uint(os, _addresses[id].size, 4);
+            os.write(_arena.data() + _addresses[id].offset,
+                     static_cast<std::streamsize>(_addresses[id].size));
+        }
+        write_uint(os, records.size(), 8);
+        for (const auto &r : records) {
+            write_uint(os,
+                       static_cast<uint64_t>(
+                         std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           r.time.time_since_epoch())
+                           .count()),
+                       8);
+            write_uint(os, r.event, 2);
+            write_uint(os, static_cast<uint32_t>(r.value), 4);
+            write_uint(os, r.address_id, 4);
+        }
+    }
+
+    /*  Dump the retained records to the file at path.
+
+        Throws: std::runtime_error if the file can not be written.
+    */
+    void dump(const std::string &path, dump_format format = dump_format::text) const
+    {
+        std::ofstream file(path, format == dump_format::binary
+                                   ? std::ios::out | std::ios::binary
+                                   : std::ios::out);
+        if (format == dump_format::binary)
+            dump_binary(file);
+        else
+            dump_text(file);
+        file.flush();
+        if (!file)
+            throw std::runtime_error("Failed to write monitor dump " + path);
+    }
+
+    // Number of retained records.
+    size_t size() const noexcept
+    {
+        const uint64_t n = _recorded.load(std::memory_order_acquire);
+        return n < _slots.size() ? static_cast<size_t>(n) : _slots.size();
+    }
+
+    // Number of records since construction, including overwritten ones.
+    uint64_t recorded() const noexcept
+    {
+        return _recorded.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const noexcept { return _slots.size(); }
+
+  private:
+    struct slot
+    {
+        std::atomic<uint64_t> seq{0};
+        std::atomic<uint64_t> time{0};
+        std::atomic<uint64_t> event_value{0}; // event << 32 | value
+        std::atomic<uint32_t> address_id{0};
+    };
+
+    struct address_entry
+    {
+        size_t offset;
+        size_t size;
+        uint64_t hash;
+    };
+
+    static void write_uint(std::ostream &os, uint64_t value, size_t bytes)
+    {
+        char buf[8];
+        for (size_t i = 0; i < bytes; ++i)
+            buf[i] = static_cast<char>(value >> (8 * (bytes - 1 - i)));
+        os.write(buf, static_cast<std::streamsize>(bytes));
+    }
+
+    uint32_t intern(const_buffer addr)
+    {
+        const uint64_t hash = detail::fnv1a(addr.data(), addr.size());
+        const uint32_t count = _address_count.load(std::memory_order_relaxed);
+        const size_t mask = _index.size() - 1;
+        size_t pos = static_cast<size_t>(hash) & mask;
+        while (_index[pos] != 0) {
+            const address_entry &e = _addresses[_index[pos] - 1];
+            if (e.hash == hash && e.size == addr.size()
+                && memcmp(_arena.data() + e.offset, addr.data(), e.size) == 0)
+                return _index[pos] - 1;
+            pos = (pos + 1) & mask;
+        }
+        if (count == _addresses.size() || _arena_used + addr.size() > _arena.size())
+            return unknown_address;
+
+        memcpy(_arena.data() + _arena_used, addr.data(), addr.size());
+        _addresses[count] = address_entry{_arena_used, addr.size(), hash};
+        _arena_used += addr.size();
+        _index[pos] = count + 1;
+        // publish the entry to readers
+        _address_count.store(count + 1, std::memory_order_release);
+        return count;
+    }
+
+    std::vector<slot> _slots;
+    std::atomic<uint64_t> _recorded{0};
+    std::vector<address_entry> _addresses;
+    std::atomic<uint32_t> _address_count{0};
+    std::vector<char> _arena;
+    size_t _arena_used{0};
+    std::vector<uint32_t> _index; // address id + 1, 0 marks an empty slot
+};
+
+#endif
+
+#ifdef ZMQ_CPP11
+
+namespace detail
+{
+inline unsigned log2_floor(uint64_t value) noexcept
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return 63u - static_cast<unsigned>(__builtin_clzll(value));
+#else
+    unsigned n = 0;
+    while (value >>= 1)
+        ++n;
+    return n;
+#endif
+}
+
+/*  Keeps value on cache lines of its own, apart from the neighbouring
+    members, without over-aligning the enclosing class; operator new
+    only respects extended alignment from C++17 on.
+*/
+template<class T> struct cache_line_padded
+{
+    char pad_before[64];
+    T value{};
+    char pad_after[64 - sizeof(T) % 64];
+};
+
+// splitmix64, used to generate trace and span ids
+inline uint64_t next_random(uint64_t &state) noexcept
+{
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+} // namespace detail
+
+/*  Histogram of latencies in nanoseconds with logarithmic buckets.
+
+    Each power of two range is split into 16 linear sub-buckets, bounding
+    the relative error of a bucket to 1/16 over the full 64 bit range.
+    Recording is a single relaxed atomic increment, the histogram may be
+    read while being recorded from another thread.
+*/
+class latency_histogram_t
+{
+  public:
+    enum : size_t
+    {
+        sub_buckets = 16,
+        bucket_count = (64 - 3) * sub_buckets
+    };
+
+    latency_histogram_t() noexcept
+    {
+        for (auto &count : _counts)
+            count = 0;
+    }
+
+    void record(uint64_t ns) noexcept
+    {
+        _counts[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void record(std::chrono::nanoseconds latency) noexcept
+    {
+        record(latency.count() < 0 ? 0 : static_cast<uint64_t>(latency.count()));
+    }
+
+    // Number of recorded values.
+    uint64_t count() const noexcept
+    {
+        uint64_t total = 0;
+        for (const auto &c : _counts)
+            total += c.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    uint64_t bucket_value(size_t index) const noexcept
+    {
+        return _counts[index].load(std::memory_order_relaxed);
+    }
+
+    // Smallest value falling into bucket index.
+    static uint64_t bucket_lower(size_t index) noexcept
+    {
+        if (index < sub_buckets)
+            return index;
+        const unsigned shift = static_cast<unsigned>(index / sub_buckets) - 1;
+        return (sub_buckets + index % sub_buckets) << shift;
+    }
+
+    static size_t bucket(uint64_t ns) noexcept
+    {
+        if (ns < sub_buckets)
+            return static_cast<size_t>(ns);
+        const unsigned shift = detail::log2_floor(ns) - 4;
+        return (shift + 1) * sub_buckets + ((ns >> shift) & (sub_buckets - 1));
+    }
+
+    // Largest value falling into bucket index.
+    static uint64_t bucket_upper(size_t index) noexcept
+    {
+        return index + 1 < bucket_count ? bucket_lower(index + 1) - 1
+                                        : ~uint64_t(0);
+    }
+
+    /*  Value at or below which the fraction q (0 to 1) of the recorded
+        values lies, reported as upper bound of its bucket.
+        Returns: 0 if the histogram is empty.
+    */
+    uint64_t percentile(double q) const noexcept
+    {
+        const uint64_t total = count();
+        if (total == 0)
+            return 0;
+        q = (std::min)((std::max)(q, 0.0), 1.0);
+        const double exact = q * static_cast<double>(total);
+        uint64_t rank = static_cast<uint64_t>(exact);
+        if (rank == 0 || static_cast<double>(rank) < exact)
+            ++rank;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < bucket_count; ++i) {
+            seen += _counts[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+                return bucket_upper(i);
+        }
+        // values recorded concurrently after counting
+        return bucket_upper(bucket_count - 1);
+    }
+
+    /*  Write the count and common percentiles in nanoseconds,
+        one "name value" pair per line.
+    */
+    void write_percentiles(std::ostream &os) const
+    {
+        static const struct
+        {
+            const char *name;
+            double q;
+        } percentiles[] = {{"p50", 0.5},    {"p90", 0.9},      {"p99", 0.99},
+                           {"p99.9", 0.999}, {"p99.99", 0.9999}, {"max", 1.0}};
+        os << "count " << count() << '\n';
+        for (const auto &p : percentiles)
+            os << p.name << ' ' << percentile(p.q) << '\n';
+    }
+
+    void reset() noexcept
+    {
+        for (auto &count : _counts)
+            count.store(0, std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<uint64_t> _counts[bucket_count];
+};
+
+/*  Trace context propagated in a leading frame of traced messages.
+
+    Trace ids of 0 mark an untraced message.
+*/
+struct trace_context
+{
+    uint64_t trace_id_high;
+    uint64_t trace_id_low;
+    uint64_t span_id;
+    uint64_t send_time_ns; // system clock, ns since the epoch
+
+    bool valid() const noexcept { return (trace_id_high | trace_id_low) != 0; }
+};
+
+/*  Opt-in message tracing.
+
+    send() prefixes a message with a 33 byte trace frame, small enough
+    to be stored inline in the message, holding a version byte, the
+    trace id, the span id and the send time. recv() strips the frame,
+    returns the trace context and records the time the message spent in
+    queues and on the wire since it was sent into a latency histogram.
+    A leading frame is taken for a trace frame only if it has the size
+    and version byte of one and a valid trace id, untraced peers must not
+    send 33 byte leading frames starting with 0xF1.
+    Intermediaries forward the trace frame along with the message or
+    continue the trace with child(). With ROUTER sockets the routing id
+    precedes the trace frame; make_frame() and parse_frame() support
+    such custom layouts.
+
+    Timestamps use the system clock, per hop latencies between hosts
+    include their clock offset.
+*/
+class tracer_t
+{
+  public:
+    enum : size_t
+    {
+        frame_size = 33
+    };
+    enum : unsigned char
+    {
+        frame_version = 0xF1
+    };
+
+    explicit tracer_t(uint64_t seed = std::random_device{}()) : _random(seed) {}
+
+    tracer_t(const tracer_t &) = delete;
+    tracer_t &operator=(const tracer_t &) = delete;
+
+    // A context starting a new trace.
+    trace_context start_trace() noexcept
+    {
+        trace_context ctx;
+        ctx.trace_id_high = detail::next_random(_random);
+        ctx.trace_id_low = detail::next_random(_random) | 1;
+        ctx.span_id = detail::next_random(_random);
+        ctx.send_time_ns = 0;
+        return ctx;
+    }
+
+    // A new span of the trace of parent.
+    trace_context child(const trace_context &parent) noexcept
+    {
+        trace_context ctx = parent;
+        ctx.span_id = detail::next_random(_random);
+        return ctx;
+    }
+
+    /*  Send msgs prefixed with the trace frame of ctx, stamped with the
+        current time.
+
+        The range must be a ForwardRange of zmq::message_t,
+        zmq::const_buffer or zmq::mutable_buffer.
+        Returns: the number of parts of msgs sent or nullopt (on EAGAIN).
+    */
+    template<class Range
+#ifndef ZMQ_CPP11_PARTIAL
+             ,
+             typename = typename std::enable_if<
+               detail::is_range<Range>::value
+               && (std::is_same<detail::range_value_t<Range>, message_t>::value
+                   || detail::is_buffer<detail::range_value_t<Range>>::value)>::type
+#endif
+             >
+    send_result_t send(socket_ref s,
+                       const trace_context &ctx,
+                       Range &&msgs,
+                       send_flags flags = send_flags::none)
+    {
+        flags = flags & ~send_flags::sndmore;
+        auto it = detail::ranges::begin(msgs);
+        const auto end = detail::ranges::end(msgs);
+        if (!s.send(make_frame(ctx, now_ns()),
+                    it == end ? flags : flags | send_flags::sndmore))
+            return {};
+        size_t count = 0;
+        while (it != end) {
+            const auto next = std::next(it);
+            s.send(*it, next == end ? flags : flags | send_flags::sndmore);
+            ++count;
+            it = next;
+        }
+        return count;
+    }
+
+    /*  Receive a message, stripping its trace frame into ctx.
+
+        The remaining parts are written to OutputIterator out. Messages
+        without trace frame are passed on unchanged and leave ctx invalid.
+        Returns: the number of parts written or nullopt (on EAGAIN).
+    */
+    template<class OutputIt>
+    recv_result_t recv(socket_ref s,
+                       OutputIt out,
+                       trace_context &ctx,
+                       recv_flags flags = recv_flags::none)
+    {
+        message_t msg;
+        if (!s.recv(msg, flags))
+            return {};
+        size_t count = 0;
+        bool more = msg.more();
+        if (parse_frame(msg, ctx)) {
+            record_hop(ctx);
+        } else {
+            ctx = trace_context();
+            *out++ = std::move(msg);
+            ++count;
+        }
+        while (more) {
+            message_t part;
+            // zmq ensures atomic delivery of messages
+            const auto ret = s.recv(part, recv_flags::none);
+            assert(ret);
+            (void) ret;
+            more = part.more();
+            *out++ = std::move(part);
+            ++count;
+        }
+        return count;
+    }
+
+    // Record the latency since the send time of ctx.
+    void record_hop(const trace_context &ctx) noexcept
+    {
+        const uint64_t now = now_ns();
+        _hop_latency.record(now > ctx.send_time_ns ? now - ctx.send_time_ns : 0);
+    }
+
+    const latency_histogram_t &hop_latency() const noexcept { return _hop_latency; }
+
+    static message_t make_frame(const trace_context &ctx, uint64_t send_time_ns)
+    {
+        unsigned char buf[frame_size];
+        buf[0] = frame_version;
+        detail::put_uint64(buf + 1, ctx.trace_id_high);
+        detail::put_uint64(buf + 9, ctx.trace_id_low);
+        detail::put_uint64(buf + 17, ctx.span_id);
+        detail::put_uint64(buf + 25, send_time_ns);
+        return message_t(buf, frame_size);
+    }
+
+    // Returns false, leaving ctx unchanged, if frame is no trace frame.
+    static bool parse_frame(const message_t &frame, trace_context &ctx) noexcept
+    {
+        if (frame.size() != frame_size
+            || *frame.data<unsigned char>() != frame_version)
+            return false;
+        const unsigned char *buf = frame.data<unsigned char>();
+        trace_context parsed;
+        parsed.trace_id_high = detail::get_uint64(buf + 1);
+        parsed.trace_id_low = detail::get_uint64(buf + 9);
+        parsed.span_id = detail::get_uint64(buf + 17);
+        parsed.send_time_ns = detail::get_uint64(buf + 25);
+        if (!parsed.valid())
+            return false;
+        ctx = parsed;
+        return true;
+    }
+
+    static uint64_t now_ns() noexcept
+    {
+        return static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count());
+    }
+
+  private:
+    uint64_t _random;
+    latency_histogram_t _hop_latency;
+};
+
+#endif // ZMQ_CPP11
+
+#ifdef ZMQ_CPP11
+
+/*  One-way latency probe.
+
+    send() appends a trailing probe frame to every message, holding the
+    send time for one in sample_every messages and empty otherwise.
+    recv() strips the probe frame and records the latency of sampled
+    messages into a latency_histogram_t, so latency accounting stays out
+    of the application payload; topics of PUB/SUB messages are kept in
+    the first frame.
+
+    Both ends must use a probe with the same Clock. The default
+    steady_clock is CLOCK_MONOTONIC on Linux, which is comparable between
+    processes of the same host; use system_clock between synchronized
+    hosts.
+*/
+template<class Clock = std::chrono::steady_clock> class latency_probe_t
+{
+  public:
+    explicit latency_probe_t(unsigned sample_every = 1) :
+        _sample_every(sample_every == 0 ? 1 : sample_every)
+    {
+    }
+
+    latency_probe_t(const latency_probe_t &) = delete;
+    latency_probe_t &operator=(const latency_probe_t &) = delete;
+
+    /*  Send msgs followed by the probe frame.
+
+        The range must be a ForwardRange of zmq::message_t,
+        zmq::const_buffer or zmq::mutable_buffer.
+        Returns: the number of parts of msgs sent or nullopt (on EAGAIN).
+    */
+    template<class Range
+#ifndef ZMQ_CPP11_PARTIAL
+             ,
+             typename = typename std::enable_if<
+               detail::is_range<Range>::value
+               && (std::is_same<detail::range_value_t<Range>, message_t>::value
+                   || detail::is_buffer<detail::range_value_t<Range>>::value)>::type
+#endif
+             >
+    send_result_t
+    send(socket_ref s, Range &&msgs, send_flags flags = send_flags::none)
+    {
+        flags = flags & ~send_flags::sndmore;
+        size_t count = 0;
+        for (auto &&msg : msgs) {
+            if (!s.send(msg, flags | send_flags::sndmore)) {
+                // zmq ensures atomic delivery of messages
+                assert(count == 0);
+                return {};
+            }
+            ++count;
+        }
+        // the timestamp is taken last to exclude the time spent above
+        if (++_sent % _sample_every == 0)
+            s.send(detail::uint64_message(now_ns()), flags);
+        else
+            s.send(message_t(), flags);
+        return count;
+    }
+
+    /*  Receive a message, stripping the probe frame.
+
+        The remaining parts are written to OutputIterator out.
+        Returns: the number of parts written or nullopt (on EAGAIN).
+    */
+    template<class OutputIt>
+    recv_result_t
+    recv(socket_ref s, OutputIt out, recv_flags flags = recv_flags::none)
+    {
+        message_t msg;
+        if (!s.recv(msg, flags))
+            return {};
+        size_t count = 0;
+        while (msg.more()) {
+            message_t next;
+            // zmq ensures atomic delivery of messages
+            const auto ret = s.recv(next, recv_flags::none);
+            assert(ret);
+            (void) ret;
+            *out++ = std::move(msg);
+            msg = std::move(next);
+            ++count;
+        }
+        if (msg.size() == sizeof(uint64_t)) {
+            const uint64_t sent = detail::message_uint64(msg);
+            const uint64_t now = now_ns();
+            _histogram.record(now > sent ? now - sent : 0);
+        }
+        return count;
+    }
+
+    const latency_histogram_t &histogram() const noexcept { return _histogram; }
+
+    latency_histogram_t &histogram() noexcept { return _histogram; }
+
+    unsigned sample_every() const noexcept { return _sample_every; }
+
+  private:
+    static uint64_t now_ns() noexcept
+    {
+        return static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now().time_since_epoch())
+            .count());
+    }
+
+    unsigned _sample_every;
+    uint64_t _sent{0};
+    latency_histogram_t _histogram;
+};
+
+#endif // ZMQ_CPP11
+
+#if defined(ZMQ_CPP11) && !defined(_WIN32)
+
+/*  Bounded lock-free in-process channel of messages.
+
+    An alternative to inproc PAIR sockets for hot thread to thread
+    pipelines, with the send/recv interface of socket_t. Messages are
+    moved through a ring of zmq_msg_t (a bounded queue with per cell
+    sequence numbers), safe for any number of sending threads and one
+    receiving thread.
+
+    fd() becomes readable when messages are pending and may be polled
+    with zmq::poll or poller_t::add_fd, it is only signalled when the
+    channel turns non-empty, so a busy pipeline does not make system
+    calls. Wakeups may be spurious, receive with recv_flags::dontwait
+    after polling. It is an eventfd on Linux and a pipe elsewhere.
+
+    Blocking sends wait for space by yielding, the receiving side is
+    expected to keep up.
+*/
+class channel_t
+{
+  public:
+    explicit channel_t(size_t capacity = 1024) :
+        _spin_count(std::thread::hardware_concurrency() > 1 ? 4096 : 0)
+    {
+        size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+        _mask = size - 1;
+        _cells.reset(new cell[size]);
+        for (size_t i = 0; i < size; ++i)
+            _cells[i].seq.store(i, std::memory_order_relaxed);
+#ifdef __linux__
+        _fds[0] = _fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (_fds[0] == -1)
+            throw error_t();
+#else
+        if (pipe(_fds) != 0)
+            throw error_t();
+        for (int fd : _fds) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+#endif
+    }
+
+    ~channel_t()
+    {
+        message_t msg;
+        while (try_pop(msg)) {
+        }
+        ::close(_fds[0]);
+        if (_fds[1] != _fds[0])
+            ::close(_fds[1]);
+    }
+
+    channel_t(const channel_t &) = delete;
+    channel_t &operator=(const channel_t &) = delete;
+
+    /*  Move msg into the channel, leaving it empty.
+
+        Returns: the size of msg or nullopt if the channel is full
+        and send_flags::dontwait was given.
+    */
+    send_result_t send(message_t &msg, send_flags flags = send_flags::none)
+    {
+        const size_t size = msg.size();
+        while (!try_push(msg)) {
+            if ((flags & send_flags::dontwait) != send_flags::none)
+                return {};
+            std::this_thread::yield();
+        }
+        // pairs with the fence in recv, see there
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!_signaled.value.load(std::memory_order_relaxed)
+            && !_signaled.value.exchange(true))
+            signal();
+        return size;
+    }
+
+    send_result_t send(message_t &&msg, send_flags flags = send_flags::none)
+    {
+        return send(msg, flags);
+    }
+
+    send_result_t send(const_buffer buf, send_flags flags = send_flags::none)
+    {
+        message_t msg(buf.data(), buf.size());
+        return send(msg, flags);
+    }
+
+    /*  Receive the next message into msg.
+
+        Returns: the size of msg or nullopt if the channel is empty
+        and recv_flags::dontwait was given.
+    */
+    ZMQ_NODISCARD
+    recv_result_t recv(message_t &msg, recv_flags flags = recv_flags::none)
+    {
+        while (true) {
+            if (try_pop(msg))
+                return msg.size();
+            // a busy pipeline delivers the next message shortly, spin
+            // briefly before falling back to a system call (multicore only)
+            if ((flags & recv_flags::dontwait) == recv_flags::none) {
+                for (unsigned i = 0; i < _spin_count; ++i) {
+                    if (try_pop(msg))
+                        return msg.size();
+                }
+            }
+            // the channel looks empty, consume the wakeup and look again
+            // so a message sent in between is not missed
+            _signaled.value.store(false, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            drain_signal();
+            if (try_pop(msg)) {
+                // more messages may follow without a signal, keep fd readable
+                if (!_signaled.value.exchange(true))
+                    signal();
+                return msg.size();
+            }
+            if ((flags & recv_flags::dontwait) != recv_flags::none)
+                return {};
+            zmq::pollitem_t items[] = {{nullptr, _fds[0], ZMQ_POLLIN, 0}};
+            poll(items, 1, std::chrono::milliseconds{-1});
+        }
+    }
+
+    // File descriptor readable when messages are pending.
+    int fd() const noexcept { return _fds[0]; }
+
+    size_t capacity() const noexcept { return _mask + 1; }
+
+  private:
+    struct cell
+    {
+        std::atomic<size_t> seq;
+        zmq_msg_t msg;
+    };
+
+    bool try_push(message_t &msg)
+    {
+        size_t pos = _enqueue_pos.value.load(std::memory_order_relaxed);
+        cell *c;
+        while (true) {
+            c = &_cells[pos & _mask];
+            const size_t seq = c->seq.load(std::memory_order_acquire);
+            const auto diff =
+              static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0) {
+                if (_enqueue_pos.value.compare_exchange_weak(pos, pos + 1,
+                                                       std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false; // full
+            } else {
+                pos = _enqueue_pos.value.load(std::memory_order_relaxed);
+            }
+        }
+        zmq_msg_init(&c->msg);
+        const int rc = zmq_msg_move(&c->msg, msg.handle());
+        ZMQ_ASSERT(rc == 0);
+        (void) rc;
+        c->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(message_t &msg)
+    {
+        const size_t pos = _dequeue_pos.value.load(std::memory_order_relaxed);
+        cell &c = _cells[pos & _mask];
+        if (c.seq.load(std::memory_order_acquire) != pos + 1)
+            return false; // empty
+        _dequeue_pos.value.store(pos + 1, std::memory_order_relaxed);
+        const int rc = zmq_msg_move(msg.handle(), &c.msg);
+        ZMQ_ASSERT(rc == 0);
+        (void) rc;
+        zmq_msg_close(&c.msg);
+        c.seq.store(pos + _mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    void signal() noexcept
+    {
+#ifdef __linux__
+        const uint64_t one = 1;
+        ssize_t rc = ::write(_fds[1], &one, sizeof(one));
+#else
+        const char one = 1;
+        ssize_t rc = ::write(_fds[1], &one, sizeof(one));
+#endif
+        (void) rc; // a pending signal suffices
+    }
+
+    void drain_signal() noexcept
+    {
+        char buf[64];
+        while (::read(_fds[0], buf, sizeof(buf)) > 0) {
+        }
+    }
+
+    std::unique_ptr<cell[]> _cells;
+    size_t _mask;
+    detail::cache_line_padded<std::atomic<size_t>> _enqueue_pos;
+    detail::cache_line_padded<std::atomic<size_t>> _dequeue_pos;
+    detail::cache_line_padded<std::atomic<bool>> _signaled;
+    unsigned _spin_count;
+    int _fds[2];
+};
+
+#endif // defined(ZMQ_CPP11) && !defined(_WIN32)
+
+#if defined(ZMQ_CPP11) && !defined(_WIN32)
+
+namespace detail
+{
+// frame kinds of the shared memory payload protocol
+enum class shm_kind : unsigned char
+{
+    inline_payload = 'I', // [I][payload]
+    shared = 'S',         // [S][8 byte id][8 byte size][segment name]
+    release = 'R'         // receiver -> sender: [R][8 byte id]
+};
+
+inline message_t shm_kind_message(shm_kind kind)
+{
+    const unsigned char c = static_cast<unsigned char>(kind);
+    return message_t(&c, 1);
+}
+
+inline bool is_shm_kind(const message_t &msg, shm_kind kind) noexcept
+{
+    return msg.size() == 1
+           && *msg.data<unsigned char>() == static_cast<unsigned char>(kind);
+}
+
+// pending release notifications, shared with the free_fn of mapped payloads
+struct shm_release_queue
+{
+    std::mutex mutex;
+    std::vector<uint64_t> ids;
+};
+
+struct shm_mapping
+{
+    std::shared_ptr<shm_release_queue> releases;
+    void *addr;
+    size_t size;
+    uint64_t id;
+};
+
+// Segments of a shm_sender_t are named /zmq-shm-<pid>-<instance>-<id>.
+inline const char *shm_name_prefix() noexcept
+{
+    return "/zmq-shm-";
+}
+
+inline bool is_shm_segment_name(const std::string &name) noexcept
+{
+    const size_t prefix_size = strlen(shm_name_prefix());
+    if (name.compare(0, prefix_size, shm_name_prefix()) != 0)
+        return false;
+    int numbers = 0;
+    bool digits = false;
+    for (size_t i = prefix_size; i < name.size(); ++i) {
+        if (name[i] >= '0' && name[i] <= '9') {
+            digits = true;
+        } else if (name[i] == '-' && digits) {
+            ++numbers;
+            digits = false;
+        } else {
+            return false;
+        }
+    }
+    return digits && numbers == 2;
+}
+
+inline void shm_mapping_free(void *, void *hint) noexcept
+{
+    std::unique_ptr<shm_mapping> mapping(static_cast<shm_mapping *>(hint));
+    munmap(mapping->addr, mapping->size);
+    std::lock_guard<std::mutex> lock(mapping->releases->mutex);
+    mapping->releases->ids.push_back(mapping->id);
+}
+} // namespace detail
+
+/*  Sending side of a same-host transfer of large payloads through shared
+    memory, for bidirectional point to point sockets (PAIR, DEALER to
+    DEALER) connected to a shm_receiver_t.
+
+    Payloads of at least inline_threshold bytes are placed in a POSIX
+    shared memory segment and only a small descriptor is sent, the
+    receiver maps the segment without copying. Each receiver sends a
+    release message once the received message_t is destroyed, released
+    segments are kept in a small pool for reuse. Smaller payloads are
+    sent inline.
+
+    allocate() hands out a segment to be filled in place, avoiding the
+    single copy made by send(const_buffer).
+*/
+class shm_sender_t
+{
+  public:
+    struct block
+    {
+        uint64_t id;
+        void *data;
+        size_t size;
+    };
+
+    explicit shm_sender_t(socket_ref socket,
+                          size_t inline_threshold = 64 * 1024,
+                          size_t max_pooled = 4) :
+        _socket(socket), _inline_threshold(inline_threshold), _max_pooled(max_pooled)
+    {
+        static std::atomic<uint64_t> instances{0};
+        std::ostringstream prefix;
+        prefix << detail::shm_name_prefix() << getpid() << '-'
+               << instances.fetch_add(1) << '-';
+        _prefix = prefix.str();
+    }
+
+    ~shm_sender_t()
+    {
+        for (auto &s : _segments)
+            destroy(s.second);
+    }
+
+    shm_sender_t(const shm_sender_t &) = delete;
+    shm_sender_t &operator=(const shm_sender_t &) = delete;
+
+    /*  A writable shared memory block of size bytes, to be sent with
+        send(const block &). A pooled segment is reused if large enough.
+
+        Throws: error_t if the segment can not be created.
+    */
+    block allocate(size_t size)
+    {
+        process_releases();
+        for (auto it = _pool.begin(); it != _pool.end(); ++it) {
+            segment &s = _segments[*it];
+            if (s.capacity >= size) {
+                _pool.erase(it);
+                return block{s.id, s.addr, size};
+            }
+        }
+        segment s;
+        s.id = ++_last_id;
+        s.name = _prefix + std::to_string(s.id);
+        s.capacity = (std::max)(size, size_t(1));
+        s.in_flight = false;
+        const int fd = shm_open(s.name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd == -1)
+            throw error_t();
+        if (ftruncate(fd, static_cast<off_t>(s.capacity)) != 0) {
+            const error_t err;
+            ::close(fd);
+            shm_unlink(s.name.c_str());
+            throw err;
+        }
+        s.addr =
+          mmap(nullptr, s.capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (s.addr == MAP_FAILED) {
+            const error_t err;
+            shm_unlink(s.name.c_str());
+            throw err;
+        }
+        _segments[s.id] = s;
+        return block{s.id, s.addr, size};
+    }
+
+    /*  Send the descriptor of an allocated block, its segment is reused
+        once the receiver released it.
+
+        Returns: the size of the block or nullopt (on EAGAIN), in which
+        case the block remains allocated.
+    */
+    send_result_t send(const block &b, send_flags flags = send_flags::none)
+    {
+        segment &s = _segments.at(b.id);
+        flags = flags & ~send_flags::sndmore;
+        message_t descriptor(2 * sizeof(uint64_t) + s.name.size());
+        unsigned char *data = descriptor.data<unsigned char>();
+        detail::put_uint64(data, b.id);
+        detail::put_uint64(data + sizeof(uint64_t), b.size);
+        memcpy(data + 2 * sizeof(uint64_t), s.name.data(), s.name.size());
+        if (!_socket.send(detail::shm_kind_message(detail::shm_kind::shared),
+                          flags | send_flags::sndmore))
+            return {};
+        _socket.send(descriptor, flags);
+        if (!s.in_flight) {
+            s.in_flight = true;
+            ++_in_flight;
+        }
+        return b.size;
+    }
+
+    /*  Send payload, through shared memory if it is at least
+        inline_threshold bytes large.
+
+        Returns: the size of payload or nullopt (on EAGAIN).
+    */
+    send_result_t send(const_buffer payload, send_flags flags = send_flags::none)
+    {
+        flags = flags & ~send_flags::sndmore;
+        if (payload.size() < _inline_threshold) {
+            const auto kind = detail::shm_kind::inline_payload;
+            if (!_socket.send(detail::shm_kind_message(kind),
+                              flags | send_flags::sndmore))
+                return {};
+            _socket.send(payload, flags);
+            return payload.size();
+        }
+        const block b = allocate(payload.size());
+        memcpy(b.data, payload.data(), payload.size());
+        const auto ret = send(b, flags);
+        if (!ret)
+            recycle(b.id);
+        return ret;
+    }
+
+    /*  Handle the release messages received so far. Releases of segments
+        not in flight, duplicates or strays, are ignored.
+
+        Returns: the number of released blocks.
+    */
+    size_t process_releases()
+    {
+        size_t released = 0;
+        std::vector<message_t> msgs;
+        while (recv_multipart(_socket, std::back_inserter(msgs),
+                              recv_flags::dontwait)) {
+            if (msgs.size() == 2
+                && detail::is_shm_kind(msgs[0], detail::shm_kind::release)
+                && msgs[1].size() == sizeof(uint64_t)) {
+                const auto it = _segments.find(detail::message_uint64(msgs[1]));
+                if (it != _segments.end() && it->second.in_flight) {
+                    it->second.in_flight = false;
+                    --_in_flight;
+                    ++released;
+                    recycle(it->first);
+                }
+            }
+            msgs.clear();
+        }
+        return released;
+    }
+
+    // Number of blocks sent and not yet released.
+    size_t in_flight() const noexcept { return _in_flight; }
+
+    size_t inline_threshold() const noexcept { return _inline_threshold; }
+
+  private:
+    struct segment
+    {
+        uint64_t id;
+        std::string name;
+        void *addr;
+        size_t capacity;
+        bool in_flight;
+    };
+
+    static void destroy(segment &s) noexcept
+    {
+        munmap(s.addr, s.capacity);
+        shm_unlink(s.name.c_str());
+    }
+
+    // Pool the segment of a block no longer used, or destroy it if the
+    // pool is full.
+    void recycle(uint64_t id)
+    {
+        if (_pool.size() < _max_pooled) {
+            _pool.push_back(id);
+            return;
+        }
+        const auto it = _segments.find(id);
+        destroy(it->second);
+        _segments.erase(it);
+    }
+
+    socket_ref _socket;
+    size_t _inline_threshold;
+    size_t _max_pooled;
+    std::string _prefix;
+    uint64_t _last_id{0};
+    size_t _in_flight{0};
+    std::unordered_map<uint64_t, segment> _segments;
+    std::vector<uint64_t> _pool;
+};
+
+/*  Receiving side of a shm_sender_t.
+
+    Shared payloads are mapped copy-on-write into zero-copy message_t
+    objects; destroying such a message (on any thread) queues a release
+    which is sent to the sender by the next recv() or flush_releases().
+    Descriptors naming no segment of a shm_sender_t, or a payload larger
+    than its segment, are discarded like other malformed messages.
+*/
+class shm_receiver_t
+{
+  public:
+    explicit shm_receiver_t(socket_ref socket) :
+        _socket(socket), _releases(std::make_shared<detail::shm_release_queue>())
+    {
+    }
+
+    shm_receiver_t(const shm_receiver_t &) = delete;
+    shm_receiver_t &operator=(const shm_receiver_t &) = delete;
+
+    /*  Receive the next payload into msg.
+
+        Returns: the size of the payload or nullopt (on EAGAIN).
+        Throws: error_t if a shared segment can not be mapped.
+    */
+    recv_result_t recv(message_t &msg, recv_flags flags = recv_flags::none)
+    {
+        flush_releases();
+        std::vector<message_t> msgs;
+        while (true) {
+            msgs.clear();
+            if (!recv_multipart(_socket, std::back_inserter(msgs), flags))
+                return {};
+            if (msgs.size() != 2)
+                continue;
+            if (detail::is_shm_kind(msgs[0], detail::shm_kind::inline_payload)) {
+                msg = std::move(msgs[1]);
+                return msg.size();
+            }
+            if (detail::is_shm_kind(msgs[0], detail::shm_kind::shared)
+                && msgs[1].size() > 2 * sizeof(uint64_t) && map(msgs[1], msg))
+                return msg.size();
+        }
+    }
+
+    /*  Send the releases of destroyed shared payloads to the sender.
+
+        Returns: the number of releases sent.
+    */
+    size_t flush_releases()
+    {
+        std::vector<uint64_t> ids;
+        {
+            std::lock_guard<std::mutex> lock(_releases->mutex);
+            ids.swap(_releases->ids);
+        }
+        for (uint64_t id : ids) {
+            _socket.send(detail::shm_kind_message(detail::shm_kind::release),
+                         send_flags::sndmore);
+            _socket.send(detail::uint64_message(id), send_flags::none);
+        }
+        return ids.size();
+    }
+
+  private:
+    // Returns false if the descriptor is invalid.
+    bool map(const message_t &descriptor, message_t &msg)
+    {
+        const unsigned char *data = descriptor.data<unsigned char>();
+        const uint64_t id = detail::get_uint64(data);
+        const uint64_t size = detail::get_uint64(data + 8);
+        const std::string name(reinterpret_cast<const char *>(data + 16),
+                               descriptor.size() - 16);
+        if (!detail::is_shm_segment_name(name))
+            return false;
+        if (size == 0) {
+            // nothing to map, release right away
+            std::lock_guard<std::mutex> lock(_releases->mutex);
+            _releases->ids.push_back(id);
+            msg.rebuild();
+            return true;
+        }
+
+        const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd == -1)
+            throw error_t();
+        // mapping beyond the end of the segment would fault on access
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            const error_t err;
+            ::close(fd);
+            throw err;
+        }
+        if (size > static_cast<uint64_t>(st.st_size)) {
+            ::close(fd);
+            return false;
+        }
+        // private mapping, writes by the application stay local
+        void *addr = mmap(nullptr, static_cast<size_t>(size),
+                          PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED)
+            throw error_t();
+
+        std::unique_ptr<detail::shm_mapping> mapping(
+          new detail::shm_mapping{_releases, addr, static_cast<size_t>(size), id});
+        msg.rebuild(addr, static_cast<size_t>(size), detail::shm_mapping_free,
+                    mapping.get());
+        mapping.release();
+        return true;
+    }
+
+    socket_ref _socket;
+    std::shared_ptr<detail::shm_release_queue> _releases;
+};
+
+#endif // defined(ZMQ_CPP11) && !defined(_WIN32)
+
+#if defined(ZMQ_CPP11) && !defined(_WIN32)
+
+namespace detail
+{
+struct file_mapping
+{
+    void *addr;
+    size_t length;
+};
+
+inline void file_mapping_free(void *, void *hint) noexcept
+{
+    std::unique_ptr<file_mapping> mapping(static_cast<file_mapping *>(hint));
+    munmap(mapping->addr, mapping->length);
+}
+
+// Map size bytes of fd at offset into a zero-copy message.
+inline message_t map_file_range(int fd, uint64_t offset, size_t size)
+{
+    if (size == 0)
+        return message_t();
+    // mmap offsets must be page aligned
+    static const uint64_t page_size = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    const uint64_t aligned = offset - offset % page_size;
+    const size_t delta = static_cast<size_t>(offset - aligned);
+    // private mapping, writes through message_t::data() stay local
+    void *addr = mmap(nullptr, size + delta, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                      fd, static_cast<off_t>(aligned));
+    if (addr == MAP_FAILED)
+        throw error_t();
+    std::unique_ptr<file_mapping> mapping(new file_mapping{addr, size + delta});
+    message_t msg(static_cast<char *>(addr) + delta, size, file_mapping_free,
+                  mapping.get());
+    mapping.release();
+    return msg;
+}
+
+class file_descriptor
+{
+  public:
+    explicit file_descriptor(const char *path) : _fd(::open(path, O_RDONLY))
+    {
+        if (_fd == -1)
+            throw error_t();
+        struct stat st;
+        if (fstat(_fd, &st) == -1) {
+            const error_t err;
+            ::close(_fd);
+            throw err;
+        }
+        _size = static_cast<uint64_t>(st.st_size);
+    }
+
+    ~file_descriptor() { ::close(_fd); }
+
+    file_descriptor(const file_descriptor &) = delete;
+    file_descriptor &operator=(const file_descriptor &) = delete;
+
+    int get() const noexcept { return _fd; }
+    uint64_t size() const noexcept { return _size; }
+
+  private:
+    int _fd;
+    uint64_t _size;
+};
+} // namespace detail
+
+/*  Create a message referring to a memory mapped range of a file.
+
+    The range starting at offset is mapped copy-on-write and unmapped
+    when libzmq releases the message, so sending it copies nothing into
+    the heap. size is clamped to the end of the file.
+    Throws: error_t if the file can not be opened or mapped,
+            std::out_of_range if offset is past the end of the file.
+*/
+inline message_t file_message(const char *path,
+                              uint64_t offset = 0,
+                              size_t size = static_cast<size_t>(-1))
+{
+    detail::file_descriptor file(path);
+    if (offset > file.size())
+        throw std::out_of_range("file offset past the end of the file");
+    const uint64_t available = file.size() - offset;
+    if (size > available)
+        size = static_cast<size_t>(available);
+    return detail::map_file_range(file.get(), offset, size);
+}
+
+inline message_t file_message(const std::string &path,
+                              uint64_t offset = 0,
+                              size_t size = static_cast<size_t>(-1))
+{
+    return file_message(path.c_str(), offset, size);
+}
+
+/*  Streams a file as a single multipart message of memory mapped chunks.
+
+    Each chunk is mapped on its own just before it is sent and unmapped
+    once libzmq is done with it, so the file is never read into the
+    heap and the mapped part of it is bounded by chunk_size times the
+    number of chunks libzmq holds. An empty file is sent as one empty
+    part.
+*/
+class file_streamer_t
+{
+  public:
+    explicit file_streamer_t(const char *path, size_t chunk_size = 1024 * 1024) :
+        _file(path), _chunk_size(chunk_size)
+    {
+        if (chunk_size == 0)
+            throw std::invalid_argument("chunk_size must not be zero");
+    }
+
+    explicit file_streamer_t(const std::string &path,
+                             size_t chunk_size = 1024 * 1024) :
+        file_streamer_t(path.c_str(), chunk_size)
+    {
+    }
+
+    file_streamer_t(const file_streamer_t &) = delete;
+    file_streamer_t &operator=(const file_streamer_t &) = delete;
+
+    /*  Send the remaining chunks to socket.
+
+        With send_flags::dontwait a send may stop at a full queue,
+        calling send() again resumes with the chunk that was not sent.
+        Returns: the number of parts sent by this call
+                 or nullopt (on EAGAIN before any part was sent).
+    */
+    send_result_t send(socket_ref socket, send_flags flags = send_flags::none)
+    {
+        flags = flags & ~send_flags::sndmore;
+        size_t count = 0;
+        while (!done()) {
+            const uint64_t remaining = _file.size() - _offset;
+            const size_t size = remaining < _chunk_size
+                                  ? static_cast<size_t>(remaining)
+                                  : _chunk_size;
+            const bool last = _offset + size == _file.size();
+            if (!_pending)
+                _pending.reset(
+                  new message_t(detail::map_file_range(_file.get(), _offset, size)));
+            if (!socket.send(*_pending, last ? flags : flags | send_flags::sndmore))
+                return count == 0 ? send_result_t{} : send_result_t{count};
+            _pending.reset();
+            _offset += size;
+            _started = true;
+            ++count;
+        }
+        return count;
+    }
+
+    // True once the last part was sent.
+    bool done() const noexcept
+    {
+        return _started && _offset == _file.size();
+    }
+
+    uint64_t file_size() const noexcept { return _file.size(); }
+    uint64_t bytes_sent() const noexcept { return _offset; }
+    size_t chunk_size() const noexcept { return _chunk_size; }
+
+  private:
+    detail::file_descriptor _file;
+    size_t _chunk_size;
+    uint64_t _offset{0};
+    bool _started{false};
+    // chunk mapped but not sent yet because of EAGAIN
+    std::unique_ptr<message_t> _pending;
+};
+
+/*  Send a file as a multipart message of memory mapped chunks.
+
+    Returns: the number of parts sent or nullopt (on EAGAIN, e.g. after
+    ZMQ_SNDTIMEO expired), in which case no part was sent.
+    Throws: error_t if the file can not be opened or mapped.
+*/
+inline send_result_t send_file(socket_ref socket,
+                               const char *path,
+                               size_t chunk_size = 1024 * 1024)
+{
+    file_streamer_t streamer(path, chunk_size);
+    return streamer.send(socket);
+}
+
+#endif // defined(ZMQ_CPP11) && !defined(_WIN32)
+
+#if defined(ZMQ_CPP11) && !defined(_WIN32)
+
+namespace detail
+{
+/*  Memory mapped segment file of a spill_queue_t.
+
+    Layout: [8 byte magic][8 byte read offset][8 byte write offset][records]
+    Each record is one message part: [8 byte size << 1 | more][data],
+    padded to 8 bytes. The write offset is only advanced once all parts
+    of a message were written, so a torn append is never read back.
+*/
+class spill_segment
+{
+  public:
+    static constexpr size_t header_size = 24;
+
+    // Create a new segment file of capacity bytes.
+    spill_segment(std::string path, size_t capacity) : _path(std::move(path))
+    {
+        const int fd = ::open(_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd == -1)
+            throw error_t();
+        if (ftruncate(fd, static_cast<off_t>(capacity)) == -1) {
+            const error_t err;
+            ::close(fd);
+            throw err;
+        }
+        map(fd, capacity);
+        std::memcpy(_addr, magic(), 8);
+        reset();
+    }
+
+    // Open an existing segment file.
+    explicit spill_segment(std::string path) : _path(std::move(path))
+    {
+        const int fd = ::open(_path.c_str(), O_RDWR);
+        if (fd == -1)
+            throw error_t();
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            const error_t err;
+            ::close(fd);
+            throw err;
+        }
+        if (static_cast<size_t>(st.st_size) < header_size) {
+            ::close(fd);
+            throw std::runtime_error("spill segment is truncated: " + _path);
+        }
+        map(fd, static_cast<size_t>(st.st_size));
+        if (std::memcmp(_addr, magic(), 8) != 0 || read_offset() < header_size
+            || read_offset() > write_offset() || write_offset() > _capacity) {
+            munmap(_addr, _capacity);
+            throw std::runtime_error("spill segment is corrupt: " + _path);
+        }
+    }
+
+    ~spill_segment() { munmap(_addr, _capacity); }
+
+    spill_segment(const spill_segment &) = delete;
+    spill_segment &operator=(const spill_segment &) = delete;
+
+    static size_t record_size(size_t size) noexcept
+    {
+        return 8 + ((size + 7) & ~size_t{7});
+    }
+
+    // Write a record at pos and advance pos past it.
+    void put(uint64_t &pos, const void *data, size_t size, bool more) noexcept
+    {
+        const uint64_t head = static_cast<uint64_t>(size) << 1 | (more ? 1 : 0);
+        std::memcpy(_addr + pos, &head, 8);
+        if (size > 0)
+            std::memcpy(_addr + pos + 8, data, size);
+        pos += record_size(size);
+    }
+
+    // Read the record at pos and advance pos past it.
+    void get(uint64_t &pos, const char *&data, size_t &size, bool &more) const
+    {
+        uint64_t head;
+        if (pos + 8 > write_offset())
+            throw std::runtime_error("spill segment is corrupt: " + _path);
+        std::memcpy(&head, _addr + pos, 8);
+        size = static_cast<size_t>(head >> 1);
+        more = (head & 1) != 0;
+        if (size > write_offset() - pos - 8)
+            throw std::runtime_error("spill segment is corrupt: " + _path);
+        data = _addr + pos + 8;
+        pos += record_size(size);
+    }
+
+    uint64_t read_offset() const noexcept { return offset(1); }
+    uint64_t write_offset() const noexcept { return offset(2); }
+    void set_read_offset(uint64_t pos) noexcept { set_offset(1, pos); }
+    void set_write_offset(uint64_t pos) noexcept { set_offset(2, pos); }
+
+    bool empty() const noexcept { return read_offset() == write_offset(); }
+    size_t room() const noexcept
+    {
+        return _capacity - static_cast<size_t>(write_offset());
+    }
+    size_t capacity() const noexcept { return _capacity; }
+
+    void reset() noexcept
+    {
+        set_read_offset(header_size);
+        set_write_offset(header_size);
+    }
+
+    void sync()
+    {
+        if (msync(_addr, _capacity, MS_SYNC) == -1)
+            throw error_t();
+    }
+
+    void remove() noexcept { ::unlink(_path.c_str()); }
+
+  private:
+    static const char *magic() noexcept { return "ZMQSPIL1"; }
+
+    void map(int fd, size_t capacity)
+    {
+        void *addr =
+          mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        const error_t err;
+        ::close(fd);
+        if (addr == MAP_FAILED)
+            throw err;
+        _addr = static_cast<char *>(addr);
+        _capacity = capacity;
+    }
+
+    uint64_t offset(size_t index) const noexcept
+    {
+        uint64_t pos;
+        std::memcpy(&pos, _addr + 8 * index, 8);
+        return pos;
+    }
+
+    void set_offset(size_t index, uint64_t pos) noexcept
+    {
+        std::memcpy(_addr + 8 * index, &pos, 8);
+    }
+
+    std::string _path;
+    char *_addr;
+    size_t _capacity;
+};
+} // namespace detail
+
+/*  Send queue that spills to disk instead of blocking or dropping when
+    a socket reaches its send high water mark, for PUSH and DEALER
+    sockets with slow peers.
+
+    Messages are sent with send_flags::dontwait. A message that hits
+    EAGAIN is appended to a segmented, memory mapped log in directory,
+    and so is every later message until the log is drained, so the order
+    of messages is preserved. flush() moves spilled messages back into
+    the socket while it accepts them; call it when the socket polls
+    ZMQ_POLLOUT, or use drain(). While nothing is spilled a send costs a
+    single non-blocking socket send.
+
+    Segments are segment_size bytes (larger if a single message needs
+    it) and are deleted once drained. Spilled messages left on
+    destruction stay on disk and are picked up by the next spill_queue_t
+    opened on the same directory. A message may be delivered twice if
+    the process dies between sending it and recording the send.
+*/
+class spill_queue_t
+{
+  public:
+    explicit spill_queue_t(socket_ref socket,
+                           std::string directory,
+                           size_t segment_size = 64 * 1024 * 1024) :
+        _socket(socket),
+        _directory(std::move(directory)),
+        _segment_size(segment_size)
+    {
+        recover();
+    }
+
+    ~spill_queue_t()
+    {
+        if (_pending == 0) {
+            for (auto &segment : _segments)
+                segment->remove();
+        }
+    }
+
+    spill_queue_t(const spill_queue_t &) = delete;
+    spill_queue_t &operator=(const spill_queue_t &) = delete;
+
+    /*  Send msg, or append it to the log if the socket would block
+        or earlier messages are still spilled.
+
+        Returns: true if msg was handed to the socket, false if it was
+        spilled, in which case msg is left unchanged.
+    */
+    bool send(message_t &msg) { return send_parts(&msg, &msg + 1); }
+
+    bool send(const_buffer buf) { return send_parts(&buf, &buf + 1); }
+
+    /*  Send a multipart message, or append it to the log as a whole.
+
+        The range must be a ForwardRange of zmq::message_t,
+        zmq::const_buffer or zmq::mutable_buffer.
+        Returns: true if the parts were handed to the socket,
+        false if they were spilled.
+    */
+    template<class Range
+#ifndef ZMQ_CPP11_PARTIAL
+             ,
+             typename = typename std::enable_if<
+               detail::is_range<Range>::value
+               && (std::is_same<detail::range_value_t<Range>, message_t>::value
+                   || detail::is_buffer<detail::range_value_t<Range>>::value)>::type
+#endif
+             >
+    bool send_multipart(Range &&msgs)
+    {
+        return send_parts(detail::ranges::begin(msgs), detail::ranges::end(msgs));
+    }
+
+    /*  Send spilled messages while the socket accepts them without blocking.
+
+        Returns: the number of messages sent.
+    */
+    size_t flush()
+    {
+        size_t count = 0;
+        while (_pending > 0) {
+            detail::spill_segment &segment = *_segments.front();
+            if (segment.empty()) {
+                segment.remove();
+                _segments.pop_front();
+                continue;
+            }
+            // parts stay staged across calls while the socket is full
+            if (_staged.empty())
+                stage(segment);
+            if (!zmq::send_multipart(_socket, _staged, send_flags::dontwait))
+                break;
+            _staged.clear();
+            segment.set_read_offset(_staged_end);
+            _pending_bytes -= _staged_bytes;
+            --_pending;
+            ++count;
+            if (segment.empty() && _segments.size() == 1)
+                segment.reset();
+        }
+        return count;
+    }
+
+    /*  Wait up to timeout (-1 waits forever) for all spilled messages
+        to be sent.
+
+        Returns: true if nothing is left spilled.
+    */
+    bool drain(std::chrono::milliseconds timeout = std::chrono::milliseconds{-1})
+    {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        flush();
+        while (_pending > 0) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+              deadline - std::chrono::steady_clock::now());
+            if (timeout.count() < 0)
+                remaining = timeout;
+            else if (remaining.count() <= 0)
+                return false;
+            zmq::pollitem_t items[] = {{_socket.handle(), 0, ZMQ_POLLOUT, 0}};
+            if (poll(items, 1, remaining) == 0)
+                return false;
+            flush();
+        }
+        return true;
+    }
+
+    // Flush the spilled messages to stable storage.
+    void sync()
+    {
+        for (auto &segment : _segments)
+            segment->sync();
+    }
+
+    bool empty() const noexcept { return _pending == 0; }
+    // Number of spilled messages.
+    size_t pending() const noexcept { return _pending; }
+    // Payload bytes of the spilled messages.
+    uint64_t pending_bytes() const noexcept { return _pending_bytes; }
+    size_t segments() const noexcept { return _segments.size(); }
+    const std::string &directory() const noexcept { return _directory; }
+
+  private:
+    template<class It> bool send_parts(It first, It last)
+    {
+        if (first == last)
+            return true;
+        if (_pending > 0)
+            flush();
+        if (_pending == 0 && send_direct(first, last))
+            return true;
+        spill(first, last);
+        return false;
+    }
+
+    template<class It> bool send_direct(It first, It last)
+    {
+        auto it = first;
+        while (it != last) {
+            const auto next = std::next(it);
+            const auto flags = send_flags::dontwait
+                               | (next == last ? send_flags::none
+                                               : send_flags::sndmore);
+            if (!_socket.send(*it, flags)) {
+                // zmq ensures atomic delivery of messages
+                assert(it == first);
+                return false;
+            }
+            it = next;
+        }
+        return true;
+    }
+
+    template<class It> void spill(It first, It last)
+    {
+        size_t size = 0;
+        uint64_t bytes = 0;
+        for (auto it = first; it != last; ++it) {
+            size += detail::spill_segment::record_size(it->size());
+            bytes += it->size();
+        }
+        if (_segments.empty() || _segments.back()->room() < size)
+            add_segment((std::max)(_segment_size,
+                                   detail::spill_segment::header_size + size));
+        detail::spill_segment &segment = *_segments.back();
+        uint64_t pos = segment.write_offset();
+        for (auto it = first; it != last;) {
+            const auto next = std::next(it);
+            segment.put(pos, it->data(), it->size(), next != last);
+            it = next;
+        }
+        segment.set_write_offset(pos);
+        _pending_bytes += bytes;
+        ++_pending;
+    }
+
+    void stage(const detail::spill_segment &segment)
+    {
+        uint64_t pos = segment.read_offset();
+        _staged_bytes = 0;
+        bool more = true;
+        while (more) {
+            const char *data;
+            size_t size;
+            segment.get(pos, data, size, more);
+            _staged.emplace_back(data, size);
+            _staged_bytes += size;
+        }
+        _staged_end = pos;
+    }
+
+    void add_segment(size_t capacity)
+    {
+        std::ostringstream path;
+        path << _directory << "/spill-" << std::setw(20) << std::setfill('0')
+             << _next_sequence++ << ".log";
+        _segments.emplace_back(new detail::spill_segment(path.str(), capacity));
+    }
+
+    // spill-<20 digit sequence>.log, other names in the directory are skipped
+    static bool parse_segment_name(const std::string &name, uint64_t &sequence)
+    {
+        if (name.size() != 30 || name.compare(0, 6, "spill-") != 0
+            || name.compare(26, 4, ".log") != 0)
+            return false;
+        sequence = 0;
+        for (size_t i = 6; i < 26; ++i) {
+            if (name[i] < '0' || name[i] > '9')
+                return false;
+            const uint64_t digit = static_cast<uint64_t>(name[i] - '0');
+            if (sequence > ((std::numeric_limits<uint64_t>::max)() - digit) / 10)
+                return false;
+            sequence = sequence * 10 + digit;
+        }
+        return true;
+    }
+
+    // Open the segments left in directory by an earlier spill_queue_t.
+    void recover()
+    {
+        if (mkdir(_directory.c_str(), 0700) == -1 && errno != EEXIST)
+            throw error_t();
+        DIR *dir = opendir(_directory.c_str());
+        if (!dir)
+            throw error_t();
+        std::vector<uint64_t> sequences;
+        while (const dirent *entry = readdir(dir)) {
+            uint64_t sequence;
+            if (parse_segment_name(entry->d_name, sequence))
+                sequences.push_back(sequence);
+        }
+        closedir(dir);
+        std::sort(sequences.begin(), sequences.end());
+        for (const uint64_t sequence : sequences) {
+            std::ostringstream path;
+            path << _directory << "/spill-" << std::setw(20) << std::setfill('0')
+                 << sequence << ".log";
+            _segments.emplace_back(new detail::spill_segment(path.str()));
+            const detail::spill_segment &segment = *_segments.back();
+            uint64_t pos = segment.read_offset();
+            while (pos < segment.write_offset()) {
+                const char *data;
+                size_t size;
+                bool more;
+                segment.get(pos, data, size, more);
+                _pending_bytes += size;
+                if (!more)
+                    ++_pending;
+            }
+            _next_sequence = sequence + 1;
+        }
+    }
+
+    socket_ref _socket;
+    std::string _directory;
+    size_t _segment_size;
+    std::deque<std::unique_ptr<detail::spill_segment>> _segments;
+    uint64_t _next_sequence{0};
+    size_t _pending{0};
+    uint64_t _pending_bytes{0};
+    // parts of the oldest spilled message, copied out of the log
+    std::vector<message_t> _staged;
+    uint64_t _staged_end{0};
+    uint64_t _staged_bytes{0};
+};
+
+#endif // defined(ZMQ_CPP11) && !defined(_WIN32)
+
+#if defined(ZMQ_CPP11) && defined(__linux__) && defined(ZMQ_THREAD_AFFINITY_CPU_ADD)
+
+namespace detail
+{
+// Parse a sysfs cpu list such as "0-3,8-11".
+inline std::vector<int> parse_cpu_list(const std::string &list)
+{
+    std::vector<int> cpus;
+    std::istringstream in(list);
+    std::string range;
+    while (std::getline(in, range, ',')) {
+        if (range.empty())
+            continue;
+        const size_t dash = range.find('-');
+        const int first = std::stoi(range.substr(0, dash));
+        const int last =
+          dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        if (first < 0 || last < first)
+            throw std::invalid_argument("invalid cpu list: " + list);
+        for (int cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+// First line of a sysfs file, empty if it can not be read.
+inline std::string read_sysfs_line(const std::string &path)
+{
+    std::ifstream in(path);
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
+
+inline std::string format_cpu_list(const std::vector<int> &cpus)
+{
+    std::ostringstream out;
+    for (size_t i = 0; i < cpus.size();) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+            ++j;
+        if (i > 0)
+            out << ',';
+        out << cpus[i];
+        if (j > i)
+            out << '-' << cpus[j];
+        i = j + 1;
+    }
+    return out.str();
+}
+} // namespace detail
+
+struct numa_node_t
+{
+    int id;
+    std::vector<int> cpus;
+};
+
+/*  CPU and NUMA node topology read from sysfs.
+
+    Kernels without NUMA support report all online CPUs as node 0.
+    Throws: std::runtime_error if no CPU is found below sysfs_root.
+*/
+class cpu_topology_t
+{
+  public:
+    explicit cpu_topology_t(const std::string &sysfs_root = "/sys/devices/system")
+    {
+        const std::string nodes = detail::read_sysfs_line(sysfs_root + "/node/online");
+        if (!nodes.empty()) {
+            for (const int id : detail::parse_cpu_list(nodes)) {
+                auto cpus = detail::parse_cpu_list(detail::read_sysfs_line(
+                  sysfs_root + "/node/node" + std::to_string(id) + "/cpulist"));
+                // memory only nodes have no CPUs to pin threads to
+                if (!cpus.empty())
+                    _nodes.push_back(numa_node_t{id, std::move(cpus)});
+            }
+        }
+        if (_nodes.empty()) {
+            auto cpus = detail::parse_cpu_list(
+              detail::read_sysfs_line(sysfs_root + "/cpu/online"));
+            if (cpus.empty())
+                throw std::runtime_error("no online cpus found in " + sysfs_root);
+            _nodes.push_back(numa_node_t{0, std::move(cpus)});
+        }
+    }
+
+    const std::vector<numa_node_t> &nodes() const noexcept { return _nodes; }
+
+    // Throws: std::out_of_range if there is no node id with CPUs.
+    const numa_node_t &node(int id) const
+    {
+        for (const auto &node : _nodes)
+            if (node.id == id)
+                return node;
+        throw std::out_of_range("unknown numa node " + std::to_string(id));
+    }
+
+    // Returns: the node of cpu or -1 if cpu is unknown.
+    int node_of_cpu(int cpu) const noexcept
+    {
+        for (const auto &node : _nodes)
+            if (std::find(node.cpus.begin(), node.cpus.end(), cpu) != node.cpus.end())
+                return node.id;
+        return -1;
+    }
+
+  private:
+    std::vector<numa_node_t> _nodes;
+};
+
+/*  A context whose I/O threads are pinned to the cores of one NUMA node.
+
+    The cores are those of the node the calling process may run on
+    (see sched_setaffinity), so the context honours taskset and cpusets.
+    place() spreads sockets round robin over the I/O threads through
+    sockopt::affinity and records the placement for report(). Sockets
+    must be placed before they bind or connect. Scheduling policy and
+    priority can be set on context() before the first socket is created.
+
+    Throws: std::out_of_range if the node is unknown,
+            std::runtime_error if the process may not run on any core of
+            the node, std::invalid_argument if io_threads is not in
+            [1, 64].
+*/
+class numa_context_t
+{
+  public:
+    struct placement
+    {
+        std::string name;
+        int io_thread;
+    };
+
+    numa_context_t(const cpu_topology_t &topology, int node, int io_threads = 1) :
+        _node(node), _io_threads(io_threads)
+    {
+        // sockopt::affinity is a 64 bit mask of I/O threads
+        if (io_threads < 1 || io_threads > 64)
+            throw std::invalid_argument("io_threads must be in [1, 64]");
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1)
+            throw error_t();
+        for (const int cpu : topology.node(node).cpus)
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+                _cpus.push_back(cpu);
+        if (_cpus.empty())
+            throw std::runtime_error("no usable cpu on numa node "
+                                     + std::to_string(node));
+        _context.set(ctxopt::io_threads, io_threads);
+        for (const int cpu : _cpus)
+            _context.set(ctxopt::thread_affinity_cpu_add, cpu);
+    }
+
+    numa_context_t(const numa_context_t &) = delete;
+    numa_context_t &operator=(const numa_context_t &) = delete;
+
+    /*  Assign socket to the next I/O thread of the context.
+
+        Returns: the index of the I/O thread handling the socket.
+    */
+    int place(socket_ref socket, std::string name = std::string())
+    {
+        const int io_thread = _next++ % _io_threads;
+        socket.set(sockopt::affinity, uint64_t{1} << io_thread);
+        if (name.empty())
+            name = "socket " + std::to_string(_placements.size());
+        _placements.push_back(placement{std::move(name), io_thread});
+        return io_thread;
+    }
+
+    // One line for the context, one line per placed socket.
+    std::string report() const
+    {
+        std::ostringstream out;
+        out << "numa node " << _node << ": cpus " << detail::format_cpu_list(_cpus)
+            << ", " << _io_threads << " io threads\n";
+        for (const auto &p : _placements)
+            out << "  " << p.name << " -> io thread " << p.io_thread << '\n';
+        return out.str();
+    }
+
+    context_t &context() noexcept { return _context; }
+    operator context_t &() noexcept { return _context; }
+
+    int node() const noexcept { return _node; }
+    int io_threads() const noexcept { return _io_threads; }
+    const std::vector<int> &cpus() const noexcept { return _cpus; }
+    const std::vector<placement> &placements() const noexcept
+    {
+        return _placements;
+    }
+
+  private:
+    context_t _context;
+    int _node;
+    int _io_threads;
+    int _next{0};
+    std::vector<int> _cpus;
+    std::vector<placement> _placements;
+};
+
+#endif // defined(ZMQ_CPP11) && defined(__linux__) && defined(ZMQ_THREAD_AFFINITY_CPU_ADD)
+
+#ifdef ZMQ_CPP11
+
+namespace detail
+{
+// Range check of integral option values known to libzmq, usable in
+// constant expressions from C++14 on.
+// Returns: false if value is out of range for option.
+#ifdef ZMQ_CPP14
+constexpr bool valid_option_value(int option, int64_t value) noexcept
+#else
+inline bool valid_option_value(int option, int64_t value) noexcept
+#endif
+{
+    switch (option) {
+        case ZMQ_SNDHWM:
+        case ZMQ_RCVHWM:
+        case ZMQ_BACKLOG:
+            return value >= 0;
+        case ZMQ_LINGER:
+        case ZMQ_SNDBUF:
+        case ZMQ_RCVBUF:
+        case ZMQ_SNDTIMEO:
+        case ZMQ_RCVTIMEO:
+        case ZMQ_RECONNECT_IVL:
+        case ZMQ_MAXMSGSIZE:
+        case ZMQ_TCP_KEEPALIVE_CNT:
+        case ZMQ_TCP_KEEPALIVE_IDLE:
+        case ZMQ_TCP_KEEPALIVE_INTVL:
+            return value >= -1;
+        case ZMQ_TCP_KEEPALIVE:
+            return value >= -1 && value <= 1;
+        case ZMQ_RECONNECT_IVL_MAX:
+#ifdef ZMQ_HEARTBEAT_IVL
+        case ZMQ_HEARTBEAT_IVL:
+        case ZMQ_HEARTBEAT_TIMEOUT:
+        case ZMQ_HEARTBEAT_TTL:
+#endif
+            return value >= 0;
+        default:
+            return true;
+    }
+}
+} // namespace detail
+
+/*  Thrown when libzmq rejects an option of a socket_profile_t or
+    socket_config, e.g. because it does not apply to the socket type.
+*/
+class socket_profile_error : public error_t
+{
+  public:
+    explicit socket_profile_error(int option) : _option(option) {}
+
+    // The rejected option.
+    int option() const noexcept { return _option; }
+
+  private:
+    int _option;
+};
+
+/*  A named set of socket options applied in one go.
+
+    Values are range checked when they are added to the profile, so an
+    invalid profile fails before any socket is touched. Setting an
+    option twice keeps the last value, options are applied in the order
+    they were first set. make_socket() and profiled_socket_t apply a
+    profile at creation and close the socket again if libzmq rejects an
+    option, so a half configured socket is never handed out.
+
+        auto profile = zmq::socket_profile_t::bulk_throughput()
+                         .set(zmq::sockopt::linger, 0);
+        zmq::socket_t push = zmq::make_socket(ctx, zmq::socket_type::push,
+                                              profile);
+*/
+class socket_profile_t
+{
+  public:
+    explicit socket_profile_t(std::string name = "custom") : _name(std::move(name))
+    {
+    }
+
+    // Throws: std::invalid_argument if val is out of range for the option.
+    template<int Opt, class T, bool BoolUnit>
+    socket_profile_t &set(sockopt::integral_option<Opt, T, BoolUnit>, const T &val)
+    {
+        static_assert(std::is_integral<T>::value, "T must be integral");
+        if (!detail::valid_option_value(Opt, static_cast<int64_t>(val)))
+            throw std::invalid_argument("socket profile " + _name + ": value "
+                                        + std::to_string(val)
+                                        + " out of range for option "
+                                        + std::to_string(Opt));
+        return set_option(Opt, &val, sizeof val);
+    }
+
+    template<int Opt, class T>
+    socket_profile_t &set(sockopt::integral_option<Opt, T, true>, bool val)
+    {
+        static_assert(std::is_integral<T>::value, "T must be integral");
+        const T rep_val = val;
+        return set_option(Opt, &rep_val, sizeof rep_val);
+    }
+
+    template<int Opt, int NullTerm>
+    socket_profile_t &set(sockopt::array_option<Opt, NullTerm>,
+                          const std::string &buf)
+    {
+        return set_option(Opt, buf.data(), buf.size());
+    }
+
+    template<int Opt, int NullTerm>
+    socket_profile_t &set(sockopt::array_option<Opt, NullTerm>, const_buffer buf)
+    {
+        return set_option(Opt, buf.data(), buf.size());
+    }
+
+    /*  Set all options of the profile on socket.
+
+        Throws: socket_profile_error for the first option libzmq rejects,
+        the options before it remain set.
+    */
+    void apply(socket_ref socket) const
+    {
+        for (const auto &e : _entries) {
+            if (zmq_setsockopt(socket.handle(), e.option, e.value.data(),
+                               e.value.size())
+                != 0)
+                throw socket_profile_error(e.option);
+        }
+    }
+
+    // Returns: true if the profile sets option.
+    bool contains(int option) const noexcept
+    {
+        return std::any_of(_entries.begin(), _entries.end(),
+                           [option](const entry &e) { return e.option == option; });
+    }
+
+    const std::string &name() const noexcept { return _name; }
+    size_t size() const noexcept { return _entries.size(); }
+
+    // Encoding of the options, equal for profiles setting equal options
+    // regardless of name and order.
+    std::string encoded() const
+    {
+        std::vector<const entry *> sorted;
+        for (const auto &e : _entries)
+            sorted.push_back(&e);
+        std::sort(sorted.begin(), sorted.end(), [](const entry *a, const entry *b) {
+            return a->option < b->option;
+        });
+        std::string out;
+        for (const entry *e : sorted) {
+            const uint32_t head[2] = {static_cast<uint32_t>(e->option),
+                                      static_cast<uint32_t>(e->value.size())};
+            out.append(reinterpret_cast<const char *>(head), sizeof head);
+            out.append(e->value);
+        }
+        return out;
+    }
+
+    /*  Short queues that are dropped on close, messages are only queued
+        to completed connections and reconnects are fast.
+    */
+    static socket_profile_t low_latency()
+    {
+        socket_profile_t profile("low_latency");
+        profile.set(sockopt::sndhwm, 1000)
+          .set(sockopt::rcvhwm, 1000)
+          .set(sockopt::linger, 0)
+          .set(sockopt::immediate, true)
+          .set(sockopt::reconnect_ivl, 10)
+          .set(sockopt::reconnect_ivl_max, 100);
+        return profile;
+    }
+
+    // Deep queues and large kernel buffers for streaming large volumes.
+    static socket_profile_t bulk_throughput()
+    {
+        socket_profile_t profile("bulk_throughput");
+        profile.set(sockopt::sndhwm, 100000)
+          .set(sockopt::rcvhwm, 100000)
+          .set(sockopt::sndbuf, 4 * 1024 * 1024)
+          .set(sockopt::rcvbuf, 4 * 1024 * 1024);
+        return profile;
+    }
+
+    /*  For PUB/XPUB sockets serving many subscribers: a large accept
+        backlog, and keepalives so that dead subscribers are detected
+        and their queues released.
+    */
+    static socket_profile_t many_subscribers()
+    {
+        socket_profile_t profile("many_subscribers");
+        profile.set(sockopt::sndhwm, 10000)
+          .set(sockopt::backlog, 1024)
+          .set(sockopt::tcp_keepalive, 1)
+          .set(sockopt::tcp_keepalive_idle, 60)
+          .set(sockopt::tcp_keepalive_intvl, 10)
+          .set(sockopt::tcp_keepalive_cnt, 3);
+#ifdef ZMQ_HEARTBEAT_IVL
+        profile.set(sockopt::heartbeat_ivl, 5000)
+          .set(sockopt::heartbeat_timeout, 15000);
+#endif
+        return profile;
+    }
+
+  private:
+    struct entry
+    {
+        int option;
+        std::string value;
+    };
+
+    socket_profile_t &set_option(int option, const void *data, size_t size)
+    {
+        std::string value(static_cast<const char *>(data), size);
+        for (auto &e : _entries) {
+            if (e.option == option) {
+                e.value = std::move(value);
+                return *this;
+            }
+        }
+        _entries.push_back(entry{option, std::move(value)});
+        return *this;
+    }
+
+    std::string _name;
+    std::vector<entry> _entries;
+};
+
+/*  Create a socket with profile applied.
+
+    Throws: socket_profile_error if an option is rejected,
+    the socket is closed in that case.
+*/
+inline socket_t
+make_socket(context_t &context, socket_type type, const socket_profile_t &profile)
+{
+    socket_t socket(context, type);
+    profile.apply(socket);
+    return socket;
+}
+
+/*  A socket created with a profile that caches the options which can
+    not change during its lifetime, so that hot paths reading them do
+    not call zmq_getsockopt. Options that may change, e.g.
+    sockopt::events or the options of the profile, are read from libzmq.
+*/
+class profiled_socket_t : public socket_t
+{
+  public:
+    // Throws: socket_profile_error if an option is rejected.
+    profiled_socket_t(context_t &context, socket_type type, socket_profile_t profile) :
+        socket_t(context, type), _type(type), _profile(std::move(profile))
+    {
+        _profile.apply(*this);
+        _fd = socket_t::get(sockopt::fd);
+    }
+
+    using socket_t::get;
+
+    ZMQ_NODISCARD int get(sockopt::type_t) const noexcept
+    {
+        return static_cast<int>(_type);
+    }
+
+    ZMQ_NODISCARD sockopt::cppzmq_fd_t get(sockopt::fd_t) const noexcept { return _fd; }
+
+    socket_type type() const noexcept { return _type; }
+
+    const socket_profile_t &profile() const noexcept { return _profile; }
+
+  private:
+    socket_type _type;
+    sockopt::cppzmq_fd_t _fd;
+    socket_profile_t _profile;
+};
+
+#endif // ZMQ_CPP11
+
+#ifdef ZMQ_CPP11
+
+namespace detail
+{
+template<class Option> struct option_traits;
+
+template<int Opt, class T, bool BoolUnit>
+struct option_traits<sockopt::integral_option<Opt, T, BoolUnit>>
+{
+    static constexpr int id = Opt;
+    using value_type = T;
+};
+
+template<int Id, class... Values> struct contains_option : std::false_type
+{
+};
+
+template<int Id, class Head, class... Tail>
+struct contains_option<Id, Head, Tail...>
+    : std::integral_constant<bool,
+                             Head::id == Id || contains_option<Id, Tail...>::value>
+{
+};
+
+template<class... Values> struct unique_options : std::true_type
+{
+};
+
+template<class Head, class... Tail>
+struct unique_options<Head, Tail...>
+    : std::integral_constant<bool,
+                             !contains_option<Head::id, Tail...>::value
+                               && unique_options<Tail...>::value>
+{
+};
+
+template<int Id, class... Values> struct find_option;
+
+template<int Id, class Head, class... Tail>
+struct find_option<Id, Head, Tail...>
+    : std::conditional<Head::id == Id, Head, find_option<Id, Tail...>>::type
+{
+};
+} // namespace detail
+
+/*  Compile time binding of an integral socket option to a value, e.g.
+    `zmq::option_value<zmq::sockopt::sndhwm_t, 1000>`.
+
+    The value must be a constant of the option's type and is range
+    checked at compile time from C++14 on.
+*/
+template<class Option, typename detail::option_traits<Option>::value_type Value>
+struct option_value
+{
+    using option_type = Option;
+    using value_type = typename detail::option_traits<Option>::value_type;
+    static constexpr int id = detail::option_traits<Option>::id;
+    static constexpr value_type value = Value;
+
+#ifdef ZMQ_CPP14
+    static_assert(detail::valid_option_value(id, static_cast<int64_t>(Value)),
+                  "socket option value out of range");
+#endif
+};
+
+/*  A set of socket options fixed at compile time.
+
+    apply() expands to one zmq_setsockopt call per option without any
+    runtime lookup, so creating many short lived sockets with the same
+    options is cheap. The options can be inspected in static_assert:
+
+        using worker_config =
+          zmq::socket_config<zmq::option_value<zmq::sockopt::linger_t, 0>,
+                             zmq::option_value<zmq::sockopt::sndhwm_t, 100>>;
+        static_assert(worker_config::get<zmq::sockopt::sndhwm_t>() == 100, "");
+        zmq::socket_t s = worker_config::make(ctx, zmq::socket_type::dealer);
+
+    Array options (strings, binary data) have no compile time values and
+    are set on the socket as usual.
+*/
+template<class... Values> class socket_config
+{
+    static_assert(detail::unique_options<Values...>::value,
+                  "socket option set twice in socket_config");
+
+  public:
+    static constexpr size_t size() noexcept { return sizeof...(Values); }
+
+    template<class Option> static constexpr bool contains() noexcept
+    {
+        return detail::contains_option<detail::option_traits<Option>::id,
+                                       Values...>::value;
+    }
+
+    template<class Option>
+    static constexpr typename detail::option_traits<Option>::value_type get() noexcept
+    {
+        return detail::find_option<detail::option_traits<Option>::id,
+                                   Values...>::value;
+    }
+
+    /*  Set all options on socket, in order.
+
+        Throws: socket_profile_error for the first option libzmq rejects,
+        the options before it remain set.
+    */
+    static void apply(socket_ref socket)
+    {
+        const int expand[] = {0, (apply_one<Values>(socket.handle()), 0)...};
+        (void) expand;
+    }
+
+    /*  Create a socket with the options applied.
+
+        Throws: socket_profile_error if an option is rejected,
+        the socket is closed in that case.
+    */
+    static socket_t make(context_t &context, socket_type type)
+    {
+        socket_t socket(context, type);
+        apply(socket);
+        return socket;
+    }
+
+  private:
+    template<class Value> static void apply_one(void *handle)
+    {
+        const typename Value::value_type val = Value::value;
+        if (zmq_setsockopt(handle, Value::id, &val, sizeof val) != 0)
+            throw socket_profile_error(Value::id);
+    }
+};
+
+#endif // ZMQ_CPP11
+
+#if defined(ZMQ_CPP11) && defined(ZMQ_NEW_MONITOR_EVENT_LAYOUT)
+
+namespace detail
+{
+struct pooled_socket
+{
+    pooled_socket(context_t &context, socket_type type) : socket(context, type) {}
+
+    socket_t socket;
+    // declared after socket, so that it stops monitoring first
+    monitor_t monitor;
+    // a disconnect was seen after the last connect
+    bool disconnected{false};
+    std::thread::id owner;
+};
+} // namespace detail
+
+/*  A pool of connected sockets, keyed by socket type, endpoint and
+    socket_profile_t options, for tasks that would otherwise create,
+    connect and handshake a socket of their own.
+
+    acquire() leases an idle socket of the key, preferring one last
+    used by the calling thread, or creates and connects a new one. The
+    lease returns the socket when it is destroyed, at most max_idle
+    sockets are kept per key and the oldest beyond that are closed.
+
+    Each pooled socket is monitored. An idle socket is not leased again
+    but closed if it was disconnected since its last connect, if it has
+    unread messages left by the previous task, or if it is a REQ socket
+    waiting for a reply. Use lease::discard() for sockets left in a
+    state the next task can not use.
+
+    The pool is thread safe, a lease must only be used by one thread at
+    a time. The pool must outlive its leases.
+*/
+class socket_pool_t
+{
+  public:
+    class lease
+    {
+      public:
+        lease() = default;
+        lease(lease &&other) noexcept :
+            _pool(other._pool), _key(std::move(other._key)), _entry(std::move(other._entry))
+        {
+            other._pool = nullptr;
+        }
+        lease &operator=(lease &&other) noexcept
+        {
+            release();
+            _pool = other._pool;
+            _key = std::move(other._key);
+            _entry = std::move(other._entry);
+            other._pool = nullptr;
+            return *this;
+        }
+        ~lease() { release(); }
+
+        socket_t &socket() noexcept { return _entry->socket; }
+        socket_t *operator->() noexcept { return &_entry->socket; }
+        operator socket_ref() noexcept { return _entry->socket; }
+        explicit operator bool() const noexcept { return _entry != nullptr; }
+
+        // Close the socket instead of returning it to the pool.
+        void discard() noexcept
+        {
+            _entry.reset();
+            _pool = nullptr;
+        }
+
+      private:
+        friend class socket_pool_t;
+
+        lease(socket_pool_t *pool,
+              std::string key,
+              std::unique_ptr<detail::pooled_socket> entry) :
+            _pool(pool), _key(std::move(key)), _entry(std::move(entry))
+        {
+        }
+
+        void release() noexcept
+        {
+            if (_pool && _entry)
+                _pool->release(std::move(_key), std::move(_entry));
+            _pool = nullptr;
+        }
+
+        socket_pool_t *_pool{nullptr};
+        std::string _key;
+        std::unique_ptr<detail::pooled_socket> _entry;
+    };
+
+    struct stats
+    {
+        uint64_t hits;      // leases served from idle sockets
+        uint64_t misses;    // leases that created a socket
+        uint64_t unhealthy; // idle sockets closed by the health check
+        uint64_t evicted;   // sockets closed beyond max_idle
+    };
+
+    explicit socket_pool_t(context_t &context, size_t max_idle = 8) :
+        _context(context), _max_idle(max_idle)
+    {
+    }
+
+    socket_pool_t(const socket_pool_t &) = delete;
+    socket_pool_t &operator=(const socket_pool_t &) = delete;
+
+    /*  Lease a socket of type connected to endpoint with profile applied.
+
+        Throws: error_t if a new socket can not be created or connected,
+                socket_profile_error if the profile is rejected.
+    */
+    lease acquire(socket_type type,
+                  const std::string &endpoint,
+                  const socket_profile_t &profile = socket_profile_t())
+    {
+        std::string key = std::to_string(static_cast<int>(type)) + '\n' + endpoint
+                          + '\n' + profile.encoded();
+        while (auto entry = take_idle(key)) {
+            if (healthy(*entry, type)) {
+                count(&stats::hits);
+                return lease(this, std::move(key), std::move(entry));
+            }
+            count(&stats::unhealthy);
+        }
+        count(&stats::misses);
+        std::unique_ptr<detail::pooled_socket> entry(
+          new detail::pooled_socket(_context, type));
+        profile.apply(entry->socket);
+        entry->monitor.init(entry->socket, next_monitor_endpoint(),
+                            ZMQ_EVENT_CONNECTED | ZMQ_EVENT_DISCONNECTED
+                              | ZMQ_EVENT_CLOSED);
+        entry->socket.connect(endpoint);
+        return lease(this, std::move(key), std::move(entry));
+    }
+
+    // Close all idle sockets.
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _idle.clear();
+    }
+
+    // Number of idle sockets over all keys.
+    size_t idle() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        size_t count = 0;
+        for (const auto &idle : _idle)
+            count += idle.second.size();
+        return count;
+    }
+
+    size_t max_idle() const noexcept { return _max_idle; }
+
+    stats statistics() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _stats;
+    }
+
+  private:
+    using entry_ptr = std::unique_ptr<detail::pooled_socket>;
+
+    // Take the newest idle socket of key, preferring the calling thread's.
+    entry_ptr take_idle(const std::string &key)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        const auto found = _idle.find(key);
+        if (found == _idle.end() || found->second.empty())
+            return nullptr;
+        auto &idle = found->second;
+        const auto self = std::this_thread::get_id();
+        auto it = std::find_if(idle.rbegin(), idle.rend(),
+                               [self](const entry_ptr &e) { return e->owner == self; });
+        auto pos = it == idle.rend() ? std::prev(idle.end()) : std::prev(it.base());
+        entry_ptr entry = std::move(*pos);
+        idle.erase(pos);
+        return entry;
+    }
+
+    void release(std::string key, entry_ptr entry) noexcept
+    {
+        entry->owner = std::this_thread::get_id();
+        entry_ptr evicted;
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto &idle = _idle[std::move(key)];
+        idle.push_back(std::move(entry));
+        if (idle.size() > _max_idle) {
+            evicted = std::move(idle.front());
+            idle.pop_front();
+            ++_stats.evicted;
+        }
+    }
+
+    static bool healthy(detail::pooled_socket &entry, socket_type type)
+    {
+        entry.monitor.drain_events([&entry](const monitor_event &event) {
+            entry.disconnected = event.event != ZMQ_EVENT_CONNECTED;
+        });
+        if (entry.disconnected)
+            return false;
+        const int events = entry.socket.get(sockopt::events);
+        if (events & ZMQ_POLLIN)
+            return false;
+        return type != socket_type::req || (events & ZMQ_POLLOUT);
+    }
+
+    std::string next_monitor_endpoint()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        std::ostringstream endpoint;
+        endpoint << "inproc://socket-pool-monitor-" << this << '-' << ++_monitors;
+        return endpoint.str();
+    }
+
+    void count(uint64_t stats::*counter)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        ++(_stats.*counter);
+    }
+
+    context_t &_context;
+    size_t _max_idle;
+    mutable std::mutex _mutex;
+    std::unordered_map<std::string, std::deque<entry_ptr>> _idle;
+    uint64_t _monitors{0};
+    stats _stats{};
+};
+
+#endif // defined(ZMQ_CPP11) && defined(ZMQ_NEW_MONITOR_EVENT_LAYOUT)
+
+#ifdef ZMQ_CPP11
+
+namespace detail
+{
+/*  Unbounded intrusive queue of multipart messages (Vyukov's MPSC
+    queue). push is wait-free, a single atomic exchange, and safe from
+    any thread. pop must only be called by one thread.
+*/
+class mpsc_message_queue
+{
+  public:
+    struct node
+    {
+        std::atomic<node *> next{nullptr};
+        message_t msg;               // first part
+        std::vector<message_t> more; // further parts
+        std::promise<void> *flushed{nullptr}; // set for flush markers
+    };
+
+    mpsc_message_queue() : _head(&_stub)
+    {
+        _tail.value.store(&_stub, std::memory_order_relaxed);
+    }
+
+    ~mpsc_message_queue()
+    {
+        while (node *n = pop())
+            delete n;
+    }
+
+    mpsc_message_queue(const mpsc_message_queue &) = delete;
+    mpsc_message_queue &operator=(const mpsc_message_queue &) = delete;
+
+    void push(node *n) noexcept
+    {
+        n->next.store(nullptr, std::memory_order_relaxed);
+        node *prev = _tail.value.exchange(n, std::memory_order_acq_rel);
+        prev->next.store(n, std::memory_order_release);
+    }
+
+    // Oldest node or nullptr if empty or the next push is still in progress.
+    node *pop() noexcept
+    {
+        node *head = _head;
+        node *next = head->next.load(std::memory_order_acquire);
+        if (head == &_stub) {
+            if (!next)
+                return nullptr;
+            _head = head = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next) {
+            _head = next;
+            return head;
+        }
+        if (head != _tail.value.load(std::memory_order_acquire))
+            return nullptr;
+        // head is the last node, put the stub behind it to unlink it
+        push(&_stub);
+        next = head->next.load(std::memory_order_acquire);
+        if (!next)
+            return nullptr;
+        _head = next;
+        return head;
+    }
+
+  private:
+    node _stub;
+    node *_head; // only accessed by the popping thread
+    detail::cache_line_padded<std::atomic<node *>> _tail;
+};
+} // namespace detail
+
+/*  Facade making a socket usable for sending from any number of threads,
+    for socket types that are not thread safe, e.g. one PUB shared by a
+    pool of workers.
+
+    The socket is moved to a thread of its own. send() moves the
+    message into a wait-free queue, without copying the payload, and
+    returns without waiting for the socket. The owning thread drains
+    all queued messages at once into the socket and sleeps while the
+    queue is empty, so a busy facade sends without system calls beyond
+    those of libzmq. Messages of one sending thread keep their order,
+    multipart messages are never interleaved.
+
+    Receiving is not supported. Sends block in the owning thread, which
+    suits types that drop or queue without blocking (PUB, RADIO) or
+    peers that keep up. If the socket throws, e.g. on context
+    termination, the facade stops: queued messages are dropped and
+    send() and flush() rethrow the error.
+
+    The destructor sends all queued messages before the socket is
+    closed, no thread may send concurrently with destruction.
+*/
+class shared_socket_t
+{
+  public:
+    explicit shared_socket_t(socket_t socket) :
+        _socket(std::move(socket)), _thread(&shared_socket_t::run, this)
+    {
+    }
+
+    ~shared_socket_t()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _wake.notify_one();
+        _thread.join();
+    }
+
+    shared_socket_t(const shared_socket_t &) = delete;
+    shared_socket_t &operator=(const shared_socket_t &) = delete;
+
+    /*  Queue msg for sending, leaving it empty.
+
+        Returns: the size of msg.
+        Throws: the error that stopped the facade.
+    */
+    size_t send(message_t &msg)
+    {
+        check();
+        const size_t size = msg.size();
+        std::unique_ptr<node> n(new node);
+        n->msg.move(msg);
+        push(n.release());
+        return size;
+    }
+
+    size_t send(message_t &&msg) { return send(msg); }
+
+    size_t send(const_buffer buf)
+    {
+        message_t msg(buf.data(), buf.size());
+        return send(msg);
+    }
+
+    /*  Queue a multipart message, moving each message out of msgs.
+
+        Returns: the number of parts queued.
+        Throws: the error that stopped the facade.
+    */
+    template<class Range
+#ifndef ZMQ_CPP11_PARTIAL
+             ,
+             typename = typename std::enable_if<
+               detail::is_range<Range>::value
+               && std::is_same<detail::range_value_t<Range>, message_t>::value>::type
+#endif
+             >
+    size_t send_multipart(Range &&msgs)
+    {
+        check();
+        std::unique_ptr<node> n(new node);
+        size_t count = 0;
+        for (message_t &part : msgs) {
+            if (count++ == 0)
+                n->msg.move(part);
+            else
+                n->more.emplace_back(std::move(part));
+        }
+        if (count == 0)
+            return 0;
+        push(n.release());
+        return count;
+    }
+
+    /*  Wait until all messages queued before the call were passed to
+        the socket.
+
+        Throws: the error that stopped the facade.
+    */
+    void flush()
+    {
+        check();
+        std::promise<void> flushed;
+        std::unique_ptr<node> n(new node);
+        n->flushed = &flushed;
+        push(n.release());
+        flushed.get_future().wait();
+        check();
+    }
+
+    // Number of messages passed to the socket.
+    uint64_t sent() const noexcept { return _sent.load(std::memory_order_relaxed); }
+
+    // Number of messages dropped after the facade stopped.
+    uint64_t dropped() const noexcept
+    {
+        return _dropped.load(std::memory_order_relaxed);
+    }
+
+  private:
+    using node = detail::mpsc_message_queue::node;
+
+    void check() const
+    {
+        if (_failed.load(std::memory_order_acquire))
+            std::rethrow_exception(_error);
+    }
+
+    void push(node *n)
+    {
+        _queue.push(n);
+        // pairs with the fence in run, see there
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_sleeping.value.load(std::memory_order_relaxed)
+            && _sleeping.value.exchange(false)) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _wake.notify_one();
+        }
+    }
+
+    void run() noexcept
+    {
+        while (true) {
+            if (drain() > 0)
+                continue;
+            // announce sleeping before looking again, either the
+            // look sees a new message or its sender sees the flag
+            _sleeping.value.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (drain() > 0) {
+                _sleeping.value.store(false, std::memory_order_relaxed);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_stopping) {
+                lock.unlock();
+                drain();
+                return;
+            }
+            _wake.wait(lock, [this] {
+                return !_sleeping.value.load(std::memory_order_relaxed)
+                       || _stopping;
+            });
+            _sleeping.value.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    // Send all queued messages, returns the number of nodes taken.
+    size_t drain() noexcept
+    {
+        size_t count = 0;
+        while (node *n = _queue.pop()) {
+            std::unique_ptr<node> owned(n);
+            ++count;
+            if (n->flushed) {
+                n->flushed->set_value();
+                continue;
+            }
+            if (_failed.load(std::memory_order_relaxed)) {
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            try {
+                send_node(*n);
+                _sent.fetch_add(1, std::memory_order_relaxed);
+            }
+            catch (...) {
+                _error = std::current_exception();
+                _failed.store(true, std::memory_order_release);
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        return count;
+    }
+
+    void send_node(node &n)
+    {
+        const bool multipart = !n.more.empty();
+        _socket.send(n.msg, multipart ? send_flags::sndmore : send_flags::none);
+        for (size_t i = 0; i < n.more.size(); ++i) {
+            const bool more = i + 1 < n.more.size();
+            _socket.send(n.more[i], more ? send_flags::sndmore : send_flags::none);
+        }
+    }
+
+    socket_t _socket;
+    detail::mpsc_message_queue _queue;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    bool _stopping{false};
+    detail::cache_line_padded<std::atomic<bool>> _sleeping;
+    std::atomic<bool> _failed{false};
+    std::exception_ptr _error;
+    std::atomic<uint64_t> _sent{0};
+    std::atomic<uint64_t> _dropped{0};
+    std::thread _thread; // last, started once all members are initialized
+};
+
+#endif // ZMQ_CPP11
+
+#ifdef ZMQ_CPP11
+
+namespace detail
+{
+/*  Buffers of messages filled by the caller, recycled once libzmq
+    releases the message. The free_fn of a message shares ownership of
+    the pool, so messages may outlive the owner of the pool.
+*/
+class message_buffer_pool
+    : public std::enable_shared_from_this<message_buffer_pool>
+{
+  public:
+    explicit message_buffer_pool(size_t max_pooled_bytes) :
+        _max_pooled_bytes(max_pooled_bytes)
+    {
+    }
+
+    ~message_buffer_pool()
+    {
+        for (auto &blocks : _free)
+            for (block *b : blocks)
+                destroy(b);
+    }
+
+    message_buffer_pool(const message_buffer_pool &) = delete;
+    message_buffer_pool &operator=(const message_buffer_pool &) = delete;
+
+    // A message of size bytes with unspecified content.
+    message_t allocate(size_t size)
+    {
+        const unsigned size_class = class_of(size);
+        block *b = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto &blocks = _free[size_class];
+            if (!blocks.empty()) {
+                b = blocks.back();
+                blocks.pop_back();
+                _pooled_bytes -= capacity(size_class);
+            }
+        }
+        if (!b) {
+            b = new (::operator new(sizeof(block) + capacity(size_class))) block;
+            b->size_class = size_class;
+        }
+        b->pool = shared_from_this();
+        return message_t(b + 1, size, &release, b);
+    }
+
+    size_t pooled_bytes() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _pooled_bytes;
+    }
+
+  private:
+    struct block
+    {
+        std::shared_ptr<message_buffer_pool> pool; // set while in use
+        unsigned size_class;
+        // buffer follows
+    };
+
+    static unsigned class_of(size_t size) noexcept
+    {
+        unsigned size_class = 6;
+        while (capacity(size_class) < size)
+            ++size_class;
+        return size_class;
+    }
+
+    static size_t capacity(unsigned size_class) noexcept
+    {
+        return size_t(1) << size_class;
+    }
+
+    static void destroy(block *b) noexcept
+    {
+        b->~block();
+        ::operator delete(b);
+    }
+
+    static void release(void *, void *hint) noexcept
+    {
+        block *b = static_cast<block *>(hint);
+        const std::shared_ptr<message_buffer_pool> pool = std::move(b->pool);
+        std::lock_guard<std::mutex> lock(pool->_mutex);
+        const size_t size = capacity(b->size_class);
+        if (pool->_pooled_bytes + size > pool->_max_pooled_bytes) {
+            destroy(b);
+            return;
+        }
+        pool->_free[b->size_class].push_back(b);
+        pool->_pooled_bytes += size;
+    }
+
+    mutable std::mutex _mutex;
+    std::vector<block *> _free[sizeof(size_t) * 8];
+    size_t _pooled_bytes{0};
+    size_t _max_pooled_bytes;
+};
+} // namespace detail
+
+/*  Compression algorithm used by compression_codec_t.
+
+    Implementations must be usable from one thread at a time, the codec
+    does not share them between threads.
+*/
+class compressor_t
+{
+  public:
+    virtual ~compressor_t() = default;
+
+    // Identifies the algorithm on the wire, sender and receiver must agree.
+    virtual unsigned char id() const noexcept = 0;
+
+    // Upper bound of the compressed size of size bytes.
+    virtual size_t bound(size_t size) const noexcept = 0;
+
+    /*  Compress src into dst, which holds at least bound(src.size())
+        bytes.
+
+        Returns: the compressed size.
+    */
+    virtual size_t compress(const_buffer src, mutable_buffer dst) = 0;
+
+    /*  Decompress src into dst, sized to the original size.
+
+        Returns: false if src is malformed or does not decompress to
+        exactly dst.size() bytes.
+    */
+    virtual bool decompress(const_buffer src, mutable_buffer dst) = 0;
+
+    /*  Use dict as content preceding every message, so that small
+        messages can refer to it. Sender and receiver must use the same
+        dictionary, an empty dict removes it.
+
+        Returns: false if dictionaries are not supported.
+    */
+    virtual bool set_dictionary(const_buffer dict)
+    {
+        (void) dict;
+        return false;
+    }
+};
+
+/*  Byte oriented LZ77 compressor without dependencies, in the spirit of
+    LZ4: greedy matching through a hash table of 4 byte sequences within
+    a 64 KiB window, fast on both sides at moderate ratios.
+
+    A compressed block is a sequence of [token][literal length]
+    [literals][offset][match length]. The token holds the literal length
+    in its high and the match length minus 4 in its low nibble, a nibble
+    of 15 is continued in bytes added up until one is below 255. The
+    offset is 2 bytes little-endian. The last sequence has literals only.
+
+    With a dictionary, offsets reaching before the start of a message
+    refer to the end of the dictionary. Only the last 64 KiB of a
+    dictionary are used.
+*/
+class lz_compressor_t : public compressor_t
+{
+  public:
+    enum : unsigned char
+    {
+        compressor_id = 1
+    };
+
+    unsigned char id() const noexcept override { return compressor_id; }
+
+    size_t bound(size_t size) const noexcept override
+    {
+        return size + size / 255 + 16;
+    }
+
+    size_t compress(const_buffer src, mutable_buffer dst) override
+    {
+        const unsigned char *in = static_cast<const unsigned char *>(src.data());
+        size_t size = src.size();
+        size_t pos = 0;
+        if (_dictionary.empty()) {
+            std::fill(std::begin(_table), std::end(_table), 0u);
+        } else {
+            // compress the message as continuation of the dictionary
+            if (_dictionary_table.empty())
+                index_dictionary();
+            std::copy(_dictionary_table.begin(), _dictionary_table.end(), _table);
+            _window.assign(_dictionary.begin(), _dictionary.end());
+            _window.insert(_window.end(), in, in + size);
+            in = _window.data();
+            pos = _dictionary.size();
+            size = _window.size();
+        }
+        unsigned char *op = static_cast<unsigned char *>(dst.data());
+        unsigned char *const start = op;
+        size_t anchor = pos;
+        while (size >= min_match && pos <= size - min_match) {
+            const uint32_t seq = load32(in + pos);
+            uint32_t &slot = _table[hash(seq)];
+            const size_t candidate = slot;
+            slot = static_cast<uint32_t>(pos + 1);
+            if (candidate == 0 || pos - (candidate - 1) > max_offset
+                || load32(in + candidate - 1) != seq) {
+                ++pos;
+                continue;
+            }
+            const size_t ref = candidate - 1;
+            size_t length = min_match;
+            while (pos + length < size && in[ref + length] == in[pos + length])
+                ++length;
+            op = put_sequence(op, in + anchor, pos - anchor, length - min_match);
+            *op++ = static_cast<unsigned char>((pos - ref) & 0xFF);
+            *op++ = static_cast<unsigned char>((pos - ref) >> 8);
+            op = put_length(op, length - min_match);
+            pos += length;
+            anchor = pos;
+        }
+        op = put_sequence(op, in + anchor, size - anchor, 0);
+        assert(static_cast<size_t>(op - start) <= dst.size());
+        return static_cast<size_t>(op - start);
+    }
+
+    bool decompress(const_buffer src, mutable_buffer dst) override
+    {
+        const unsigned char *ip = static_cast<const unsigned char *>(src.data());
+        const unsigned char *const iend = ip + src.size();
+        unsigned char *const out = static_cast<unsigned char *>(dst.data());
+        const size_t out_size = dst.size();
+        size_t op = 0;
+        while (true) {
+            // a block ends with a literal sequence, also for truncated input
+            if (ip == iend)
+                return false;
+            const unsigned char token = *ip++;
+            size_t literals = token >> 4;
+            if (!get_length(ip, iend, literals)
+                || literals > static_cast<size_t>(iend - ip)
+                || literals > out_size - op)
+                return false;
+            std::copy(ip, ip + literals, out + op);
+            ip += literals;
+            op += literals;
+            if (ip == iend)
+                return op == out_size;
+            if (iend - ip < 2)
+                return false;
+            const size_t offset = ip[0] | static_cast<size_t>(ip[1]) << 8;
+            ip += 2;
+            size_t length = token & 0x0F;
+            if (offset == 0 || offset > op + _dictionary.size()
+                || !get_length(ip, iend, length)
+                || length + min_match > out_size - op)
+                return false;
+            length += min_match;
+            // byte by byte, the match may overlap its own output
+            for (; length > 0 && offset > op; --length, ++op)
+                out[op] = _dictionary[_dictionary.size() + op - offset];
+            for (; length > 0; --length, ++op)
+                out[op] = out[op - offset];
+        }
+    }
+
+    bool set_dictionary(const_buffer dict) override
+    {
+        const unsigned char *data = static_cast<const unsigned char *>(dict.data());
+        const size_t size = std::min<size_t>(dict.size(), max_offset);
+        _dictionary.assign(data + dict.size() - size, data + dict.size());
+        _dictionary_table.clear();
+        return true;
+    }
+
+  private:
+    enum : size_t
+    {
+        min_match = 4,
+        max_offset = 65535,
+        hash_bits = 12
+    };
+
+    static uint32_t load32(const unsigned char *p) noexcept
+    {
+        uint32_t value;
+        std::memcpy(&value, p, sizeof value);
+        return value;
+    }
+
+    static uint32_t hash(uint32_t seq) noexcept
+    {
+        return (seq * 2654435761u) >> (32 - hash_bits);
+    }
+
+    static unsigned char *put_length(unsigned char *op, size_t length) noexcept
+    {
+        if (length < 15)
+            return op;
+        for (length -= 15; length >= 255; length -= 255)
+            *op++ = 255;
+        *op++ = static_cast<unsigned char>(length);
+        return op;
+    }
+
+    static unsigned char *put_sequence(unsigned char *op,
+                                       const unsigned char *literals,
+                                       size_t count,
+                                       size_t match) noexcept
+    {
+        *op++ = static_cast<unsigned char>((std::min<size_t>(count, 15) << 4)
+                                           | std::min<size_t>(match, 15));
+        op = put_length(op, count);
+        return std::copy(literals, literals + count, op);
+    }
+
+    // Continue a length nibble of 15, false on truncated input.
+    static bool get_length(const unsigned char *&ip,
+                           const unsigned char *iend,
+                           size_t &length) noexcept
+    {
+        if (length != 15)
+            return true;
+        unsigned char byte;
+        do {
+            if (ip == iend)
+                return false;
+            byte = *ip++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    }
+
+    // hash table of the dictionary alone, copied to start each message
+    void index_dictionary()
+    {
+        _dictionary_table.assign(size_t(1) << hash_bits, 0u);
+        for (size_t pos = 0; pos + min_match <= _dictionary.size(); ++pos)
+            _dictionary_table[hash(load32(&_dictionary[pos]))] =
+              static_cast<uint32_t>(pos + 1);
+    }
+
+    uint32_t _table[size_t(1) << hash_bits]; // position + 1 of a sequence
+    std::vector<unsigned char> _dictionary;
+    std::vector<uint32_t> _dictionary_table;
+    std::vector<unsigned char> _window; // dictionary followed by the message
+};
+
+namespace detail
+{
+struct compression_dictionary
+{
+    uint32_t id;
+    std::string data;
+};
+
+inline uint32_t get_uint32(const unsigned char *buf) noexcept
+{
+    return static_cast<uint32_t>(buf[0]) << 24 | static_cast<uint32_t>(buf[1]) << 16
+           | static_cast<uint32_t>(buf[2]) << 8 | buf[3];
+}
+
+inline void put_uint32(std::string &out, uint32_t value)
+{
+    for (int shift = 24; shift >= 0; shift -= 8)
+        out.push_back(static_cast<char>((value >> shift) & 0xFF));
+}
+} // namespace detail
+
+/*  Builds a compression dictionary from sampled messages.
+
+    Every sample_every-th part passed to add() is kept, up to
+    max_sample_bytes in total. train() scores 32 byte segments of the
+    samples by how many samples share their 8 byte sequences and
+    concatenates the best segments, the best last, closest to the
+    messages. Sequences are only counted once, so repeated content is
+    not selected twice.
+*/
+class dictionary_trainer_t
+{
+  public:
+    explicit dictionary_trainer_t(size_t sample_every = 1,
+                                  size_t max_sample_bytes = size_t(1) << 20) :
+        _sample_every(sample_every ? sample_every : 1),
+        _max_sample_bytes(max_sample_bytes)
+    {
+    }
+
+    void add(const_buffer part)
+    {
+        if (_offered++ % _sample_every != 0
+            || _sample_bytes + part.size() > _max_sample_bytes)
+            return;
+        const char *data = static_cast<const char *>(part.data());
+        _samples.emplace_back(data, data + part.size());
+        _sample_bytes += part.size();
+    }
+
+    /*  Sample the parts of msgs.
+
+        The range must be a ForwardRange of zmq::message_t,
+        zmq::const_buffer or zmq::mutable_buffer.
+    */
+    template<class Range
+#ifndef ZMQ_CPP11_PARTIAL
+             ,
+             typename = typename std::enable_if<
+               detail::is_range<Range>::value
+               && (std::is_same<detail::range_value_t<Range>, message_t>::value
+                   || detail::is_buffer<detail::range_value_t<Range>>::value)>::type
+#endif
+             >
+    void add_multipart(const Range &msgs)
+    {
+        for (const auto &part : msgs)
+            add(const_buffer(part.data(), part.size()));
+    }
+
+    // A dictionary of at most dictionary_size bytes, empty without samples.
+    std::string train(size_t dictionary_size = 16384) const
+    {
+        // number of samples containing each sequence
+        struct sequence_count
+        {
+            uint32_t samples;
+            uint32_t last; // index + 1 of the last sample counted
+        };
+        std::unordered_map<uint64_t, sequence_count> counts;
+        for (size_t i = 0; i < _samples.size(); ++i) {
+            const std::string &sample = _samples[i];
+            for (size_t pos = 0; pos + sequence_size <= sample.size(); ++pos) {
+                sequence_count &count = counts[load64(&sample[pos])];
+                if (count.last != i + 1) {
+                    count.last = static_cast<uint32_t>(i + 1);
+                    ++count.samples;
+                }
+            }
+        }
+
+        struct segment
+        {
+            uint64_t score;
+            size_t sample;
+            size_t offset;
+            bool operator<(const segment &other) const noexcept
+            {
+                return score < other.score;
+            }
+        };
+        const auto score = [&](const segment &seg) {
+            const std::string &sample = _samples[seg.sample];
+            const size_t end = std::min(seg.offset + segment_size, sample.size());
+            uint64_t total = 0;
+            for (size_t pos = seg.offset; pos + sequence_size <= end; ++pos) {
+                const uint32_t shared = counts[load64(&sample[pos])].samples;
+                // content of a single sample does not recur
+                if (shared > 1)
+                    total += shared;
+            }
+            return total;
+        };
+
+        std::priority_queue<segment> queue;
+        for (size_t i = 0; i < _samples.size(); ++i) {
+            for (size_t offset = 0; offset + sequence_size <= _samples[i].size();
+                 offset += segment_size / 2) {
+                segment seg{0, i, offset};
+                seg.score = score(seg);
+                if (seg.score > 0)
+                    queue.push(seg);
+            }
+        }
+
+        // greedy selection, scores only drop as sequences are taken, so a
+        // segment still scoring at least the next best one is the best
+        std::vector<std::string> selected;
+        size_t size = 0;
+        while (!queue.empty() && size < dictionary_size) {
+            segment seg = queue.top();
+            queue.pop();
+            seg.score = score(seg);
+            if (seg.score == 0)
+                continue;
+            if (!queue.empty() && seg.score < queue.top().score) {
+                queue.push(seg);
+                continue;
+            }
+            const std::string &sample = _samples[seg.sample];
+            const size_t length =
+              std::min({static_cast<size_t>(segment_size), sample.size() - seg.offset,
+                        dictionary_size - size});
+            for (size_t pos = seg.offset; pos + sequence_size <= seg.offset + length;
+                 ++pos)
+                counts[load64(&sample[pos])].samples = 0;
+            selected.push_back(sample.substr(seg.offset, length));
+            size += length;
+        }
+
+        std::string dictionary;
+        dictionary.reserve(size);
+        for (auto it = selected.rbegin(); it != selected.rend(); ++it)
+            dictionary += *it;
+        return dictionary;
+    }
+
+    size_t samples() const noexcept { return _samples.size(); }
+    size_t sample_bytes() const noexcept { return _sample_bytes; }
+
+  private:
+    enum : size_t
+    {
+        sequence_size = 8,
+        segment_size = 32
+    };
+
+    static uint64_t load64(const char *p) noexcept
+    {
+        uint64_t value;
+        std::memcpy(&value, p, sizeof value);
+        return value;
+    }
+
+    size_t _sample_every;
+    size_t _max_sample_bytes;
+    size_t _offered{0};
+    size_t _sample_bytes{0};
+    std::vector<std::string> _samples;
+};
+
+/*  Transparent compression of multipart messages.
+
+    send() compresses parts of at least threshold bytes and keeps those
+    that shrink, the others are sent unchanged. A leading header frame
+    marks the compressed parts: a 4 byte magic, the compressor id and
+    one varint per part holding its original size, or 0 for a part sent
+    as is. recv() strips the header and decompresses into message
+    buffers recycled from a pool once the received messages are
+    released. Messages without header are passed on unchanged, their
+    first frame must not start with the magic 0xC1 'Z' 'C' of codec
+    frames.
+
+    The header is always the first frame, so PUB/SUB topic prefixes
+    match the header instead of the topic. Subscribers of a codec
+    stream must subscribe to the magic (or to everything) and filter
+    topics after recv().
+
+    Small messages hardly compress on their own. With set_dictionary()
+    they are compressed against a dictionary shared by both sides, e.g.
+    built by dictionary_trainer_t from sampled traffic. The dictionary
+    is announced in-band on a single frame control message before the
+    first message using it, and the header of each such message carries
+    the dictionary id, a hash of its content. recv() consumes
+    announcements and keeps the last max_dictionaries dictionaries, so
+    messages in flight during a change decompress. Announcements start
+    with the magic of codec frames as well, late joining subscribers
+    need a repeated send_dictionary().
+
+    The compressor is pluggable, lz_compressor_t is the default. A codec
+    must only be used by one thread at a time.
+*/
+class compression_codec_t
+{
+  public:
+    enum : uint32_t
+    {
+        // first 4 bytes of codec frames, 0xC1 'Z' 'C' followed by the kind
+        frame_magic = 0xC15A4300
+    };
+    enum : unsigned char
+    {
+        header_frame = 1, // [magic 1][compressor id][sizes]
+        // [magic 2][compressor id][4 byte dictionary id][sizes]
+        dictionary_header_frame = 2,
+        // [magic 3][4 byte dictionary id][dictionary]
+        dictionary_frame = 3
+    };
+    enum : size_t
+    {
+        max_dictionaries = 4
+    };
+
+    struct stats
+    {
+        uint64_t compressed_parts; // parts sent compressed
+        uint64_t raw_bytes;        // their size before compression
+        uint64_t wire_bytes;       // their size after compression
+    };
+
+    explicit compression_codec_t(
+      size_t threshold = 256,
+      std::unique_ptr<compressor_t> compressor = std::unique_ptr<compressor_t>(
+        new lz_compressor_t),
+      size_t max_part_size = size_t(1) << 28,
+      size_t max_pooled_bytes = size_t(1) << 24) :
+        _threshold(threshold),
+        _max_part_size(max_part_size),
+        _compressor(std::move(compressor)),
+        _pool(std::make_shared<detail::message_buffer_pool>(max_pooled_bytes)),
+        _stats{}
+    {
+    }
+
+    compression_codec_t(const compression_codec_t &) = delete;
+    compression_codec_t &operator=(const compression_codec_t &) = delete;
+
+    /*  Compress against dictionary from the next message on, announcing
+        it first. An empty dictionary stops the use of dictionaries.
+
+        Throws: std::invalid_argument if the compressor does not support
+                dictionaries.
+    */
+    void set_dictionary(std::string dictionary)
+    {
+        if (dictionary.empty()) {
+            _dictionary.reset();
+            _announce = false;
+            return;
+        }
+        const uint32_t id = dictionary_id(buffer(dictionary));
+        auto dict = std::make_shared<const detail::compression_dictionary>(
+          detail::compression_dictionary{id, std::move(dictionary)});
+        if (!_compressor->set_dictionary(buffer(dict->data)))
+            throw std::invalid_argument("compressor does not support dictionaries");
+        _installed = dict;
+        _dictionary = std::move(dict);
+        _announce = true;
+    }
+
+    // Id of the dictionary used for sending, 0 if none.
+    uint32_t dictionary_id() const noexcept
+    {
+        return _dictionary ? _dictionary->id : 0;
+    }
+
+    // Id of a dictionary, FNV-1a of its content, never 0.
+    static uint32_t dictionary_id(const_buffer dictionary) noexcept
+    {
+        const unsigned char *data = static_cast<const unsigned char *>(dictionary.data());
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < dictionary.size(); ++i)
+            hash = (hash ^ data[i]) * 16777619u;
+        return hash ? hash : 1;
+    }
+
+    // Whether recv() learned the dictionary of id.
+    bool has_dictionary(uint32_t id) const noexcept
+    {
+        return find_dictionary(id) != nullptr;
+    }
+
+    /*  Announce the dictionary used for sending, e.g. again for peers
+        connected since the last announcement.
+
+        Returns: the size of the dictionary or nullopt (on EAGAIN).
+        Throws: std::logic_error if no dictionary is set.
+    */
+    send_result_t send_dictionary(socket_ref s, send_flags flags = send_flags::none)
+    {
+        if (!_dictionary)
+            throw std::logic_error("no compression dictionary set");
+        std::string frame;
+        frame.reserve(8 + _dictionary->data.size());
+        detail::put_uint32(frame,
+                           frame_magic | static_cast<uint32_t>(dictionary_frame));
+        detail::put_uint32(frame, _dictionary->id);
+        frame += _dictionary->data;
+        if (!s.send(buffer(frame), flags & ~send_flags::sndmore))
+            return {};
+        _announce = false;
+        return _dictionary->data.size();
+    }
+
+    /*  Send msgs with a compression header, compressing large parts.
+
+        The range must be a ForwardRange of zmq::message_t,
+        zmq::const_buffer or zmq::mutable_buffer. Messages in the range
+        sent uncompressed are consumed as by send_multipart.
+        Returns: the number of parts of msgs sent or nullopt (on EAGAIN).
+    */
+    template<class Range
+#ifndef ZMQ_CPP11_PARTIAL
+             ,
+             typename = typename std::enable_if<
+               detail::is_range<Range>::value
+               && (std::is_same<detail::range_value_t<Range>, message_t>::value
+                   || detail::is_buffer<detail::range_value_t<Range>>::value)>::type
+#endif
+             >
+    send_result_t send(socket_ref s, Range &&msgs, send_flags flags = send_flags::none)
+    {
+        flags = flags & ~send_flags::sndmore;
+        if (_announce && !send_dictionary(s, flags))
+            return {};
+        std::string header;
+        if (_dictionary) {
+            detail::put_uint32(
+              header, frame_magic | static_cast<uint32_t>(dictionary_header_frame));
+            header.push_back(static_cast<char>(_compressor->id()));
+            detail::put_uint32(header, _dictionary->id);
+        } else {
+            detail::put_uint32(header,
+                               frame_magic | static_cast<uint32_t>(header_frame));
+            header.push_back(static_cast<char>(_compressor->id()));
+        }
+        const size_t header_size = header.size();
+        install(_dictionary);
+        _compressed.clear();
+        stats sent{};
+        for (const auto &part : msgs) {
+            const size_t size = part.size();
+            if (size < _threshold || size == 0) {
+                detail::put_varint(header, 0);
+                continue;
+            }
+            _scratch.resize(_compressor->bound(size));
+            const size_t compressed = _compressor->compress(
+              const_buffer(part.data(), size), buffer(_scratch));
+            if (compressed >= size) {
+                detail::put_varint(header, 0);
+                continue;
+            }
+            detail::put_varint(header, size);
+            _compressed.emplace_back(_scratch.data(), compressed);
+            ++sent.compressed_parts;
+            sent.raw_bytes += size;
+            sent.wire_bytes += compressed;
+        }
+
+        auto it = detail::ranges::begin(msgs);
+        const auto end = detail::ranges::end(msgs);
+        if (!s.send(buffer(header), it == end ? flags : flags | send_flags::sndmore))
+            return {};
+        const unsigned char *sizes =
+          reinterpret_cast<const unsigned char *>(header.data()) + header_size;
+        const unsigned char *const sizes_end =
+          reinterpret_cast<const unsigned char *>(header.data()) + header.size();
+        auto compressed = _compressed.begin();
+        size_t count = 0;
+        while (it != end) {
+            const auto next = std::next(it);
+            const auto part_flags = next == end ? flags : flags | send_flags::sndmore;
+            uint64_t size;
+            detail::get_varint(sizes, sizes_end, size);
+            if (size != 0)
+                s.send(*compressed++, part_flags);
+            else
+                s.send(*it, part_flags);
+            ++count;
+            it = next;
+        }
+        _stats.compressed_parts += sent.compressed_parts;
+        _stats.raw_bytes += sent.raw_bytes;
+        _stats.wire_bytes += sent.wire_bytes;
+        return count;
+    }
+
+    /*  Receive a message, stripping its compression header and
+        decompressing its parts. Dictionary announcements received
+        before the message are consumed.
+
+        The parts are written to OutputIterator out.
+        Returns: the number of parts written or nullopt (on EAGAIN).
+        Throws: std::runtime_error on a malformed header, part or
+                announcement or an unknown dictionary, the message is
+                consumed in that case.
+    */
+    template<class OutputIt>
+    recv_result_t recv(socket_ref s, OutputIt out, recv_flags flags = recv_flags::none)
+    {
+        message_t header;
+        do {
+            if (!s.recv(header, flags))
+                return {};
+        } while (learn_dictionary(header));
+        _received.clear();
+        bool more = header.more();
+        while (more) {
+            message_t part;
+            // zmq ensures atomic delivery of messages
+            const auto ret = s.recv(part, recv_flags::none);
+            assert(ret);
+            (void) ret;
+            more = part.more();
+            _received.push_back(std::move(part));
+        }
+
+        const unsigned char *sizes = header.data<unsigned char>();
+        const unsigned char *const sizes_end = sizes + header.size();
+        const int kind = frame_kind(header);
+        if (kind != header_frame && kind != dictionary_header_frame) {
+            *out++ = std::move(header);
+            for (auto &part : _received)
+                *out++ = std::move(part);
+            return _received.size() + 1;
+        }
+        const bool with_dictionary = kind == dictionary_header_frame;
+        if (header.size() < (with_dictionary ? 9u : 5u))
+            throw std::runtime_error("Malformed compression header");
+        if (sizes[4] != _compressor->id())
+            throw std::runtime_error("Unknown compressor id "
+                                     + std::to_string(sizes[4]));
+        std::shared_ptr<const detail::compression_dictionary> dictionary;
+        if (with_dictionary) {
+            const uint32_t id = detail::get_uint32(sizes + 5);
+            dictionary = find_dictionary(id);
+            if (!dictionary)
+                throw std::runtime_error("Unknown compression dictionary "
+                                         + std::to_string(id));
+            sizes += 9;
+        } else {
+            sizes += 5;
+        }
+        for (auto &part : _received) {
+            uint64_t size;
+            if (!detail::get_varint(sizes, sizes_end, size))
+                throw std::runtime_error("Malformed compression header");
+            if (size == 0)
+                continue;
+            if (size > _max_part_size)
+                throw std::runtime_error("Compressed part exceeds max_part_size");
+            install(dictionary);
+            message_t decompressed = _pool->allocate(static_cast<size_t>(size));
+            if (!_compressor->decompress(
+                  const_buffer(part.data(), part.size()),
+                  mutable_buffer(decompressed.data(), decompressed.size())))
+                throw std::runtime_error("Malformed compressed part");
+            part = std::move(decompressed);
+        }
+        if (sizes != sizes_end)
+            throw std::runtime_error("Malformed compression header");
+        for (auto &part : _received)
+            *out++ = std::move(part);
+        return _received.size();
+    }
+
+    stats statistics() const noexcept { return _stats; }
+
+    size_t threshold() const noexcept { return _threshold; }
+
+    // Bytes held by released receive buffers for reuse.
+    size_t pooled_bytes() const { return _pool->pooled_bytes(); }
+
+  private:
+    using dictionary_ptr = std::shared_ptr<const detail::compression_dictionary>;
+
+    // Kind of a codec frame, -1 for frames without the magic.
+    static int frame_kind(const message_t &frame) noexcept
+    {
+        if (frame.size() < 4)
+            return -1;
+        const uint32_t magic = detail::get_uint32(frame.data<unsigned char>());
+        if ((magic & 0xFFFFFF00u) != frame_magic)
+            return -1;
+        return static_cast<int>(magic & 0xFF);
+    }
+
+    // Make dictionary the one of the compressor, if not already.
+    void install(const dictionary_ptr &dictionary)
+    {
+        if (dictionary == _installed)
+            return;
+        const const_buffer data =
+          dictionary ? buffer(dictionary->data) : const_buffer();
+        if (!_compressor->set_dictionary(data) && dictionary)
+            throw std::runtime_error("compressor does not support dictionaries");
+        _installed = dictionary;
+    }
+
+    dictionary_ptr find_dictionary(uint32_t id) const noexcept
+    {
+        if (_dictionary && _dictionary->id == id)
+            return _dictionary;
+        for (const auto &dictionary : _known)
+            if (dictionary->id == id)
+                return dictionary;
+        return nullptr;
+    }
+
+    // Store the dictionary of an announcement, false for other messages.
+    bool learn_dictionary(const message_t &frame)
+    {
+        if (frame.more() || frame_kind(frame) != dictionary_frame)
+            return false;
+        const unsigned char *data = frame.data<unsigned char>();
+        if (frame.size() < 9)
+            throw std::runtime_error("Malformed compression dictionary");
+        const uint32_t id = detail::get_uint32(data + 4);
+        const const_buffer content(data + 8, frame.size() - 8);
+        if (dictionary_id(content) != id)
+            throw std::runtime_error("Malformed compression dictionary");
+        if (!has_dictionary(id)) {
+            _known.push_back(std::make_shared<const detail::compression_dictionary>(
+              detail::compression_dictionary{
+                id, std::string(static_cast<const char *>(content.data()),
+                                content.size())}));
+            if (_known.size() > max_dictionaries)
+                _known.pop_front();
+        }
+        return true;
+    }
+
+    size_t _threshold;
+    size_t _max_part_size;
+    std::unique_ptr<compressor_t> _compressor;
+    std::shared_ptr<detail::message_buffer_pool> _pool;
+    std::vector<unsigned char> _scratch;
+    std::vector<message_t> _compressed;
+    std::vector<message_t> _received;
+    dictionary_ptr _dictionary; // used for sending
+    dictionary_ptr _installed;  // set in the compressor
+    std::deque<dictionary_ptr> _known; // learned by recv
+    bool _announce{false};
+    stats _stats;
+};
+
+#endif // ZMQ_CPP11
+
+#ifdef ZMQ_CPP11
+
+enum class byte_order
+{
+    little,
+    big,
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    native = big
+#else
+    native = little
+#endif
+};
+
+/*  Integer stored in a fixed byte order, for fields of structs sent with
+    message_builder and received with message_view. Converts on access,
+    which is free if Order is the native byte order. Alignment is 1, so
+    such fields add no padding.
+*/
+template<class T, byte_order Order> class endian_value
+{
+    static_assert(std::is_integral<T>::value || std::is_enum<T>::value,
+                  "endian_value requires an integral or enum type");
+
+  public:
+    endian_value() = default;
+    endian_value(T value) noexcept { store(value); }
+
+    endian_value &operator=(T value) noexcept
+    {
+        store(value);
+        return *this;
+    }
+
+    operator T() const noexcept { return load(); }
+
+    T load() const noexcept
+    {
+        unsigned char bytes[sizeof(T)];
+        std::memcpy(bytes, _bytes, sizeof(T));
+        if (Order != byte_order::native)
+            std::reverse(bytes, bytes + sizeof(T));
+        T value;
+        std::memcpy(&value, bytes, sizeof(T));
+        return value;
+    }
+
+    void store(T value) noexcept
+    {
+        std::memcpy(_bytes, &value, sizeof(T));
+        if (Order != byte_order::native)
+            std::reverse(_bytes, _bytes + sizeof(T));
+    }
+
+  private:
+    unsigned char _bytes[sizeof(T)];
+};
+
+template<class T> using little_endian = endian_value<T, byte_order::little>;
+template<class T> using big_endian = endian_value<T, byte_order::big>;
+
+namespace detail
+{
+// Whether the data of msg is aligned for T and stays aligned if msg is
+// moved, which moves data stored inline in the zmq_msg_t.
+template<class T> bool stably_aligned(const message_t &msg) noexcept
+{
+    const auto data = reinterpret_cast<std::uintptr_t>(msg.data());
+    const auto handle = reinterpret_cast<std::uintptr_t>(msg.handle());
+    if (data >= handle && data < handle + sizeof(zmq_msg_t))
+        return alignof(T) <= alignof(zmq_msg_t) && (data - handle) % alignof(T) == 0;
+    return data % alignof(T) == 0;
+}
+
+inline void aligned_message_free(void *, void *hint) noexcept
+{
+    ::operator delete(hint);
+}
+
+// A message of size bytes with data aligned to alignment.
+inline message_t aligned_message(size_t size, size_t alignment)
+{
+    void *const block = ::operator new(size + alignment - 1);
+    void *data = block;
+    size_t space = size + alignment - 1;
+    std::align(alignment, size, data, space);
+    try {
+        return message_t(data, size, &aligned_message_free, block);
+    }
+    catch (...) {
+        ::operator delete(block);
+        throw;
+    }
+}
+} // namespace detail
+
+/*  Builds a message holding a T, brace-initialized in place in the
+    message data, which is aligned for T. T must be trivially copyable,
+    use endian_value fields for a layout independent of the host byte
+    order.
+
+        message_builder<order> builder(id, price, quantity, side);
+        socket.send(builder.release(), send_flags::none);
+*/
+template<class T> class message_builder
+{
+    static_assert(ZMQ_IS_TRIVIALLY_COPYABLE(T),
+                  "message_builder requires a trivially copyable type");
+
+  public:
+    template<class... Args> explicit message_builder(Args &&... args)
+    {
+        _msg.rebuild(sizeof(T));
+        if (!detail::stably_aligned<T>(_msg))
+            _msg = detail::aligned_message(sizeof(T), alignof(T));
+        ::new (_msg.data()) T{std::forward<Args>(args)...};
+    }
+
+    T *get() noexcept { return _msg.data<T>(); }
+    T &operator*() noexcept { return *get(); }
+    T *operator->() noexcept { return get(); }
+
+    // The message holding the T, the builder is empty afterwards.
+    message_t release() noexcept { return std::move(_msg); }
+
+  private:
+    message_t _msg;
+};
+
+/*  Read only access to a T received in a message, without copying if
+    the message data is suitably aligned. Otherwise, and for small
+    messages stored inline, the T is copied once into the view.
+
+    Throws: std::runtime_error if the message size is not sizeof(T).
+*/
+template<class T> class message_view
+{
+    static_assert(ZMQ_IS_TRIVIALLY_COPYABLE(T),
+                  "message_view requires a trivially copyable type");
+
+  public:
+    explicit message_view(message_t msg) : _msg(std::move(msg))
+    {
+        if (_msg.size() != sizeof(T))
+            throw std::runtime_error("Invalid size, expected "
+                                     + std::to_string(sizeof(T)) + " bytes");
+        _copied = !detail::stably_aligned<T>(_msg);
+        if (_copied)
+            std::memcpy(_copy, _msg.data(), sizeof(T));
+    }
+
+    const T *get() const noexcept
+    {
+        return _copied ? reinterpret_cast<const T *>(_copy) : _msg.data<T>();
+    }
+    const T &operator*() const noexcept { return *get(); }
+    const T *operator->() const noexcept { return get(); }
+
+    // Whether the T had to be copied out of the message.
+    bool copied() const noexcept { return _copied; }
+
+    const message_t &message() const noexcept { return _msg; }
+
+  private:
+    message_t _msg;
+    bool _copied;
+    alignas(T) unsigned char _copy[sizeof(T)];
+};
+
+#endif // ZMQ_CPP11
+
+#ifdef ZMQ_CPP11
+
+/*  Field of a message_schema holding a T, stored in place. T must be
+    trivially copyable, endian_value types give a host independent layout.
+*/
+template<class T> struct schema_field
+{
+    static_assert(ZMQ_IS_TRIVIALLY_COPYABLE(T),
+                  "schema_field requires a trivially copyable type");
+
+    using value_type = T;
+
+    static constexpr size_t slot_size() noexcept { return sizeof(T); }
+
+    static size_t data_size(const T &) noexcept { return 0; }
+
+    static void write(unsigned char *msg, size_t slot, size_t &, const T &value) noexcept
+    {
+        std::memcpy(msg + slot, &value, sizeof(T));
+    }
+
+    static T read(const unsigned char *msg, size_t, size_t slot) noexcept
+    {
+        T value;
+        std::memcpy(&value, msg + slot, sizeof(T));
+        return value;
+    }
+};
+
+/*  Variable length field of a message_schema. Its slot holds the
+    offset and size of the bytes, stored after all slots, as 4 byte
+    little-endian integers. Reads refer to the message data.
+*/
+struct schema_bytes
+{
+    using value_type = const_buffer;
+
+    static constexpr size_t slot_size() noexcept { return 8; }
+
+    static size_t data_size(const_buffer value) noexcept { return value.size(); }
+
+    static void
+    write(unsigned char *msg, size_t slot, size_t &data, const_buffer value) noexcept
+    {
+        const little_endian<uint32_t> ref[2] = {static_cast<uint32_t>(data),
+                                                static_cast<uint32_t>(value.size())};
+        std::memcpy(msg + slot, ref, sizeof ref);
+        if (value.size() > 0)
+            std::memcpy(msg + data, value.data(), value.size());
+        data += value.size();
+    }
+
+    static const_buffer read(const unsigned char *msg, size_t size, size_t slot)
+    {
+        little_endian<uint32_t> ref[2];
+        std::memcpy(ref, msg + slot, sizeof ref);
+        const size_t offset = ref[0];
+        const size_t length = ref[1];
+        if (offset > size || length > size - offset)
+            throw std::out_of_range("Malformed schema message, bytes out of bounds");
+        return const_buffer(msg + offset, length);
+    }
+};
+
+namespace detail
+{
+constexpr size_t sum_first(size_t) noexcept
+{
+    return 0;
+}
+
+template<class... Tail>
+constexpr size_t sum_first(size_t n, size_t head, Tail... tail) noexcept
+{
+    return n == 0 ? 0 : head + sum_first(n - 1, tail...);
+}
+} // namespace detail
+
+/*  Compile time description of a message layout, encoded into a single
+    message_t with random access to its fields.
+
+        using quote = message_schema<1, schema_field<little_endian<uint64_t>>,
+                                     schema_bytes>;
+        message_t msg = quote::encode(uint64_t(42), buffer(symbol));
+        const quote::reader r(msg);
+        const uint64_t id = r.get<0>();
+
+    A message starts with a 4 byte header holding the schema version and
+    the number of fields, both 2 byte little-endian. A fixed size slot
+    per field follows, at offsets known at compile time, then the data
+    of variable length fields.
+
+    Schemas evolve by appending fields. Readers of an older schema
+    ignore the additional fields, readers of a newer schema see the
+    fields missing in older messages as absent and read them as value
+    initialized or empty.
+*/
+template<uint16_t Version, class... Fields> class message_schema
+{
+  public:
+    template<size_t I>
+    using field = typename std::tuple_element<I, std::tuple<Fields...>>::type;
+    template<size_t I> using value_type = typename field<I>::value_type;
+
+    static constexpr uint16_t version() noexcept { return Version; }
+    static constexpr size_t field_count() noexcept { return sizeof...(Fields); }
+    static constexpr size_t header_size() noexcept { return 4; }
+
+    // Offset of the slot of field I.
+    template<size_t I> static constexpr size_t offset() noexcept
+    {
+        return header_size() + detail::sum_first(I, Fields::slot_size()...);
+    }
+
+    // Size of a message without variable length data.
+    static constexpr size_t fixed_size() noexcept
+    {
+        return offset<sizeof...(Fields)>();
+    }
+
+    /*  Encode one value per field into a message.
+
+        Throws: std::range_error if the message exceeds 4 GiB.
+    */
+    template<class... Values> static message_t encode(const Values &... values)
+    {
+        static_assert(sizeof...(Values) == sizeof...(Fields),
+                      "encode requires one value per field");
+        const size_t size = fixed_size() + data_size<0>(values...);
+        if (size > std::numeric_limits<uint32_t>::max())
+            throw std::range_error("Invalid size, schema message too large");
+        message_t msg(size);
+        unsigned char *data = msg.data<unsigned char>();
+        const little_endian<uint16_t> header[2] = {
+          Version, static_cast<uint16_t>(sizeof...(Fields))};
+        std::memcpy(data, header, sizeof header);
+        size_t variable = fixed_size();
+        write<0>(data, variable, values...);
+        return msg;
+    }
+
+    /*  Reads fields of an encoded message on access, without copying the
+        message. The message must outlive the reader.
+    */
+    class reader
+    {
+      public:
+        /*  Throws: std::out_of_range if the message is too short for its
+                    header or the slots of the fields it has.
+        */
+        explicit reader(const message_t &msg) :
+            _data(msg.data<unsigned char>()), _size(msg.size())
+        {
+            if (_size < header_size())
+                throw std::out_of_range("Malformed schema message, no header");
+            little_endian<uint16_t> header[2];
+            std::memcpy(header, _data, sizeof header);
+            _version = header[0];
+            _fields = header[1];
+            const size_t known = std::min<size_t>(_fields, sizeof...(Fields));
+            const size_t slots = detail::sum_first(known, Fields::slot_size()...);
+            if (_size - header_size() < slots)
+                throw std::out_of_range("Malformed schema message, truncated slots");
+        }
+
+        // Version of the schema the message was encoded with.
+        uint16_t version() const noexcept { return _version; }
+
+        // Number of fields in the message, may differ from the schema.
+        size_t field_count() const noexcept { return _fields; }
+
+        template<size_t I> bool has() const noexcept { return I < _fields; }
+
+        /*  Value of field I, value initialized if absent.
+
+            Throws: std::out_of_range if a variable length field refers
+                    past the end of the message.
+        */
+        template<size_t I> value_type<I> get() const
+        {
+            static_assert(I < sizeof...(Fields), "field index out of range");
+            if (!has<I>())
+                return value_type<I>();
+            return field<I>::read(_data, _size, offset<I>());
+        }
+
+      private:
+        const unsigned char *_data;
+        size_t _size;
+        uint16_t _version;
+        size_t _fields;
+    };
+
+  private:
+    template<size_t I> static size_t data_size() noexcept { return 0; }
+
+    template<size_t I, class Value, class... Values>
+    static size_t data_size(const Value &value, const Values &... values) noexcept
+    {
+        return field<I>::data_size(value) + data_size<I + 1>(values...);
+    }
+
+    template<size_t I> static void write(unsigned char *, size_t &) noexcept {}
+
+    template<size_t I, class Value, class... Values>
+    static void write(unsigned char *data,
+                      size_t &variable,
+                      const Value &value,
+                      const Values &... values) noexcept
+    {
+        field<I>::write(data, offset<I>(), variable, value);
+        write<I + 1>(data, variable, values...);
+    }
+};
+
+#endif // ZMQ_CPP11
+
 } // namespace zmq
 
 #endif // __ZMQ_ADDON_HPP_INCLUDED__